@@ -0,0 +1,268 @@
+/**
+ * \file access_plan.c
+ * \brief Record access plan - field offsets resolved once per template pair.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "access_plan.h"
+
+#define PLAN_RESOLVE_IN(name) \
+   if (!ur_is_present(in_tmplt, F_##name)) { \
+      fprintf(stderr, "Error: Input template does not contain field " #name ".\n"); \
+      return -1; \
+   } \
+   plan->in[PLAN_IN_##name] = in_tmplt->offset[F_##name];
+
+#define PLAN_RESOLVE_FEATURE(name) \
+   if (ur_is_present(out_tmplt, F_##name)) { \
+      plan->features |= FEATURE_BIT(name); \
+      plan->out[PLAN_OUT_##name] = out_tmplt->offset[F_##name]; \
+   }
+
+#define PLAN_IS_FEATURE(name) \
+   if (id == F_##name) { \
+      return (features & FEATURE_BIT(name)) != 0; \
+   }
+
+/**
+ * Check whether the field is one of the features of the set
+ */
+static int plan_is_feature(ur_field_id_t id, feature_set_t features)
+{
+   FEATURE_FIELDS(PLAN_IS_FEATURE)
+   return 0;
+}
+
+int access_plan_build(access_plan_t *plan, const ur_template_t *in_tmplt, const ur_template_t *out_tmplt,
+                      int var_copy)
+{
+   PLAN_IN_FIELDS(PLAN_RESOLVE_IN)
+   plan->features = 0;
+   FEATURE_FIELDS(PLAN_RESOLVE_FEATURE)
+
+   // Copy runs in the order of the output record, neighbouring fields with the same layout on both sides are merged
+   plan_copy_run_t *copy = malloc(out_tmplt->count * sizeof(plan_copy_run_t));
+   plan_copy_run_t *zero = malloc(out_tmplt->count * sizeof(plan_copy_run_t));
+   plan_var_field_t *var = malloc(out_tmplt->count * sizeof(plan_var_field_t));
+   uint16_t copy_cnt = 0, zero_cnt = 0, var_cnt = 0;
+   if (copy == NULL || zero == NULL || var == NULL) {
+      free(copy);
+      free(zero);
+      free(var);
+      fprintf(stderr, "Error: Memory allocation problem (access plan).\n");
+      return -1;
+   }
+   // Dynamic parts are the same when both templates have the same variable length fields in the same order,
+   // array features are not part of the copied fields
+   int in_var_cnt = in_tmplt->first_dynamic < 0 ? 0 : in_tmplt->count - in_tmplt->first_dynamic;
+   int var_block = 1;
+   for (uint16_t i = 0; i < out_tmplt->count; i++) {
+      ur_field_id_t id = out_tmplt->ids[i];
+      if (plan_is_feature(id, plan->features)) {
+         continue;
+      }
+      if (ur_is_dynamic(id)) {
+         var_block = var_block && var_cnt < in_var_cnt && in_tmplt->ids[in_tmplt->first_dynamic + var_cnt] == id;
+         var[var_cnt].src = ur_is_present(in_tmplt, id) ? in_tmplt->offset[id] : PLAN_NO_FIELD;
+         var[var_cnt++].dst = out_tmplt->offset[id];
+         continue;
+      }
+      if (!ur_is_present(in_tmplt, id)) {
+         // Passed through from another input
+         uint16_t dst = out_tmplt->offset[id], len = ur_get_size(id);
+         if (zero_cnt > 0 && zero[zero_cnt - 1].dst + zero[zero_cnt - 1].len == dst) {
+            zero[zero_cnt - 1].len += len;
+         } else {
+            zero[zero_cnt++] = (plan_copy_run_t) { .src = PLAN_NO_FIELD, .dst = dst, .len = len };
+         }
+         continue;
+      }
+      uint16_t src = in_tmplt->offset[id], dst = out_tmplt->offset[id], len = ur_get_size(id);
+      plan_copy_run_t *last = copy_cnt > 0 ? &copy[copy_cnt - 1] : NULL;
+      if (last != NULL && last->src + last->len == src && last->dst + last->len == dst) {
+         last->len += len;
+      } else {
+         copy[copy_cnt++] = (plan_copy_run_t) { .src = src, .dst = dst, .len = len };
+      }
+   }
+   free(plan->copy);
+   plan->copy = copy;
+   plan->copy_cnt = copy_cnt;
+   free(plan->zero);
+   plan->zero = zero;
+   plan->zero_cnt = zero_cnt;
+
+   plan->var_block = var_block && in_var_cnt == var_cnt;
+   free(plan->var);
+   plan->var = var;
+   plan->var_cnt = var_cnt;
+   plan->var_copy = var_copy;
+   if (plan->len_bins == 0) {
+      plan->len_bins = PLAN_LEN_BINS_DEFAULT;
+   }
+   if (plan->len_bin_width == 0) {
+      plan->len_bin_width = PLAN_LEN_BIN_WIDTH_DEFAULT;
+   }
+   plan->len_bin_inv = 1.0f / plan->len_bin_width;
+   if (plan->burst_gap_us == 0) {
+      plan->burst_gap_us = PLAN_BURST_GAP_DEFAULT;
+   }
+
+   plan->in_static_size = ur_rec_fixlen_size(in_tmplt);
+   plan->out_static_size = ur_rec_fixlen_size(out_tmplt);
+   plan->in_tmplt = in_tmplt;
+   plan->out_tmplt = out_tmplt;
+   return 0;
+}
+
+/**
+ * Header of a variable length field
+ */
+#define PLAN_VAR_OFFSET(rec, hdr) (*(uint16_t *) ((uint8_t *) (rec) + (hdr)))
+#define PLAN_VAR_LEN(rec, hdr) (*(uint16_t *) ((uint8_t *) (rec) + (hdr) + 2))
+
+/**
+ * Leave all variable length fields of the output record empty
+ */
+static void plan_clear_var(const access_plan_t *plan, void *out_rec)
+{
+   for (uint16_t i = 0; i < plan->var_cnt; i++) {
+      PLAN_VAR_OFFSET(out_rec, plan->var[i].dst) = 0;
+      PLAN_VAR_LEN(out_rec, plan->var[i].dst) = 0;
+   }
+}
+
+uint32_t access_plan_copy_var(const access_plan_t *plan, const void *in_rec, uint16_t in_size, void *out_rec)
+{
+   const uint8_t *in_var = (const uint8_t *) in_rec + plan->in_static_size;
+   uint8_t *out_var = (uint8_t *) out_rec + plan->out_static_size;
+   uint32_t in_var_size = in_size - plan->in_static_size;
+   uint32_t size = 0;
+
+   if (!plan->var_copy) {
+      plan_clear_var(plan, out_rec);
+      return 0;
+   }
+
+   if (plan->var_block) {
+      // Headers (offsets relative to the dynamic part) stay valid, data are moved at once
+      for (uint16_t i = 0; i < plan->var_cnt; i++) {
+         uint32_t end = (uint32_t) PLAN_VAR_OFFSET(in_rec, plan->var[i].src) + PLAN_VAR_LEN(in_rec, plan->var[i].src);
+         size = end > size ? end : size;
+      }
+      if (size > in_var_size || plan->out_static_size + size > UR_MAX_SIZE) {
+         plan_clear_var(plan, out_rec);
+         return 0;
+      }
+      for (uint16_t i = 0; i < plan->var_cnt; i++) {
+         memcpy((uint8_t *) out_rec + plan->var[i].dst, (const uint8_t *) in_rec + plan->var[i].src, 4);
+      }
+      memcpy(out_var, in_var, size);
+      return size;
+   }
+
+   for (uint16_t i = 0; i < plan->var_cnt; i++) {
+      uint16_t src = plan->var[i].src, off = 0, len = 0;
+      if (src != PLAN_NO_FIELD) {
+         off = PLAN_VAR_OFFSET(in_rec, src);
+         len = PLAN_VAR_LEN(in_rec, src);
+      }
+      if ((uint32_t) off + len > in_var_size || plan->out_static_size + size + len > UR_MAX_SIZE) {
+         len = 0;
+      }
+      memcpy(out_var + size, in_var + off, len);
+      PLAN_VAR_OFFSET(out_rec, plan->var[i].dst) = size;
+      PLAN_VAR_LEN(out_rec, plan->var[i].dst) = len;
+      size += len;
+   }
+   return size;
+}
+
+char *access_plan_out_spec(const ur_template_t *const *in_tmplts, uint32_t in_cnt, feature_set_t features)
+{
+   size_t size = 1;
+
+   for (uint32_t t = 0; t < in_cnt; t++) {
+      for (uint16_t i = 0; i < in_tmplts[t]->count; i++) {
+         size += strlen(ur_get_name(in_tmplts[t]->ids[i])) + 1;
+      }
+   }
+   char *names = malloc(size);
+   uint8_t *added = calloc(ur_field_specs.ur_last_id + 1, 1);
+   if (names == NULL || added == NULL) {
+      free(names);
+      free(added);
+      return NULL;
+   }
+   names[0] = '\0';
+   for (uint32_t t = 0; t < in_cnt; t++) {
+      for (uint16_t i = 0; i < in_tmplts[t]->count; i++) {
+         ur_field_id_t id = in_tmplts[t]->ids[i];
+         if (added[id] || plan_is_feature(id, features)) {
+            continue; // features are added at the end
+         }
+         added[id] = 1;
+         if (names[0] != '\0') {
+            strcat(names, ",");
+         }
+         strcat(names, ur_get_name(id));
+      }
+   }
+   char *spec = feature_set_spec(names, features);
+   free(names);
+   free(added);
+   return spec;
+}
+
+void access_plan_free(access_plan_t *plan)
+{
+   free(plan->copy);
+   free(plan->zero);
+   free(plan->var);
+   plan->copy = NULL;
+   plan->copy_cnt = 0;
+   plan->zero = NULL;
+   plan->zero_cnt = 0;
+   plan->var = NULL;
+   plan->var_cnt = 0;
+}
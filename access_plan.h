@@ -0,0 +1,259 @@
+/**
+ * \file access_plan.h
+ * \brief Record access plan - field offsets resolved once per template pair.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef _ACCESS_PLAN_H_
+#define _ACCESS_PLAN_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <unirec/unirec.h>
+#include "fields.h"
+#include "feature_set.h"
+#include "shard.h"
+
+/**
+ * Input fields read by process_flow()
+ */
+#define PLAN_IN_FIELDS(X) \
+   X(DST_IP) \
+   X(SRC_IP) \
+   X(BYTES) \
+   X(BYTES_REV) \
+   X(TIME_FIRST) \
+   X(TIME_LAST) \
+   X(PACKETS) \
+   X(PACKETS_REV) \
+   X(PPI_PKT_DIRECTIONS) \
+   X(PPI_PKT_LENGTHS) \
+   X(PPI_PKT_TIMES) \
+   X(PPI_PKT_FLAGS)
+
+/**
+ * Output fields written by process_flow(), features may be missing in the output template.
+ * All other fields of the output template are copied from the input record.
+ */
+#define PLAN_OUT_FIELDS(X) \
+   FEATURE_FIELDS(X)
+
+#define PLAN_IN_ENUM(name) PLAN_IN_##name,
+#define PLAN_OUT_ENUM(name) PLAN_OUT_##name,
+
+enum {
+   PLAN_IN_FIELDS(PLAN_IN_ENUM)
+   PLAN_IN_CNT
+};
+
+enum {
+   PLAN_OUT_FIELDS(PLAN_OUT_ENUM)
+   PLAN_OUT_CNT
+};
+
+/**
+ * Contiguous block of fixed length fields copied from input to output record
+ */
+typedef struct plan_copy_run_s {
+   uint16_t src; ///< offset in the input record
+   uint16_t dst; ///< offset in the output record
+   uint16_t len; ///< number of bytes
+} plan_copy_run_t;
+
+/**
+ * Variable length field of the output template
+ */
+typedef struct plan_var_field_s {
+   uint16_t src; ///< offset of the (offset, length) header in the input record, PLAN_NO_FIELD if missing
+   uint16_t dst; ///< offset of the header in the output record
+} plan_var_field_t;
+
+#define PLAN_NO_FIELD UINT16_MAX
+
+/**
+ * Default packet length histogram: 16 bins of 100 bytes, the last one counts also all longer packets
+ */
+#define PLAN_LEN_BINS_DEFAULT 16
+#define PLAN_LEN_BIN_WIDTH_DEFAULT 100
+
+/**
+ * Default burst gap in microseconds, longer intervals between packets separate bursts
+ */
+#define PLAN_BURST_GAP_DEFAULT 100000
+
+/**
+ * Offsets of all fields used on the hot path, resolved once from the
+ * templates. For variable length fields the offset points to the 4 byte
+ * (offset, length) header in the fixed part of the record.
+ */
+typedef struct access_plan_s {
+   const ur_template_t *in_tmplt;  ///< input template the plan was built for
+   const ur_template_t *out_tmplt; ///< output template the plan was built for
+   uint16_t in_static_size;        ///< size of the fixed part of input records
+   uint16_t out_static_size;       ///< size of the fixed part of output records
+   feature_set_t features;         ///< features present in out_tmplt
+   uint16_t in[PLAN_IN_CNT];       ///< offsets of input fields
+   uint16_t out[PLAN_OUT_CNT];     ///< offsets of output fields
+   plan_copy_run_t *copy;          ///< fixed length fields shared by both templates, merged into runs
+   uint16_t copy_cnt;              ///< number of copy runs
+   plan_copy_run_t *zero;          ///< fixed length fields missing in the input, cleared (src is not used)
+   uint16_t zero_cnt;              ///< number of cleared runs
+   plan_var_field_t *var;          ///< variable length fields of out_tmplt in record order
+   uint16_t var_cnt;               ///< number of variable length fields
+   int var_copy;                   ///< variable length fields are filled from the input, left empty otherwise
+   int var_block;                  ///< variable length parts of both templates have the same layout
+   uint32_t shard_cnt;             ///< number of output interfaces records are routed to, set by the caller
+   shard_key_t shard_key;          ///< key routing records to the outputs, set by the caller
+   uint32_t len_bins;              ///< bins of the packet length histograms, set by the caller (default if 0)
+   uint32_t len_bin_width;         ///< width of the histogram bins in bytes, set by the caller (default if 0)
+   float len_bin_inv;              ///< 1 / len_bin_width
+   uint32_t burst_gap_us;          ///< burst gap in microseconds, set by the caller (default if 0)
+} access_plan_t;
+
+/**
+ * Read a fixed length input field
+ */
+#define PLAN_GET(plan, rec, name) \
+   (*(const F_##name##_T *) ((const uint8_t *) (rec) + (plan)->in[PLAN_IN_##name]))
+
+/**
+ * Pointer to the data of a variable length input field
+ */
+#define PLAN_GET_PTR(plan, rec, name) \
+   ((const F_##name##_T *) ((const uint8_t *) (rec) + (plan)->in_static_size + \
+                            *(const uint16_t *) ((const uint8_t *) (rec) + (plan)->in[PLAN_IN_##name])))
+
+/**
+ * Nonzero when the data of a variable length input field lie within the input
+ * record of size bytes (at least its fixed length part)
+ */
+#define PLAN_VAR_FITS(plan, rec, size, name) \
+   ((uint32_t) *(const uint16_t *) ((const uint8_t *) (rec) + (plan)->in[PLAN_IN_##name]) + \
+    *(const uint16_t *) ((const uint8_t *) (rec) + (plan)->in[PLAN_IN_##name] + 2) <= \
+    (uint32_t) (size) - (plan)->in_static_size)
+
+/**
+ * Number of elements of a variable length (array) input field
+ */
+#define PLAN_GET_CNT(plan, rec, name) \
+   ((uint32_t) (*(const uint16_t *) ((const uint8_t *) (rec) + (plan)->in[PLAN_IN_##name] + 2) / \
+                sizeof(F_##name##_T)))
+
+/**
+ * Write a fixed length output field
+ */
+#define PLAN_SET(plan, rec, name, value) \
+   (*(F_##name##_T *) ((uint8_t *) (rec) + (plan)->out[PLAN_OUT_##name]) = (value))
+
+/**
+ * Append cnt elements of an array feature to the variable length part of the
+ * output record, used bytes of which are already filled.
+ */
+#define PLAN_APPEND(plan, rec, name, used, data, cnt) \
+   access_plan_append_var(plan, rec, (plan)->out[PLAN_OUT_##name], used, data, (cnt) * sizeof(F_##name##_T))
+
+/**
+ * Copy the fixed length fields present in both templates from the input to
+ * the output record and clear those passed through from other inputs.
+ */
+static inline void access_plan_copy(const access_plan_t *plan, const void *in_rec, void *out_rec)
+{
+   for (uint16_t i = 0; i < plan->copy_cnt; i++) {
+      memcpy((uint8_t *) out_rec + plan->copy[i].dst, (const uint8_t *) in_rec + plan->copy[i].src, plan->copy[i].len);
+   }
+   for (uint16_t i = 0; i < plan->zero_cnt; i++) {
+      memset((uint8_t *) out_rec + plan->zero[i].dst, 0, plan->zero[i].len);
+   }
+}
+
+/**
+ * Resolve offsets of all PLAN_IN_FIELDS in in_tmplt and PLAN_OUT_FIELDS in
+ * out_tmplt, features are those of FEATURE_FIELDS present in out_tmplt. The
+ * remaining fixed length fields of out_tmplt found in in_tmplt are merged
+ * into copy runs, those missing in in_tmplt into cleared runs. Variable length fields of out_tmplt are filled from the
+ * input by access_plan_copy_var() when var_copy is set, array features are
+ * appended after them by process_flow().
+ * The plan must be zero initialized before the first build, a rebuild
+ * releases the previous copy runs and keeps the shard and histogram settings.
+ * Returns 0 on success, -1 when a required field is missing in a template.
+ */
+int access_plan_build(access_plan_t *plan, const ur_template_t *in_tmplt, const ur_template_t *out_tmplt,
+                      int var_copy);
+
+/**
+ * Fill the variable length part of the output record from the input record
+ * of in_size bytes, as a single block when both templates have the same
+ * layout. Without var_copy, or when the result would not fit into a UniRec
+ * record, the variable length fields are left empty. Returns the number of
+ * bytes of the variable length part used.
+ */
+uint32_t access_plan_copy_var(const access_plan_t *plan, const void *in_rec, uint16_t in_size, void *out_rec);
+
+/**
+ * Append len bytes of data to the variable length part of the output record
+ * and point the header at hdr to them. The array is left empty when it would
+ * not fit into a UniRec record. Returns the new number of bytes used.
+ */
+static inline uint32_t access_plan_append_var(const access_plan_t *plan, void *out_rec, uint16_t hdr, uint32_t used,
+                                              const void *data, uint32_t len)
+{
+   uint16_t *header = (uint16_t *) ((uint8_t *) out_rec + hdr);
+   if (plan->out_static_size + used + len > UR_MAX_SIZE) {
+      len = 0;
+   }
+   memcpy((uint8_t *) out_rec + plan->out_static_size + used, data, len);
+   header[0] = used;
+   header[1] = len;
+   return used + len;
+}
+
+/**
+ * Output template specification passing all fields of the in_cnt input
+ * templates through (each field once), followed by the features of the set.
+ * Returns a string allocated by malloc() or NULL.
+ */
+char *access_plan_out_spec(const ur_template_t *const *in_tmplts, uint32_t in_cnt, feature_set_t features);
+
+/**
+ * Release memory of the plan
+ */
+void access_plan_free(access_plan_t *plan);
+
+#endif
@@ -0,0 +1,117 @@
+/**
+ * \file arena.c
+ * \brief Arena allocator of cache line aligned buffers.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <sys/mman.h>
+#include "arena.h"
+
+/**
+ * Map a chunk of at least size bytes (with the header), NULL on failure
+ */
+static arena_chunk_t *arena_map(size_t size, int huge)
+{
+   void *mem = MAP_FAILED;
+
+   size = (size + ARENA_CHUNK_SIZE - 1) & ~(size_t) (ARENA_CHUNK_SIZE - 1);
+#ifdef MAP_HUGETLB
+   if (huge) {
+      mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+   }
+#endif
+   if (mem == MAP_FAILED) {
+      mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (mem == MAP_FAILED) {
+         return NULL;
+      }
+#ifdef MADV_HUGEPAGE
+      if (huge) {
+         madvise(mem, size, MADV_HUGEPAGE);
+      }
+#endif
+   }
+   arena_chunk_t *c = (arena_chunk_t *) mem;
+   c->prev = NULL;
+   c->size = size;
+   c->used = sizeof(arena_chunk_t);
+   return c;
+}
+
+int arena_init(arena_t *a, size_t size, int huge)
+{
+   a->chunk = NULL;
+   a->huge = huge;
+   if (size > 0) {
+      a->chunk = arena_map(ARENA_ROUND(sizeof(arena_chunk_t)) + size, huge);
+      if (a->chunk == NULL) {
+         return -1;
+      }
+   }
+   return 0;
+}
+
+void *arena_alloc_chunk(arena_t *a, size_t size)
+{
+   arena_chunk_t *c = arena_map(ARENA_ROUND(sizeof(arena_chunk_t)) + size, a->huge);
+   if (c == NULL) {
+      return NULL;
+   }
+   c->prev = a->chunk;
+   a->chunk = c;
+   return arena_alloc(a, size);
+}
+
+void arena_release(arena_t *a, arena_mark_t mark)
+{
+   while (a->chunk != mark.chunk) {
+      arena_chunk_t *prev = a->chunk->prev;
+      munmap(a->chunk, a->chunk->size);
+      a->chunk = prev;
+   }
+   if (a->chunk != NULL) {
+      a->chunk->used = mark.used;
+   }
+}
+
+void arena_free(arena_t *a)
+{
+   arena_release(a, (arena_mark_t) { .chunk = NULL, .used = 0 });
+}
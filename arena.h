@@ -0,0 +1,141 @@
+/**
+ * \file arena.h
+ * \brief Arena allocator of cache line aligned buffers.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Alignment of all allocations, a cache line
+ */
+#define ARENA_ALIGN 64
+
+/**
+ * Minimal size of a chunk mapped by the arena, a huge page
+ */
+#define ARENA_CHUNK_SIZE (2 * 1024 * 1024)
+
+/**
+ * Round a size up to ARENA_ALIGN
+ */
+#define ARENA_ROUND(size) (((size) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1))
+
+/**
+ * Mapped chunk of an arena, allocations follow the header
+ */
+typedef struct arena_chunk_s {
+   struct arena_chunk_s *prev; ///< previously mapped chunk
+   size_t size;                ///< mapped size including the header
+   size_t used;                ///< used bytes including the header
+} arena_chunk_t;
+
+/**
+ * Bump allocator over chunks mapped by mmap(). Allocations are never freed
+ * one by one: the arena is released to a mark (the allocations made after
+ * it are dropped) or reset as a whole, so buffers sized once are reused with
+ * no allocation on the hot path. An arena is used by one thread at a time.
+ */
+typedef struct arena_s {
+   arena_chunk_t *chunk; ///< current chunk, NULL before the first allocation
+   int huge;             ///< back chunks by huge pages when possible
+} arena_t;
+
+/**
+ * Position in an arena returned by arena_mark()
+ */
+typedef struct arena_mark_s {
+   arena_chunk_t *chunk;
+   size_t used;
+} arena_mark_t;
+
+/**
+ * Initialize an empty arena. With huge set, chunks are mapped from the huge
+ * page pool (MAP_HUGETLB) and when it is empty, transparent huge pages are
+ * requested for them (MADV_HUGEPAGE). At least size bytes are mapped in the
+ * first chunk right away (none when 0). Returns 0 on success, -1 when memory
+ * could not be mapped.
+ */
+int arena_init(arena_t *a, size_t size, int huge);
+
+/**
+ * Allocate from a new chunk, called by arena_alloc() when the current one is full
+ */
+void *arena_alloc_chunk(arena_t *a, size_t size);
+
+/**
+ * Allocate size bytes aligned to ARENA_ALIGN. Memory of a new chunk is zeroed,
+ * memory reused after arena_release() is not. Returns NULL when memory could
+ * not be mapped.
+ */
+static inline void *arena_alloc(arena_t *a, size_t size)
+{
+   arena_chunk_t *c = a->chunk;
+   if (c == NULL || ARENA_ROUND(c->used) + size > c->size) {
+      return arena_alloc_chunk(a, size);
+   }
+   size_t off = ARENA_ROUND(c->used);
+   c->used = off + size;
+   return (uint8_t *) c + off;
+}
+
+/**
+ * Current position, allocations made after it are dropped by arena_release()
+ */
+static inline arena_mark_t arena_mark(const arena_t *a)
+{
+   return (arena_mark_t) { .chunk = a->chunk, .used = a->chunk != NULL ? a->chunk->used : 0 };
+}
+
+/**
+ * Drop the allocations made after the mark, chunks mapped after it are unmapped
+ */
+void arena_release(arena_t *a, arena_mark_t mark);
+
+/**
+ * Unmap all chunks
+ */
+void arena_free(arena_t *a);
+
+#endif
@@ -0,0 +1,733 @@
+/**
+ * \file arrow_writer.c
+ * \brief Export of output records as Arrow IPC streams.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unirec/ur_time.h>
+#include "arrow_writer.h"
+
+/**
+ * Values of the Arrow format (Schema.fbs, Message.fbs)
+ */
+#define ARROW_METADATA_V5 4
+#define ARROW_HEADER_SCHEMA 1
+#define ARROW_HEADER_RECORD_BATCH 3
+#define ARROW_TYPE_INT 2
+#define ARROW_TYPE_FLOAT 3
+#define ARROW_TYPE_BINARY 4
+#define ARROW_TYPE_UTF8 5
+#define ARROW_TYPE_TIMESTAMP 10
+#define ARROW_TYPE_LIST 12
+#define ARROW_TYPE_FIXED_BINARY 15
+#define ARROW_PRECISION_SINGLE 1
+#define ARROW_PRECISION_DOUBLE 2
+#define ARROW_UNIT_MICROSECOND 2
+#define ARROW_CONTINUATION 0xffffffff
+
+/**
+ * Buffers of a message body are padded to 8 bytes
+ */
+#define ARROW_PAD(size) (((size) + 7) & ~(uint64_t) 7)
+
+/**
+ * Largest offset of a list or byte column before its batch is written, one
+ * more record always fits into the 32 bit offsets
+ */
+#define ARROW_OFFSET_MAX (INT32_MAX - UR_MAX_SIZE)
+
+/**
+ * Space of the message metadata per column and for the rest
+ */
+#define ARROW_META_PER_COL 512
+#define ARROW_META_BASE 256
+
+/**
+ * Flatbuffer built front to back into a buffer large enough for the
+ * message: tables are written before the tables, vectors and strings they
+ * refer to, so all offsets point forward and are patched when the target is
+ * written. Vtables precede their tables.
+ */
+typedef struct fb_s {
+   uint8_t *buf;
+   size_t len;
+} fb_t;
+
+/**
+ * Scalar or offset field of a table, offsets have size 4 and are patched later
+ */
+typedef struct fb_field_s {
+   uint16_t id;    ///< index of the field in the table schema
+   uint8_t size;   ///< 1, 2, 4 or 8 bytes
+   uint64_t value;
+} fb_field_t;
+
+#define FB_FIELDS_MAX 8
+
+/**
+ * Pad with zeros until len % align == rem
+ */
+static void fb_align(fb_t *b, size_t align, size_t rem)
+{
+   while (b->len % align != rem) {
+      b->buf[b->len++] = 0;
+   }
+}
+
+static size_t fb_bytes(fb_t *b, const void *data, size_t size)
+{
+   size_t pos = b->len;
+   memcpy(b->buf + pos, data, size);
+   b->len += size;
+   return pos;
+}
+
+/**
+ * Point the offset at position at to target
+ */
+static void fb_patch(fb_t *b, size_t at, size_t target)
+{
+   uint32_t off = target - at;
+   memcpy(b->buf + at, &off, sizeof(off));
+}
+
+/**
+ * Write a table of n fields, positions of the fields are stored to pos.
+ * The table starts 4 bytes before an 8 byte boundary, so the fields placed
+ * after its vtable offset from the largest ones are aligned.
+ */
+static size_t fb_table(fb_t *b, const fb_field_t *fields, uint32_t n, size_t *pos)
+{
+   uint16_t vtable[2 + FB_FIELDS_MAX] = { 0 };
+   uint16_t field_off[FB_FIELDS_MAX];
+   uint16_t table_size = sizeof(int32_t), id_cnt = 0;
+
+   for (uint32_t size = 8; size > 0; size /= 2) {
+      for (uint32_t i = 0; i < n; i++) {
+         if (fields[i].size == size) {
+            field_off[i] = table_size;
+            table_size += size;
+         }
+      }
+   }
+   for (uint32_t i = 0; i < n; i++) {
+      vtable[2 + fields[i].id] = field_off[i];
+      id_cnt = fields[i].id + 1 > id_cnt ? fields[i].id + 1 : id_cnt;
+   }
+   vtable[0] = (2 + id_cnt) * sizeof(uint16_t);
+   vtable[1] = table_size;
+   fb_align(b, 2, 0);
+   size_t vtable_pos = fb_bytes(b, vtable, vtable[0]);
+   fb_align(b, 8, 4);
+   size_t table = b->len;
+   int32_t vtable_off = table - vtable_pos;
+   memset(b->buf + table, 0, table_size);
+   memcpy(b->buf + table, &vtable_off, sizeof(vtable_off));
+   for (uint32_t i = 0; i < n; i++) {
+      memcpy(b->buf + table + field_off[i], &fields[i].value, fields[i].size);
+      pos[i] = table + field_off[i];
+   }
+   b->len = table + table_size;
+   return table;
+}
+
+/**
+ * Write a zeroed vector of n elements, the elements are 8 byte aligned
+ */
+static size_t fb_vector(fb_t *b, uint32_t n, size_t elem_size)
+{
+   fb_align(b, 8, 4);
+   size_t vec = fb_bytes(b, &n, sizeof(n));
+   memset(b->buf + b->len, 0, n * elem_size);
+   b->len += n * elem_size;
+   return vec;
+}
+
+static size_t fb_string(fb_t *b, const char *s)
+{
+   uint32_t len = strlen(s);
+   fb_align(b, 4, 0);
+   size_t str = fb_bytes(b, &len, sizeof(len));
+   fb_bytes(b, s, len + 1);
+   return str;
+}
+
+/**
+ * Start the metadata with the root Message table, returns position of its header offset
+ */
+static size_t fb_message(fb_t *b, uint8_t header_type, uint64_t body_len)
+{
+   fb_field_t fields[] = { { 0, 2, ARROW_METADATA_V5 }, { 1, 1, header_type }, { 2, 4, 0 }, { 3, 8, body_len } };
+   size_t pos[4];
+   uint32_t root = 0;
+
+   b->len = 0;
+   fb_bytes(b, &root, sizeof(root));
+   fb_patch(b, 0, fb_table(b, fields, 4, pos));
+   return pos[2];
+}
+
+/**
+ * Arrow type of a UniRec type, arrays are lists
+ */
+static uint8_t arrow_type_id(ur_field_type_t type)
+{
+   switch (type) {
+   case UR_TYPE_STRING:
+      return ARROW_TYPE_UTF8;
+   case UR_TYPE_BYTES:
+      return ARROW_TYPE_BINARY;
+   case UR_TYPE_CHAR:
+   case UR_TYPE_UINT8:
+   case UR_TYPE_INT8:
+   case UR_TYPE_UINT16:
+   case UR_TYPE_INT16:
+   case UR_TYPE_UINT32:
+   case UR_TYPE_INT32:
+   case UR_TYPE_UINT64:
+   case UR_TYPE_INT64:
+      return ARROW_TYPE_INT;
+   case UR_TYPE_FLOAT:
+   case UR_TYPE_DOUBLE:
+      return ARROW_TYPE_FLOAT;
+   case UR_TYPE_IP:
+   case UR_TYPE_MAC:
+      return ARROW_TYPE_FIXED_BINARY;
+   case UR_TYPE_TIME:
+      return ARROW_TYPE_TIMESTAMP;
+   default:
+      return ARROW_TYPE_LIST;
+   }
+}
+
+/**
+ * Write the type table of a UniRec type (of a list for arrays)
+ */
+static size_t fb_type(fb_t *b, ur_field_type_t type)
+{
+   size_t pos[2];
+
+   switch (arrow_type_id(type)) {
+   case ARROW_TYPE_INT: {
+      int is_signed = type == UR_TYPE_INT8 || type == UR_TYPE_INT16 || type == UR_TYPE_INT32 || type == UR_TYPE_INT64;
+      fb_field_t fields[] = { { 0, 4, ur_size_of(type) * 8 }, { 1, 1, is_signed } };
+      return fb_table(b, fields, 2, pos);
+   }
+   case ARROW_TYPE_FLOAT: {
+      fb_field_t fields[] = { { 0, 2, type == UR_TYPE_FLOAT ? ARROW_PRECISION_SINGLE : ARROW_PRECISION_DOUBLE } };
+      return fb_table(b, fields, 1, pos);
+   }
+   case ARROW_TYPE_FIXED_BINARY: {
+      fb_field_t fields[] = { { 0, 4, ur_size_of(type) } };
+      return fb_table(b, fields, 1, pos);
+   }
+   case ARROW_TYPE_TIMESTAMP: {
+      fb_field_t fields[] = { { 0, 2, ARROW_UNIT_MICROSECOND }, { 1, 4, 0 } };
+      size_t table = fb_table(b, fields, 2, pos);
+      fb_patch(b, pos[1], fb_string(b, "UTC"));
+      return table;
+   }
+   default:
+      return fb_table(b, NULL, 0, pos); // Utf8, Binary and List have no fields
+   }
+}
+
+/**
+ * Write a Field table, arrays are lists of elements of elem_type
+ */
+static size_t fb_field(fb_t *b, const char *name, ur_field_type_t type, ur_field_type_t elem_type)
+{
+   uint8_t type_id = arrow_type_id(type);
+   fb_field_t fields[] = { { 0, 4, 0 }, { 1, 1, 0 }, { 2, 1, type_id }, { 3, 4, 0 }, { 5, 4, 0 } };
+   size_t pos[5];
+
+   size_t field = fb_table(b, fields, 5, pos);
+   fb_patch(b, pos[0], fb_string(b, name));
+   fb_patch(b, pos[3], fb_type(b, type));
+   size_t children = fb_vector(b, type_id == ARROW_TYPE_LIST, sizeof(uint32_t));
+   fb_patch(b, pos[4], children);
+   if (type_id == ARROW_TYPE_LIST) {
+      fb_patch(b, children + sizeof(uint32_t), fb_field(b, "item", elem_type, elem_type));
+   }
+   return field;
+}
+
+/**
+ * Append bytes to the current file
+ */
+static int arrow_write(arrow_writer_t *w, const void *data, size_t size)
+{
+   if (size > 0 && fwrite(data, size, 1, w->file) != 1) {
+      fprintf(stderr, "Error: Write of Arrow file %s.%06u.arrows failed.\n", w->prefix, w->file_seq - 1);
+      return -1;
+   }
+   w->file_size += size;
+   return 0;
+}
+
+/**
+ * Write a buffer of the message body padded to 8 bytes
+ */
+static int arrow_write_padded(arrow_writer_t *w, const void *data, size_t size)
+{
+   static const uint8_t zeros[8] = { 0 };
+   if (arrow_write(w, data, size) != 0) {
+      return -1;
+   }
+   return arrow_write(w, zeros, ARROW_PAD(size) - size);
+}
+
+/**
+ * Write the message with the metadata built in w->meta, the body follows it
+ */
+static int arrow_write_meta(arrow_writer_t *w, fb_t *b)
+{
+   fb_align(b, 8, 0);
+   uint32_t prefix[2] = { ARROW_CONTINUATION, b->len };
+   if (arrow_write(w, prefix, sizeof(prefix)) != 0) {
+      return -1;
+   }
+   return arrow_write(w, b->buf, b->len);
+}
+
+static int arrow_write_schema(arrow_writer_t *w)
+{
+   fb_t b = { .buf = w->meta, .len = 0 };
+   fb_field_t fields[] = { { 0, 2, 0 }, { 1, 4, 0 } }; // little endian
+   size_t pos[2];
+
+   size_t header = fb_message(&b, ARROW_HEADER_SCHEMA, 0);
+   fb_patch(&b, header, fb_table(&b, fields, 2, pos));
+   size_t vec = fb_vector(&b, w->col_cnt, sizeof(uint32_t));
+   fb_patch(&b, pos[1], vec);
+   for (uint32_t i = 0; i < w->col_cnt; i++) {
+      ur_field_id_t id = w->cols[i].id;
+      ur_field_type_t type = ur_get_type(id);
+      ur_field_type_t elem_type = w->cols[i].kind == ARROW_COL_LIST ? ur_array_get_elem_type(id) : type;
+      fb_patch(&b, vec + sizeof(uint32_t) * (i + 1), fb_field(&b, ur_get_name(id), type, elem_type));
+   }
+   return arrow_write_meta(w, &b);
+}
+
+/**
+ * Add a buffer of size bytes at offset body_len of the body to the buffer vector of a record batch
+ */
+static void arrow_batch_buffer(fb_t *b, size_t *buffer, uint64_t *body_len, uint64_t size)
+{
+   uint64_t desc[2] = { *body_len, size };
+   memcpy(b->buf + *buffer, desc, sizeof(desc));
+   *buffer += sizeof(desc);
+   *body_len += ARROW_PAD(size);
+}
+
+/**
+ * Size of the values of a column in a batch of rows
+ */
+static inline size_t arrow_col_used(const arrow_col_t *c, uint32_t rows)
+{
+   return c->offsets != NULL ? c->data_used : (size_t) rows * c->width;
+}
+
+/**
+ * Write the rows of the current batch as a record batch message and clear the columns
+ */
+static int arrow_write_batch(arrow_writer_t *w)
+{
+   fb_t b = { .buf = w->meta, .len = 0 };
+   uint32_t node_cnt = 0, buffer_cnt = 0;
+   uint64_t rows = w->row_cnt, body_len = 0;
+   size_t pos[3];
+
+   for (uint32_t i = 0; i < w->col_cnt; i++) {
+      const arrow_col_t *c = &w->cols[i];
+      int with_offsets = c->kind == ARROW_COL_BYTES || c->kind == ARROW_COL_LIST;
+      node_cnt += c->kind == ARROW_COL_LIST ? 2 : 1;
+      buffer_cnt += c->kind == ARROW_COL_LIST ? 4 : with_offsets ? 3 : 2;
+      body_len += (with_offsets ? ARROW_PAD((rows + 1) * sizeof(int32_t)) : 0) + ARROW_PAD(arrow_col_used(c, rows));
+   }
+   size_t header = fb_message(&b, ARROW_HEADER_RECORD_BATCH, body_len);
+   body_len = 0;
+   fb_field_t fields[] = { { 0, 8, rows }, { 1, 4, 0 }, { 2, 4, 0 } };
+   fb_patch(&b, header, fb_table(&b, fields, 3, pos));
+   size_t nodes = fb_vector(&b, node_cnt, 2 * sizeof(uint64_t));
+   fb_patch(&b, pos[1], nodes);
+   size_t buffers = fb_vector(&b, buffer_cnt, 2 * sizeof(uint64_t));
+   fb_patch(&b, pos[2], buffers);
+
+   // field nodes (length, null count) and buffers (validity bitmaps are empty, there are no nulls)
+   size_t node = nodes + sizeof(uint32_t), buffer = buffers + sizeof(uint32_t);
+   for (uint32_t i = 0; i < w->col_cnt; i++) {
+      const arrow_col_t *c = &w->cols[i];
+      uint64_t desc[2] = { rows, 0 };
+      memcpy(b.buf + node, desc, sizeof(desc));
+      node += sizeof(desc);
+      arrow_batch_buffer(&b, &buffer, &body_len, 0);
+      if (c->kind == ARROW_COL_BYTES || c->kind == ARROW_COL_LIST) {
+         arrow_batch_buffer(&b, &buffer, &body_len, (rows + 1) * sizeof(int32_t));
+      }
+      if (c->kind == ARROW_COL_LIST) {
+         desc[0] = c->offsets[rows];
+         memcpy(b.buf + node, desc, sizeof(desc));
+         node += sizeof(desc);
+         arrow_batch_buffer(&b, &buffer, &body_len, 0);
+      }
+      arrow_batch_buffer(&b, &buffer, &body_len, arrow_col_used(c, rows));
+   }
+
+   if (arrow_write_meta(w, &b) != 0) {
+      return -1;
+   }
+   for (uint32_t i = 0; i < w->col_cnt; i++) {
+      arrow_col_t *c = &w->cols[i];
+      if (c->kind == ARROW_COL_BYTES || c->kind == ARROW_COL_LIST) {
+         if (arrow_write_padded(w, c->offsets, (rows + 1) * sizeof(int32_t)) != 0) {
+            return -1;
+         }
+      }
+      if (arrow_write_padded(w, c->data, arrow_col_used(c, rows)) != 0) {
+         return -1;
+      }
+      c->data_used = 0;
+   }
+   w->row_cnt = 0;
+   return 0;
+}
+
+/**
+ * Open the next file and write the schema
+ */
+static int arrow_open(arrow_writer_t *w)
+{
+   size_t len = strlen(w->prefix) + 32;
+   char *path = malloc(len);
+
+   if (path == NULL) {
+      fprintf(stderr, "Error: Memory allocation problem (Arrow writer).\n");
+      return -1;
+   }
+   snprintf(path, len, "%s.%06u.arrows", w->prefix, w->file_seq++);
+   w->file = fopen(path, "wb");
+   if (w->file == NULL) {
+      fprintf(stderr, "Error: Arrow file %s could not be created.\n", path);
+      free(path);
+      return -1;
+   }
+   free(path);
+   w->file_size = 0;
+   w->file_opened = time(NULL);
+   return arrow_write_schema(w);
+}
+
+/**
+ * Write the pending rows, the end of stream marker and close the file
+ */
+int arrow_writer_close(arrow_writer_t *w)
+{
+   uint32_t eos[2] = { ARROW_CONTINUATION, 0 };
+   int ret = 0;
+
+   if (w->file == NULL) {
+      return 0;
+   }
+   if (w->row_cnt > 0) {
+      ret = arrow_write_batch(w);
+   }
+   if (ret == 0) {
+      ret = arrow_write(w, eos, sizeof(eos));
+   }
+   if (fclose(w->file) != 0 && ret == 0) {
+      fprintf(stderr, "Error: Write of Arrow file %s.%06u.arrows failed.\n", w->prefix, w->file_seq - 1);
+      ret = -1;
+   }
+   w->file = NULL;
+   return ret;
+}
+
+/**
+ * Write the full batch, rotate the file when it is large enough
+ */
+static int arrow_flush(arrow_writer_t *w)
+{
+   if (arrow_write_batch(w) != 0) {
+      return -1;
+   }
+   if (w->max_size > 0 && w->file_size >= w->max_size) {
+      return arrow_writer_close(w);
+   }
+   return 0;
+}
+
+int arrow_writer_tick(arrow_writer_t *w, time_t now)
+{
+   if (w->file != NULL && w->interval > 0 && now - w->file_opened >= (time_t) w->interval) {
+      return arrow_writer_close(w);
+   }
+   return 0;
+}
+
+/**
+ * Enlarge the values of a list or byte column to hold size more bytes
+ */
+static int arrow_col_grow(arrow_col_t *c, size_t size)
+{
+   size_t data_size = c->data_size * 2;
+   while (data_size < c->data_used + size) {
+      data_size *= 2;
+   }
+   uint8_t *data = realloc(c->data, data_size);
+   if (data == NULL) {
+      fprintf(stderr, "Error: Memory allocation problem (Arrow writer).\n");
+      return -1;
+   }
+   c->data = data;
+   c->data_size = data_size;
+   return 0;
+}
+
+static inline int64_t arrow_time_us(ur_time_t t)
+{
+   return (int64_t) ur_time_get_sec(t) * 1000000 + ur_time_get_usec(t);
+}
+
+int arrow_writer_append(arrow_writer_t *w, const void *rec)
+{
+   uint32_t row = w->row_cnt;
+
+   if (w->file == NULL && arrow_open(w) != 0) {
+      return -1;
+   }
+   for (uint32_t i = 0; i < w->col_cnt; i++) {
+      arrow_col_t *c = &w->cols[i];
+      const uint8_t *field = (const uint8_t *) rec + c->offset;
+      switch (c->kind) {
+      case ARROW_COL_FIXED:
+         memcpy(c->data + (size_t) row * c->width, field, c->width);
+         break;
+      case ARROW_COL_TIME: {
+         ur_time_t t;
+         memcpy(&t, field, sizeof(t));
+         int64_t us = arrow_time_us(t);
+         memcpy(c->data + (size_t) row * sizeof(us), &us, sizeof(us));
+         break;
+      }
+      default: {
+         const uint8_t *values = ur_get_ptr_by_id(w->tmplt, rec, c->id);
+         uint32_t len = ur_get_var_len(w->tmplt, rec, c->id);
+         uint32_t cnt = c->kind == ARROW_COL_LIST ? len / ur_array_get_elem_size(c->id) : len;
+         size_t size = (size_t) cnt * c->width;
+         if (c->data_used + size > c->data_size && arrow_col_grow(c, size) != 0) {
+            return -1;
+         }
+         if (c->elem_time) {
+            for (uint32_t j = 0; j < cnt; j++) {
+               ur_time_t t;
+               memcpy(&t, values + j * sizeof(t), sizeof(t));
+               int64_t us = arrow_time_us(t);
+               memcpy(c->data + c->data_used + j * sizeof(us), &us, sizeof(us));
+            }
+         } else {
+            memcpy(c->data + c->data_used, values, size);
+         }
+         c->data_used += size;
+         c->offsets[row + 1] = c->offsets[row] + cnt;
+         break;
+      }
+      }
+   }
+   w->row_cnt++;
+   if (w->row_cnt == w->rows) {
+      return arrow_flush(w);
+   }
+   // keep the 32 bit offsets of the next record from overflowing
+   for (uint32_t i = 0; i < w->col_cnt; i++) {
+      if (w->cols[i].offsets != NULL && w->cols[i].offsets[w->row_cnt] > ARROW_OFFSET_MAX) {
+         return arrow_flush(w);
+      }
+   }
+   return 0;
+}
+
+/**
+ * Free buffers of the columns
+ */
+static void arrow_free_cols(arrow_writer_t *w)
+{
+   for (uint32_t i = 0; i < w->col_cnt; i++) {
+      free(w->cols[i].data);
+      free(w->cols[i].offsets);
+   }
+   free(w->cols);
+   w->cols = NULL;
+   w->col_cnt = 0;
+   free(w->meta);
+   w->meta = NULL;
+}
+
+/**
+ * Resolve a column of field name and allocate its buffers
+ */
+static int arrow_col_init(arrow_writer_t *w, arrow_col_t *c, const char *name, size_t *meta_size)
+{
+   int id = ur_get_id_by_name(name);
+   if (id < 0 || !ur_is_present(w->tmplt, id)) {
+      fprintf(stderr, "Error: Output template does not contain field %s exported to Arrow.\n", name);
+      return -1;
+   }
+   ur_field_type_t type = ur_get_type(id);
+   c->id = id;
+   c->type = type;
+   c->offset = ur_is_static(id) ? w->tmplt->offset[id] : 0;
+   if (type == UR_TYPE_STRING || type == UR_TYPE_BYTES) {
+      c->kind = ARROW_COL_BYTES;
+      c->width = 1;
+   } else if (arrow_type_id(type) == ARROW_TYPE_LIST) {
+      ur_field_type_t elem_type = ur_array_get_elem_type(id);
+      c->kind = ARROW_COL_LIST;
+      c->elem_time = elem_type == UR_TYPE_TIME;
+      c->width = c->elem_time ? sizeof(int64_t) : (uint32_t) ur_size_of(elem_type);
+   } else {
+      c->kind = type == UR_TYPE_TIME ? ARROW_COL_TIME : ARROW_COL_FIXED;
+      c->width = type == UR_TYPE_TIME ? sizeof(int64_t) : (uint32_t) ur_size_of(type);
+   }
+   // values of fixed columns fit exactly, lists and byte fields grow as needed
+   c->data_size = (size_t) w->rows * c->width;
+   c->data = malloc(c->data_size);
+   if (c->kind == ARROW_COL_BYTES || c->kind == ARROW_COL_LIST) {
+      c->offsets = calloc(w->rows + 1, sizeof(int32_t));
+      if (c->offsets == NULL) {
+         return -1;
+      }
+   }
+   *meta_size += ARROW_META_PER_COL + 2 * strlen(name);
+   return c->data == NULL ? -1 : 0;
+}
+
+/**
+ * Update offsets of the columns in a new template of the same schema, -1 when
+ * a field is missing or its type changed
+ */
+static int arrow_rebind(arrow_writer_t *w, const ur_template_t *tmplt)
+{
+   for (uint32_t i = 0; i < w->col_cnt; i++) {
+      if (!ur_is_present(tmplt, w->cols[i].id) || ur_get_type(w->cols[i].id) != w->cols[i].type) {
+         return -1;
+      }
+   }
+   for (uint32_t i = 0; i < w->col_cnt; i++) {
+      w->cols[i].offset = ur_is_static(w->cols[i].id) ? tmplt->offset[w->cols[i].id] : 0;
+   }
+   w->tmplt = tmplt;
+   return 0;
+}
+
+int arrow_writer_bind(arrow_writer_t *w, const ur_template_t *tmplt)
+{
+   // the columns are given by names, the file continues unless their types changed
+   if (w->cols != NULL && arrow_rebind(w, tmplt) == 0) {
+      return 0;
+   }
+   int ret = arrow_writer_close(w);
+   arrow_free_cols(w);
+   if (ret != 0) {
+      return -1;
+   }
+   w->tmplt = tmplt;
+
+   uint32_t col_cnt = 1;
+   for (const char *p = w->fields; *p != '\0'; p++) {
+      col_cnt += *p == ',';
+   }
+   w->cols = calloc(col_cnt, sizeof(arrow_col_t));
+   char *names = strdup(w->fields);
+   if (w->cols == NULL || names == NULL) {
+      free(names);
+      fprintf(stderr, "Error: Memory allocation problem (Arrow writer).\n");
+      return -1;
+   }
+   size_t meta_size = ARROW_META_BASE;
+   char *save = NULL;
+   for (char *name = strtok_r(names, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+      if (arrow_col_init(w, &w->cols[w->col_cnt++], name, &meta_size) != 0) {
+         free(names);
+         return -1;
+      }
+   }
+   free(names);
+   w->meta = malloc(meta_size);
+   w->meta_size = meta_size;
+   if (w->meta == NULL) {
+      fprintf(stderr, "Error: Memory allocation problem (Arrow writer).\n");
+      return -1;
+   }
+   return 0;
+}
+
+arrow_writer_t *arrow_writer_create(const char *prefix, const char *fields, uint32_t rows, uint64_t max_size,
+                                    uint32_t interval)
+{
+   arrow_writer_t *w = calloc(1, sizeof(arrow_writer_t));
+   if (w == NULL) {
+      return NULL;
+   }
+   w->prefix = strdup(prefix);
+   w->fields = strdup(fields);
+   w->rows = rows > 0 ? rows : ARROW_ROWS_DEFAULT;
+   w->max_size = max_size;
+   w->interval = interval;
+   if (w->prefix == NULL || w->fields == NULL) {
+      arrow_writer_destroy(w);
+      return NULL;
+   }
+   return w;
+}
+
+void arrow_writer_destroy(arrow_writer_t *w)
+{
+   if (w == NULL) {
+      return;
+   }
+   arrow_writer_close(w);
+   arrow_free_cols(w);
+   free(w->prefix);
+   free(w->fields);
+   free(w);
+}
@@ -0,0 +1,152 @@
+/**
+ * \file arrow_writer.h
+ * \brief Export of output records as Arrow IPC streams.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef _ARROW_WRITER_H_
+#define _ARROW_WRITER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unirec/unirec.h>
+
+/**
+ * Default number of rows of a record batch
+ */
+#define ARROW_ROWS_DEFAULT 65536
+
+/**
+ * Input fields exported besides the computed ones by default
+ */
+#define ARROW_FIELDS_DEFAULT "DST_IP,SRC_IP,TIME_FIRST,TIME_LAST"
+
+/**
+ * Kind of a column, how its values are appended
+ */
+typedef enum {
+   ARROW_COL_FIXED, ///< fixed length values copied as they are (numbers, addresses)
+   ARROW_COL_TIME,  ///< UniRec timestamps converted to microseconds
+   ARROW_COL_BYTES, ///< strings and byte fields, offsets and data
+   ARROW_COL_LIST   ///< arrays, offsets and elements (fixed or time)
+} arrow_col_kind_t;
+
+/**
+ * Column of the current record batch. Values (list elements) are appended to
+ * data, lists and byte fields have rows + 1 offsets into it.
+ */
+typedef struct arrow_col_s {
+   ur_field_id_t id;      ///< UniRec field
+   ur_field_type_t type;  ///< UniRec type of the field when the column was resolved
+   arrow_col_kind_t kind;
+   int elem_time;         ///< list elements are timestamps
+   uint32_t width;        ///< size of a value (of a list element)
+   uint16_t offset;       ///< offset of a fixed length field in the record
+   uint8_t *data;         ///< values of the batch
+   size_t data_used;      ///< used part of data of lists and byte fields
+   size_t data_size;      ///< allocated size of data
+   int32_t *offsets;      ///< offsets of the rows in values, lists and byte fields only
+} arrow_col_t;
+
+/**
+ * Writer of Arrow IPC streaming format files: a schema message followed by
+ * record batches of up to rows rows and the end of stream marker. Values of
+ * each record are appended to the column buffers of the batch as they are
+ * (only timestamps are converted), a full batch is written with one write
+ * per buffer. Files are named prefix.NNNNNN.arrows and rotated when they
+ * exceed max_size bytes or are older than interval seconds (0 = never), as
+ * well as when a template change alters the schema (a stream has a single one).
+ */
+typedef struct arrow_writer_s {
+   char *prefix;
+   char *fields;          ///< comma separated names of the exported fields
+   uint32_t rows;         ///< rows of a record batch
+   uint64_t max_size;     ///< rotation size in bytes, 0 = off
+   uint32_t interval;     ///< rotation interval in seconds, 0 = off
+   const ur_template_t *tmplt; ///< template of the appended records
+   arrow_col_t *cols;
+   uint32_t col_cnt;
+   uint32_t row_cnt;      ///< rows of the current batch
+   FILE *file;            ///< current file, NULL until the first batch
+   uint64_t file_size;    ///< bytes written to the current file
+   time_t file_opened;    ///< time the current file was opened
+   uint32_t file_seq;     ///< number of the next file
+   uint8_t *meta;         ///< buffer of the message metadata
+   size_t meta_size;      ///< allocated size of meta
+} arrow_writer_t;
+
+/**
+ * Create a writer of the comma separated fields (names of the output
+ * template). Returns NULL on failure.
+ */
+arrow_writer_t *arrow_writer_create(const char *prefix, const char *fields, uint32_t rows, uint64_t max_size,
+                                    uint32_t interval);
+
+/**
+ * Resolve the columns in a new output template. When the types of the
+ * columns are unchanged only their offsets are updated and the file
+ * continues, otherwise rows of the previous template are written first and
+ * its file is closed. Returns 0 on success, -1 when a field is missing or of
+ * an unsupported type.
+ */
+int arrow_writer_bind(arrow_writer_t *w, const ur_template_t *tmplt);
+
+/**
+ * Append a record of the bound template, the batch is written when it is full.
+ * Returns 0 on success, -1 on a write error.
+ */
+int arrow_writer_append(arrow_writer_t *w, const void *rec);
+
+/**
+ * Rotate the file when it is older than the interval, the pending rows are
+ * written first. Called regularly with the current time.
+ * Returns 0 on success, -1 on a write error.
+ */
+int arrow_writer_tick(arrow_writer_t *w, time_t now);
+
+/**
+ * Write the pending rows and close the file
+ */
+int arrow_writer_close(arrow_writer_t *w);
+
+void arrow_writer_destroy(arrow_writer_t *w);
+
+#endif
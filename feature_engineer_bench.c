@@ -0,0 +1,430 @@
+/**
+ * \file feature_engineer_bench.c
+ * \brief Throughput benchmark of process_flow() on synthetic records.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <libtrap/trap.h>
+#include <unirec/unirec.h>
+#include <unirec/ur_time.h>
+#include "fields.h"
+#include "arena.h"
+#include "access_plan.h"
+#include "feature_set.h"
+#include "flow_features.h"
+#include "ppi_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAVE_TSC
+#endif
+
+/**
+ * Maximal number of packets in PPI arrays of a generated record
+ */
+#define BENCH_PPI_MAX 1000
+
+/**
+ * Size of the variable length part of a generated record with BENCH_PPI_MAX packets
+ */
+#define BENCH_VAR_MAX (BENCH_PPI_MAX * (sizeof(int8_t) + sizeof(uint16_t) + sizeof(ur_time_t) + sizeof(uint8_t)))
+
+/**
+ * Benchmark configuration
+ */
+typedef struct bench_cfg_s {
+   uint32_t records;    ///< number of distinct generated records
+   double duration;     ///< minimal measured time in seconds
+   uint32_t ppi_min;    ///< minimal number of packets in PPI arrays
+   uint32_t ppi_max;    ///< maximal number of packets in PPI arrays
+   uint32_t ipv6;       ///< percentage of IPv6 flows
+   uint32_t seed;       ///< seed of the generator
+   feature_set_t features;
+   int var_copy;        ///< variable length fields are copied to the output
+   int json;            ///< print results as JSON
+   const char *output;  ///< TRAP interface the records are written to instead of benchmarking
+} bench_cfg_t;
+
+static void usage(const char *name)
+{
+   fprintf(stderr,
+           "Usage: %s [-n RECORDS] [-d SECONDS] [-l MIN[-MAX]] [-6 PERCENT] [-f FEATURES] [-p] [-s SEED] [-j] [-o IFC]\n"
+           "   -n RECORDS   Number of distinct synthetic records processed in a loop (default 65536).\n"
+           "   -d SECONDS   Minimal duration of the measurement (default 2).\n"
+           "   -l MIN[-MAX] Number of packets in PPI arrays, uniformly distributed (default 1-30).\n"
+           "   -6 PERCENT   Percentage of IPv6 flows (default 20).\n"
+           "   -f FEATURES  Comma separated list of computed features, ALL for all (default as the module).\n"
+           "   -p           Copy variable length fields to the output records (as the module with -p).\n"
+           "   -s SEED      Seed of the record generator (default 1).\n"
+           "   -j           Print results as JSON.\n"
+           "   -o IFC       Write the generated records to TRAP output interface IFC (e.g. f:records.trapcap)\n"
+           "                instead of benchmarking, input for load tests of the whole module.\n",
+           name);
+}
+
+static double now()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t cycles()
+{
+#ifdef BENCH_HAVE_TSC
+   return __rdtsc();
+#else
+   return 0;
+#endif
+}
+
+/**
+ * Fill rec with a synthetic flow: random addresses, PPI arrays of a random
+ * length from the configured range, totals consistent with the arrays.
+ */
+static void generate_record(const bench_cfg_t *cfg, const ur_template_t *tmplt, void *rec, uint32_t i)
+{
+   static int8_t dirs[BENCH_PPI_MAX];
+   static uint16_t lens[BENCH_PPI_MAX];
+   static ur_time_t times[BENCH_PPI_MAX];
+   static uint8_t flags[BENCH_PPI_MAX];
+   uint64_t bytes = 0, bytes_rev = 0;
+   uint32_t packets = 0, packets_rev = 0;
+   uint32_t cnt = cfg->ppi_min + rand() % (cfg->ppi_max - cfg->ppi_min + 1);
+
+   ur_clear_varlen(tmplt, rec);
+   if ((uint32_t) (rand() % 100) < cfg->ipv6) {
+      char src[16], dst[16];
+      for (int k = 0; k < 16; k++) {
+         src[k] = rand();
+         dst[k] = rand();
+      }
+      ur_set(tmplt, rec, F_SRC_IP, ip_from_16_bytes_be(src));
+      ur_set(tmplt, rec, F_DST_IP, ip_from_16_bytes_be(dst));
+   } else {
+      ur_set(tmplt, rec, F_SRC_IP, ip_from_int(0x0a000000 + rand() % 65536));
+      ur_set(tmplt, rec, F_DST_IP, ip_from_int(0xc0a80000 + rand() % 65536));
+   }
+
+   ur_time_t first = ur_time_from_sec_msec(1600000000 + i / 1000, rand() % 1000);
+   ur_time_t t = first;
+   for (uint32_t k = 0; k < cnt; k++) {
+      dirs[k] = rand() % 3 ? 1 : -1;
+      lens[k] = 40 + rand() % 1461;
+      t += ((uint64_t) (rand() % 200000) << 32) / 1000000; // up to 200 ms between packets
+      times[k] = t;
+      flags[k] = k == 0 ? 0x02 : (k == 1 ? 0x12 : 0x18);
+      if (dirs[k] == 1) {
+         bytes += lens[k];
+         packets++;
+      } else {
+         bytes_rev += lens[k];
+         packets_rev++;
+      }
+   }
+   ur_set(tmplt, rec, F_BYTES, bytes);
+   ur_set(tmplt, rec, F_BYTES_REV, bytes_rev);
+   ur_set(tmplt, rec, F_PACKETS, packets);
+   ur_set(tmplt, rec, F_PACKETS_REV, packets_rev);
+   ur_set(tmplt, rec, F_TIME_FIRST, first);
+   ur_set(tmplt, rec, F_TIME_LAST, t);
+   ur_set_var(tmplt, rec, F_PPI_PKT_DIRECTIONS, dirs, cnt * sizeof(dirs[0]));
+   ur_set_var(tmplt, rec, F_PPI_PKT_LENGTHS, lens, cnt * sizeof(lens[0]));
+   ur_set_var(tmplt, rec, F_PPI_PKT_TIMES, times, cnt * sizeof(times[0]));
+   ur_set_var(tmplt, rec, F_PPI_PKT_FLAGS, flags, cnt * sizeof(flags[0]));
+}
+
+/**
+ * Send the records stored back to back in buf to the TRAP output interface
+ * ifc, followed by the end of data record.
+ */
+static int write_records(const char *ifc, ur_template_t *tmplt, const uint8_t *buf, const size_t *off,
+                         const uint16_t *size, uint32_t cnt)
+{
+   char *args[] = { "feature_engineer_bench", "-i", (char *) ifc, NULL };
+   int argc = 3;
+   trap_ifc_spec_t ifc_spec;
+   const char eod = 0;
+   int ret = 0;
+
+   trap_module_info_t *info = trap_create_module_info("feature_engineer_bench", "Synthetic flow records", 0, 1, 0);
+   if (info == NULL) {
+      fprintf(stderr, "Error: Memory allocation problem.\n");
+      return -1;
+   }
+   if (trap_parse_params(&argc, args, &ifc_spec) != TRAP_E_OK) {
+      fprintf(stderr, "Error: Invalid output interface: %s\n", trap_last_error_msg);
+      trap_free_module_info(info);
+      return -1;
+   }
+   ret = trap_init(info, ifc_spec);
+   trap_free_ifc_spec(ifc_spec);
+   if (ret != TRAP_E_OK) {
+      fprintf(stderr, "Error: TRAP initialization failed: %s\n", trap_last_error_msg);
+      trap_free_module_info(info);
+      return -1;
+   }
+   ur_set_output_template(0, tmplt);
+
+   for (uint32_t i = 0; i < cnt && ret == 0; i++) {
+      if (trap_send(0, buf + off[i], size[i]) != TRAP_E_OK) {
+         fprintf(stderr, "Error: Sending failed: %s\n", trap_last_error_msg);
+         ret = -1;
+      }
+   }
+   if (ret == 0 && trap_send(0, &eod, sizeof(eod)) != TRAP_E_OK) {
+      ret = -1;
+   }
+   trap_send_flush(0);
+   trap_finalize();
+   trap_free_module_info(info);
+   return ret;
+}
+
+static int parse_args(int argc, char **argv, bench_cfg_t *cfg)
+{
+   int opt;
+   char *end;
+
+   while ((opt = getopt(argc, argv, "n:d:l:6:f:ps:jo:h")) != -1) {
+      switch (opt) {
+      case 'n':
+         cfg->records = strtoul(optarg, NULL, 10);
+         break;
+      case 'd':
+         cfg->duration = strtod(optarg, NULL);
+         break;
+      case 'l':
+         cfg->ppi_min = cfg->ppi_max = strtoul(optarg, &end, 10);
+         if (*end == '-') {
+            cfg->ppi_max = strtoul(end + 1, NULL, 10);
+         }
+         break;
+      case '6':
+         cfg->ipv6 = strtoul(optarg, NULL, 10);
+         break;
+      case 'f':
+         if (feature_set_parse(optarg, &cfg->features) != 0) {
+            return -1;
+         }
+         break;
+      case 'p':
+         cfg->var_copy = 1;
+         break;
+      case 's':
+         cfg->seed = strtoul(optarg, NULL, 10);
+         break;
+      case 'j':
+         cfg->json = 1;
+         break;
+      case 'o':
+         cfg->output = optarg;
+         break;
+      default:
+         usage(argv[0]);
+         return -1;
+      }
+   }
+   if (cfg->records == 0 || cfg->duration <= 0 || cfg->ppi_min > cfg->ppi_max || cfg->ppi_max > BENCH_PPI_MAX ||
+       cfg->ipv6 > 100) {
+      fprintf(stderr, "Error: Invalid arguments.\n");
+      usage(argv[0]);
+      return -1;
+   }
+   return 0;
+}
+
+int main(int argc, char **argv)
+{
+   bench_cfg_t cfg = { .records = 65536, .duration = 2, .ppi_min = 1, .ppi_max = 30, .ipv6 = 20, .seed = 1,
+                       .features = FEATURES_DEFAULT };
+   access_plan_t plan = { 0 };
+   uint8_t *in_buf = NULL, *out_buf = NULL;
+   uint64_t *scratch = NULL;
+   size_t *in_off = NULL;
+   uint16_t *in_size = NULL;
+   void *rec = NULL;
+   char *out_spec = NULL, *feature_names = NULL;
+   ur_template_t *in_tmplt = NULL, *out_tmplt = NULL;
+   int ret = 1;
+
+   if (parse_args(argc, argv, &cfg) != 0) {
+      return 1;
+   }
+   const char *kernels = ppi_kernels_init();
+   srand(cfg.seed);
+
+   in_tmplt = ur_create_template(IN_SPEC, NULL);
+   if (in_tmplt == NULL) {
+      fprintf(stderr, "Error: Input template could not be created.\n");
+      goto cleanup;
+   }
+   out_spec = access_plan_out_spec((const ur_template_t *const *) &in_tmplt, 1, cfg.features);
+   feature_names = feature_set_spec("", cfg.features);
+   out_tmplt = out_spec == NULL ? NULL : ur_create_template(out_spec, NULL);
+   if (out_tmplt == NULL || feature_names == NULL) {
+      fprintf(stderr, "Error: Output template could not be created.\n");
+      goto cleanup;
+   }
+   if (access_plan_build(&plan, in_tmplt, out_tmplt, cfg.var_copy) != 0) {
+      goto cleanup;
+   }
+
+   // Records are stored at cache line boundaries as in a batch of the pipeline
+   size_t in_used = 0, in_bytes = 0, in_buf_size = 0;
+   uint16_t in_size_max = 0;
+   rec = ur_create_record(in_tmplt, BENCH_VAR_MAX);
+   in_off = malloc(cfg.records * sizeof(size_t));
+   in_size = malloc(cfg.records * sizeof(uint16_t));
+   if (rec == NULL || in_off == NULL || in_size == NULL) {
+      fprintf(stderr, "Error: Memory allocation problem.\n");
+      goto cleanup;
+   }
+   for (uint32_t i = 0; i < cfg.records; i++) {
+      generate_record(&cfg, in_tmplt, rec, i);
+      in_size[i] = ur_rec_size(in_tmplt, rec);
+      if (in_used + ARENA_ROUND(in_size[i]) > in_buf_size) {
+         size_t size = 2 * in_buf_size + ARENA_ROUND(UR_MAX_SIZE);
+         void *buf;
+         if (posix_memalign(&buf, ARENA_ALIGN, size) != 0) {
+            fprintf(stderr, "Error: Memory allocation problem.\n");
+            goto cleanup;
+         }
+         if (in_buf != NULL) {
+            memcpy(buf, in_buf, in_used);
+         }
+         free(in_buf);
+         in_buf = buf;
+         in_buf_size = size;
+      }
+      in_off[i] = in_used;
+      memcpy(in_buf + in_used, rec, in_size[i]);
+      in_used += ARENA_ROUND(in_size[i]);
+      in_bytes += in_size[i];
+      in_size_max = in_size[i] > in_size_max ? in_size[i] : in_size_max;
+   }
+   if (cfg.output != NULL) {
+      if (write_records(cfg.output, in_tmplt, in_buf, in_off, in_size, cfg.records) == 0) {
+         fprintf(stderr, "Info: %u records written to %s.\n", cfg.records, cfg.output);
+         ret = 0;
+      }
+      goto cleanup;
+   }
+
+   size_t out_stride = ARENA_ROUND(ur_rec_fixlen_size(out_tmplt) +
+                                   flow_features_var_size(cfg.features, plan.len_bins) +
+                                   (cfg.var_copy ? in_size_max : 0));
+   void *mem;
+   if (posix_memalign(&mem, ARENA_ALIGN, cfg.records * out_stride) == 0) {
+      out_buf = memset(mem, 0, cfg.records * out_stride);
+   }
+   if (posix_memalign(&mem, ARENA_ALIGN, ARENA_ROUND(FLOW_FEATURES_SCRATCH_SIZE)) == 0) {
+      scratch = mem;
+   }
+   if (out_buf == NULL || scratch == NULL) {
+      fprintf(stderr, "Error: Memory allocation problem.\n");
+      goto cleanup;
+   }
+
+   // Warm up caches and branch predictors, then repeat passes until the duration elapses
+   for (uint32_t i = 0; i < cfg.records; i++) {
+      process_flow(&plan, in_buf + in_off[i], in_size[i], out_buf + i * out_stride, scratch);
+   }
+   uint64_t processed = 0;
+   double start = now(), elapsed;
+   uint64_t start_cycles = cycles();
+   do {
+      for (uint32_t i = 0; i < cfg.records; i++) {
+         process_flow(&plan, in_buf + in_off[i], in_size[i], out_buf + i * out_stride, scratch);
+      }
+      processed += cfg.records;
+      elapsed = now() - start;
+   } while (elapsed < cfg.duration);
+   uint64_t used_cycles = cycles() - start_cycles;
+
+   double rate = processed / elapsed;
+   double ns = elapsed * 1e9 / processed;
+   double cpr = (double) used_cycles / processed;
+   if (cfg.json) {
+      printf("{\"records\": %lu, \"seconds\": %.6f, \"records_per_s\": %.1f, \"ns_per_record\": %.3f, "
+             "\"cycles_per_record\": %.1f, \"kernels\": \"%s\", \"ppi_min\": %u, \"ppi_max\": %u, "
+             "\"ipv6_percent\": %u, \"features\": \"%s\", \"var_copy\": %s, \"avg_record_size\": %.1f}\n",
+             (unsigned long) processed, elapsed, rate, ns, cpr, kernels, cfg.ppi_min, cfg.ppi_max, cfg.ipv6,
+             feature_names, cfg.var_copy ? "true" : "false", (double) in_bytes / cfg.records);
+   } else {
+      printf("Kernels:           %s\n", kernels);
+      printf("Records:           %lu in %.3f s (%u distinct, %.1f B on average)\n", (unsigned long) processed,
+             elapsed, cfg.records, (double) in_bytes / cfg.records);
+      printf("Throughput:        %.0f records/s\n", rate);
+      printf("Time per record:   %.1f ns\n", ns);
+#ifdef BENCH_HAVE_TSC
+      printf("Cycles per record: %.1f (TSC)\n", cpr);
+#endif
+   }
+   ret = 0;
+
+cleanup:
+   access_plan_free(&plan);
+   ur_free_record(rec);
+   free(in_buf);
+   free(in_off);
+   free(in_size);
+   free(out_buf);
+   free(scratch);
+   free(out_spec);
+   free(feature_names);
+   if (in_tmplt != NULL) {
+      ur_free_template(in_tmplt);
+   }
+   if (out_tmplt != NULL) {
+      ur_free_template(out_tmplt);
+   }
+   ur_finalize();
+   return ret;
+}
@@ -46,6 +46,8 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 #include <getopt.h>
 #include <libtrap/trap.h>
@@ -54,12 +56,17 @@
 #include <unirec/ur_values.h>
 #include <limits.h>
 #include "fields.h"
-
-/**
- * Define input template spec and newly calculated features
- */
-#define IN_SPEC "DST_IP,SRC_IP,BYTES,BYTES_REV,TIME_FIRST,TIME_LAST,PACKETS,PACKETS_REV,PPI_PKT_DIRECTIONS,PPI_PKT_LENGTHS,PPI_PKT_TIMES,PPI_PKT_FLAGS"
-#define NEW_FEATURES "MAX_PKT_LEN,MIN_PKT_LEN,VAR_PKT_LENGTH,MEAN_PKT_LENGTH,MEAN_TIME_BETWEEN_PKTS,RECV_PERCENTAGE,SENT_PERCENTAGE,BYTES_TOTAL,PACKETS_TOTAL,PACKETS_RATIO,PACKETS_PER_MS,BYTES_PER_MS,BYTES_RATIO,TIME_DUR_MS,DATA_SYMMETRY"
+#include "pipeline.h"
+#include "ppi_kernels.h"
+#include "access_plan.h"
+#include "feature_set.h"
+#include "flow_features.h"
+#include "stats.h"
+#include "shard.h"
+#include "host_aggr.h"
+#include "heavy_hitters.h"
+#include "arrow_writer.h"
+#include "npy_writer.h"
 
 /**
  * Definition of fields used in unirec templates (for both input and output interfaces)
@@ -91,24 +98,157 @@ UR_FIELDS (
    double VAR_PKT_LENGTH,
    uint16 MIN_PKT_LEN,
    uint16 MAX_PKT_LEN,
-   double DATA_SYMMETRY
+   double DATA_SYMMETRY,
+   uint16* PKT_LEN_HIST_SENT,
+   uint16* PKT_LEN_HIST_RECV,
+   uint16* PKT_LEN_LOG_HIST_SENT,
+   uint16* PKT_LEN_LOG_HIST_RECV,
+   uint64 MIN_IAT_US,
+   uint64 MAX_IAT_US,
+   double STD_IAT_US,
+   double MEDIAN_IAT_US,
+   uint64 MIN_SENT_IAT_US,
+   uint64 MAX_SENT_IAT_US,
+   double STD_SENT_IAT_US,
+   double MEDIAN_SENT_IAT_US,
+   uint64 MIN_RECV_IAT_US,
+   uint64 MAX_RECV_IAT_US,
+   double STD_RECV_IAT_US,
+   double MEDIAN_RECV_IAT_US,
+   uint32 SENT_PKT_CNT,
+   uint32 RECV_PKT_CNT,
+   double MEAN_SENT_PKT_LENGTH,
+   double MEAN_RECV_PKT_LENGTH,
+   double VAR_SENT_PKT_LENGTH,
+   double VAR_RECV_PKT_LENGTH,
+   uint16 MIN_SENT_PKT_LEN,
+   uint16 MIN_RECV_PKT_LEN,
+   uint16 MAX_SENT_PKT_LEN,
+   uint16 MAX_RECV_PKT_LEN,
+   double MEAN_SENT_IAT_US,
+   double MEAN_RECV_IAT_US,
+   uint32 FIN_CNT,
+   uint32 SYN_CNT,
+   uint32 RST_CNT,
+   uint32 PSH_CNT,
+   uint32 ACK_CNT,
+   uint32 URG_CNT,
+   uint32 SENT_FIN_CNT,
+   uint32 SENT_SYN_CNT,
+   uint32 SENT_RST_CNT,
+   uint32 SENT_PSH_CNT,
+   uint32 SENT_ACK_CNT,
+   uint32 SENT_URG_CNT,
+   uint32 RECV_FIN_CNT,
+   uint32 RECV_SYN_CNT,
+   uint32 RECV_RST_CNT,
+   uint32 RECV_PSH_CNT,
+   uint32 RECV_ACK_CNT,
+   uint32 RECV_URG_CNT,
+   uint32 FIRST_FLAGS,
+   uint64 HANDSHAKE_SYNACK_US,
+   uint64 HANDSHAKE_ACK_US,
+   double PKT_LEN_ENTROPY,
+   double IAT_ENTROPY,
+   uint32 BURST_CNT,
+   double MEAN_BURST_PKTS,
+   double MEAN_BURST_BYTES,
+   uint64 MAX_IDLE_US,
+   uint32 BURST_DIR_CHANGES
 )
 
 trap_module_info_t *module_info = NULL;
 
 /**
  * Definition of basic module information - module name, module description, number of input and output interfaces
+ * (the numbers are changed by -n, -o and -s, see main())
  */
 #define MODULE_BASIC_INFO(BASIC) \
   BASIC("Feature engineer module", \
-        "This module serves as an preprocessor for calculating basic features that can be used in ML application.", 1, 1)
+        "This module serves as an preprocessor for calculating basic features that can be used in ML application. " \
+        "With -n N, records of N input interfaces are merged into one output. " \
+        "With -o K, records are distributed to K outputs by a hash of their IP addresses. " \
+        "With -s, runtime statistics are sent to an additional (last) output interface. " \
+        "With -w, records are extended by aggregates of their hosts over a sliding window. " \
+        "With -c, records are extended by Count-Min estimates of the flows and bytes of their hosts.", 1, 1)
   //BASIC(char *, char *, int, int)
 
 
 /**
- * Definition of module parameters - stays empty since this module has no module specific parameters.
+ * Definition of module parameters
+ */
+#define MODULE_PARAMS(PARAM) \
+  PARAM('t', "threads", "Number of threads computing features, records are sent in input order (default 1).", required_argument, "uint32") \
+  PARAM('b', "batch", "Number of records received, processed and sent together as one batch (default 1).", required_argument, "uint32") \
+  PARAM('f', "features", "Comma separated list of features computed and sent, ALL for all of them (default the original 15, MAX_PKT_LEN to DATA_SYMMETRY).", required_argument, "string") \
+  PARAM('p', "ppi", "Send also variable length fields of input records (PPI_PKT_* arrays), otherwise they are empty.", no_argument, "none") \
+  PARAM('l', "len-bins", "Packet length histograms have N bins of WIDTH bytes, the last one counts also all longer packets (default 16:100, N at most 64).", required_argument, "N:WIDTH") \
+  PARAM('g', "burst-gap", "Packets separated by at most US microseconds belong to the same burst (default 100000).", required_argument, "US") \
+  PARAM('H', "huge-pages", "Back the batch buffers by huge pages (transparent huge pages when none are reserved).", no_argument, "none") \
+  PARAM('A', "arrow", "Write the features and the -F fields to Arrow IPC stream files PREFIX.NNNNNN.arrows as well.", required_argument, "PREFIX") \
+  PARAM('F', "arrow-fields", "With -A, input fields exported besides the computed ones (default DST_IP,SRC_IP,TIME_FIRST,TIME_LAST).", required_argument, "LIST") \
+  PARAM('r', "arrow-rows", "With -A, rows of an Arrow record batch (default 65536).", required_argument, "uint32") \
+  PARAM('R', "arrow-size", "With -A, start a new file when the current one exceeds N MiB (default off).", required_argument, "uint32") \
+  PARAM('T', "arrow-time", "With -A, start a new file every N seconds (default off).", required_argument, "uint32") \
+  PARAM('X', "matrix", "Write the computed fields as a float32 matrix to NumPy files PREFIX.NNNNNN.npy and the flow keys to PREFIX.NNNNNN.keys.npy as well.", required_argument, "PREFIX") \
+  PARAM('Y', "matrix-keys", "With -X, flow key fields, e.g. SRC_PORT when the input has it (default SRC_IP,DST_IP,TIME_FIRST,TIME_LAST).", required_argument, "LIST") \
+  PARAM('N', "matrix-rows", "With -X, start new files after N rows (default off).", required_argument, "uint32") \
+  PARAM('Z', "matrix-time", "With -X, start new files every N seconds (default off).", required_argument, "uint32") \
+  PARAM('s', "stats", "Send counters and latency percentiles to an additional output interface every N seconds (default off).", required_argument, "uint32") \
+  PARAM('n', "inputs", "Number of input interfaces, each is received by its own thread (default 1).", required_argument, "uint32") \
+  PARAM('o', "outputs", "Number of output interfaces, records are routed by a hash of the shard key (default 1).", required_argument, "uint32") \
+  PARAM('k', "shard-key", "Shard key of -o: SRC_IP, DST_IP or IP_PAIR (both addresses, symmetric) (default SRC_IP).", required_argument, "string") \
+  PARAM('w', "window", "Add flow, byte and packet counts of the source host in the last N seconds (default off).", required_argument, "uint32") \
+  PARAM('d', "dst-hosts", "With -w, add the counts of the destination host as well.", no_argument, "none") \
+  PARAM('m', "max-hosts", "With -w, maximum number of tracked hosts per direction, the oldest are evicted (default 1048576).", required_argument, "uint32") \
+  PARAM('u', "distinct-dst", "With -w, add the number of distinct destinations of the source host estimated by HyperLogLog with 2^P registers (P 4-16).", required_argument, "uint32") \
+  PARAM('M', "distinct-memory", "With -u, memory of the sketches in MiB, it bounds the number of tracked sources (default 256).", required_argument, "uint32") \
+  PARAM('c', "cms-width", "Add Count-Min estimates of flows and bytes of the source and destination hosts, N counters per sketch row (default off).", required_argument, "uint32") \
+  PARAM('e', "cms-depth", "With -c, number of rows of the sketches (default 4, at most 8).", required_argument, "uint32") \
+  PARAM('W', "cms-window", "With -c, window of the estimates in seconds (default 60).", required_argument, "uint32") \
+  PARAM('K', "top-k", "With -c and -s, send the K heaviest source and destination hosts by bytes with the statistics.", required_argument, "uint32")
+
+/**
+ * Receive timeout in microseconds used in batch mode, a partially filled batch
+ * is sent and the output interface flushed when no record arrives in time.
+ */
+#define BATCH_TIMEOUT 100000
+
+/**
+ * Upper limit of the batch size
+ */
+#define BATCH_MAX 65536
+
+/**
+ * Upper limit of the number of input interfaces
+ */
+#define INPUTS_MAX 256
+
+/**
+ * Upper limit of the number of (data) output interfaces
+ */
+#define OUTPUTS_MAX 256
+
+/**
+ * Output interface of records that failed processing, they are not sent
  */
-#define MODULE_PARAMS(PARAM)
+#define OUTPUT_DROP UINT16_MAX
+
+/**
+ * Default number of hosts tracked by -w
+ */
+#define HOSTS_DEFAULT 1048576
+
+/**
+ * Default memory of the distinct destination sketches of -u in MiB
+ */
+#define DISTINCT_MEMORY_DEFAULT 256
+
+/**
+ * Defaults of the Count-Min sketches of -c
+ */
+#define CMS_DEPTH_DEFAULT 4
+#define CMS_WINDOW_DEFAULT 60
 
 /**
  * Flag variable which manage the loop
@@ -121,193 +261,849 @@ static int stop = 0;
 TRAP_DEFAULT_SIGNAL_HANDLER(stop = 1)
 
 /**
- *  Processing function.
+ * State of one input interface, used by the thread receiving from it. The
+ * plan is read by the workers as well, it is changed only while the pipeline
+ * is paused.
+ */
+typedef struct fe_input_s {
+   ur_template_t *tmplt;  ///< input template
+   access_plan_t plan;    ///< field offsets for tmplt and the output template
+   const void *pending;   ///< received record which did not fit into the previous batch
+   uint16_t pending_size; ///< size of the pending record, 0 if there is none
+   int format_changed;    ///< the pending record is the first one in a new input format
+} fe_input_t;
+
+/**
+ * Templates shared by the pipeline callbacks
+ */
+typedef struct fe_ctx_s {
+   fe_input_t *inputs;        ///< input interfaces, indexed by the pipeline receiver (slot->source)
+   uint32_t input_cnt;        ///< number of input interfaces (-n)
+   uint32_t output_cnt;       ///< number of data output interfaces (-o), all use out_tmplt
+   ur_template_t *out_tmplt;
+   feature_set_t features;    ///< features selected by -f
+   int var_copy;              ///< variable length fields are sent (-p)
+   uint32_t len_bins;         ///< bins of the packet length histograms (-l)
+   pipeline_t *pipeline;      ///< pipeline running the callbacks
+   stats_t *stats;            ///< runtime statistics (-s), NULL when disabled
+   host_aggr_t *hosts;        ///< per-host aggregates (-w), NULL when disabled, used by the sender only
+   hh_t *hh;                  ///< heavy hitter estimates (-c), NULL when disabled, used by the sender only
+   arrow_writer_t *arrow;     ///< Arrow export (-A), NULL when disabled, used by the sender only
+   npy_writer_t *matrix;      ///< feature matrix export (-X), NULL when disabled, used by the sender only
+} fe_ctx_t;
+
+/**
+ * Space of an output record, its fixed part and the array features (the copied
+ * variable length fields have their space in the pipeline)
+ */
+static uint16_t out_rec_size(const fe_ctx_t *ctx)
+{
+   return ur_rec_fixlen_size(ctx->out_tmplt) + flow_features_var_size(ctx->features, ctx->len_bins);
+}
+
+/**
+ * Append comma separated fields to the output template specification
+ */
+static char *append_spec(char *spec, const char *fields)
+{
+   size_t len = strlen(spec);
+   char *out = realloc(spec, len + strlen(fields) + 2);
+   if (out == NULL) {
+      free(spec);
+      return NULL;
+   }
+   out[len] = ',';
+   strcpy(out + len + 1, fields);
+   return out;
+}
+
+/**
+ * Columns of the feature matrix (-X): the selected features, histograms with
+ * a column per bin
+ */
+static char *matrix_spec(feature_set_t features, uint32_t len_bins)
+{
+   char *names = feature_set_spec("", features);
+   if (names == NULL) {
+      return NULL;
+   }
+   // room for ":N" after each histogram
+   char *spec = malloc(strlen(names) + 4 * 8 + 1);
+   if (spec == NULL) {
+      free(names);
+      return NULL;
+   }
+   spec[0] = '\0';
+   char *save = NULL;
+   for (char *name = strtok_r(names, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+      size_t len = strlen(spec);
+      if (strncmp(name, "PKT_LEN_HIST_", 13) == 0) {
+         sprintf(spec + len, "%s%s:%u", len > 0 ? "," : "", name, len_bins);
+      } else if (strncmp(name, "PKT_LEN_LOG_HIST_", 17) == 0) {
+         sprintf(spec + len, "%s%s:%u", len > 0 ? "," : "", name, PPI_LOG_BINS);
+      } else {
+         sprintf(spec + len, "%s%s", len > 0 ? "," : "", name);
+      }
+   }
+   free(names);
+   return spec;
+}
+
+/**
+ * Create the output template passing through fields of all inputs and the
+ * selected features (followed by the fields of the stateful stages), and
+ * build access plans of all inputs for it. The plans are built aside and
+ * replace the current ones together with the template, so the context is left
+ * unchanged when the template or a plan cannot be created. When a later step
+ * (the output records or a stateful stage) fails, the stages may be bound to
+ * the new template already and the caller has to stop the pipeline.
  */
-static inline int process_flow(ur_template_t* in_tmplt, const void* in_rec, ur_template_t* out_tmplt, void* out_rec) {
-   
-   // First read input fields
-   // scalars:
-   uint64_t bytes = ur_get(in_tmplt, in_rec, F_BYTES);
-   uint64_t bytes_rev = ur_get(in_tmplt, in_rec, F_BYTES_REV);
-   ur_time_t time_start = ur_get(in_tmplt, in_rec, F_TIME_FIRST);
-   ur_time_t time_last = ur_get(in_tmplt, in_rec, F_TIME_LAST);
-   uint32_t packets = ur_get(in_tmplt, in_rec, F_PACKETS);
-   uint32_t packets_rev = ur_get(in_tmplt, in_rec, F_PACKETS_REV);
-   // vectors:
-   int8_t* pkt_dirs = (int8_t*)ur_get_ptr(in_tmplt, in_rec, F_PPI_PKT_DIRECTIONS);
-   uint16_t* pkt_lens = (uint16_t*)ur_get_ptr(in_tmplt, in_rec, F_PPI_PKT_LENGTHS);
-   ur_time_t* pkt_times = (ur_time_t*)ur_get_ptr(in_tmplt, in_rec, F_PPI_PKT_TIMES);
-   //uint8_t* pkt_flags = (uint8_t*)ur_get_ptr(in_tmplt, in_rec, F_PPI_PKT_FLAGS);
-
-   // Then compute features
-   // 1. Duration
-   uint64_t time_duration_ms = ur_timediff(time_last, time_start);
-   // 2. Totals
-   uint64_t bytes_total = bytes + bytes_rev;
-   uint32_t packets_total = packets + packets_rev;
-   // 3. Feature ratios
-   double bytes_ratio = bytes_rev == 0 ? 0 : (double)bytes/(double)bytes_rev;
-   double packets_ratio = packets_rev == 0 ? 0 : (double)packets/(double)packets_rev;
-   // 4. "Features" per milisecond
-   double bytes_per_ms = (double)(bytes+bytes_rev)/(double)time_duration_ms;
-   double packets_per_ms = (double)(packets+packets_rev)/(double)time_duration_ms;
-   // 5. Arrays
-   uint16_t pkt_dirs_len = ur_get_var_len(in_tmplt, in_rec, F_PPI_PKT_DIRECTIONS);
-   uint32_t sent = 0, recv = 0, interval_sum = 0, interval_cnt = 0;
-   uint16_t min_pkt_length = INT16_MAX, max_pkt_length = 0;
-   uint64_t pkt_length_sum = 0, pkt_length_sum_squared = 0; // use case is calculate mean and var in one interation
-   uint64_t bytes_sent = 0, bytes_recv = 0; // for data symmetry (ratio of sent/recv bytes)
-
-   // Use only one loop through all vectors. Invariant is all arrays are always the same length
-   for(int i = 0; i < pkt_dirs_len; ++i) {
-      // direction count
-      pkt_dirs[i] == 1 ? sent++ : recv++;
-      pkt_dirs[i] == 1 ? bytes_sent += pkt_lens[i] : bytes_recv += pkt_lens[i];
-      // intervals and time stuff
-      interval_sum += (i < pkt_dirs_len-1) ? ur_timediff(pkt_times[i+1], pkt_times[i]) : 0;
-      interval_cnt += 1;
-      // length statistics
-      pkt_length_sum += pkt_lens[i]; pkt_length_sum_squared += pkt_lens[i]*pkt_lens[i];
-      min_pkt_length = pkt_lens[i] < min_pkt_length ? pkt_lens[i] : min_pkt_length;
-      max_pkt_length = pkt_lens[i] > max_pkt_length ? pkt_lens[i] : max_pkt_length;
-   }
-   // final statistical calculations
-   double mean_pkt_time = interval_cnt == 0 ? 0 : (double)interval_sum / (double)interval_cnt;
-   double mean_pkt_len = pkt_dirs_len == 0 ? 0 : (double)pkt_length_sum / (double)pkt_dirs_len;
-   double var_pkt_len  = mean_pkt_len == 0 ? 0 : ((double)pkt_length_sum_squared/(double)pkt_dirs_len) - (mean_pkt_len*mean_pkt_len);
-   double data_symmetry = bytes_sent / bytes_recv;
-
-   // Finally, fill the output record
-
-   // Original fields, only copy //TODO make it macro
-   ur_set(out_tmplt, out_rec, F_DST_IP, ur_get(in_tmplt, in_rec, F_DST_IP));
-   ur_set(out_tmplt, out_rec, F_SRC_IP, ur_get(in_tmplt, in_rec, F_SRC_IP));
-   ur_set(out_tmplt, out_rec, F_TIME_FIRST, ur_get(in_tmplt, in_rec, F_TIME_FIRST));
-   ur_set(out_tmplt, out_rec, F_TIME_LAST, ur_get(in_tmplt, in_rec, F_TIME_LAST));
-   ur_set(out_tmplt, out_rec, F_BYTES, ur_get(in_tmplt, in_rec, F_BYTES));
-   ur_set(out_tmplt, out_rec, F_BYTES_REV, ur_get(in_tmplt, in_rec, F_BYTES_REV));
-   ur_set(out_tmplt, out_rec, F_PACKETS, ur_get(in_tmplt, in_rec, F_PACKETS));
-   ur_set(out_tmplt, out_rec, F_PACKETS_REV, ur_get(in_tmplt, in_rec, F_PACKETS_REV));
-   // New fields
-   ur_set(out_tmplt, out_rec, F_BYTES_RATIO, bytes_ratio);
-   ur_set(out_tmplt, out_rec, F_TIME_DUR_MS, time_duration_ms);
-   ur_set(out_tmplt, out_rec, F_BYTES_PER_MS, bytes_per_ms);
-   ur_set(out_tmplt, out_rec, F_PACKETS_PER_MS, packets_per_ms);
-   ur_set(out_tmplt, out_rec, F_PACKETS_RATIO, packets_ratio);
-   ur_set(out_tmplt, out_rec, F_PACKETS_TOTAL, packets_total);
-   ur_set(out_tmplt, out_rec, F_BYTES_TOTAL, bytes_total);
-   ur_set(out_tmplt, out_rec, F_SENT_PERCENTAGE, sent+recv == 0 ? 0 : sent/(sent+recv));
-   ur_set(out_tmplt, out_rec, F_RECV_PERCENTAGE, sent+recv == 0 ? 0 : recv/(sent+recv));
-   ur_set(out_tmplt, out_rec, F_MEAN_TIME_BETWEEN_PKTS, mean_pkt_time);
-   ur_set(out_tmplt, out_rec, F_MEAN_PKT_LENGTH, mean_pkt_len);
-   ur_set(out_tmplt, out_rec, F_VAR_PKT_LENGTH, var_pkt_len);
-   ur_set(out_tmplt, out_rec, F_MIN_PKT_LENGTH, min_pkt_length);
-   ur_set(out_tmplt, out_rec, F_MAX_PKT_LENGTH, min_pkt_length);
-   ur_set(out_tmplt, out_rec, F_DATA_SYMMETRY, data_symmetry);
-   
+static int update_out_template(fe_ctx_t *ctx)
+{
+   const ur_template_t *in_tmplts[INPUTS_MAX];
+
+   for (uint32_t i = 0; i < ctx->input_cnt; i++) {
+      in_tmplts[i] = ctx->inputs[i].tmplt;
+   }
+   char *out_spec = access_plan_out_spec(in_tmplts, ctx->input_cnt, ctx->features);
+   if (out_spec != NULL && ctx->hosts != NULL) {
+      out_spec = append_spec(out_spec, host_aggr_spec(ctx->hosts));
+   }
+   if (out_spec != NULL && ctx->hh != NULL) {
+      out_spec = append_spec(out_spec, hh_spec());
+   }
+   if (out_spec == NULL) {
+      fprintf(stderr, "Error: Memory allocation problem (output template).\n");
+      return -1;
+   }
+   ur_template_t *out_tmplt = ur_create_output_template(0, out_spec, NULL);
+   free(out_spec);
+   if (out_tmplt == NULL) {
+      fprintf(stderr, "Error: Output template could not be created.\n");
+      return -1;
+   }
+   access_plan_t *plans = malloc(ctx->input_cnt * sizeof(access_plan_t));
+   if (plans == NULL) {
+      ur_free_template(out_tmplt);
+      fprintf(stderr, "Error: Memory allocation problem (access plans).\n");
+      return -1;
+   }
+   uint32_t built;
+   for (built = 0; built < ctx->input_cnt; built++) {
+      // parameters set by the caller are kept, the field lists are built anew
+      plans[built] = ctx->inputs[built].plan;
+      plans[built].copy = NULL;
+      plans[built].zero = NULL;
+      plans[built].var = NULL;
+      if (access_plan_build(&plans[built], ctx->inputs[built].tmplt, out_tmplt, ctx->var_copy) != 0) {
+         access_plan_free(&plans[built]);
+         break;
+      }
+   }
+   if (built < ctx->input_cnt) {
+      for (uint32_t i = 0; i < built; i++) {
+         access_plan_free(&plans[i]);
+      }
+      free(plans);
+      ur_free_template(out_tmplt);
+      return -1;
+   }
+   for (uint32_t i = 0; i < ctx->input_cnt; i++) {
+      access_plan_free(&ctx->inputs[i].plan);
+      ctx->inputs[i].plan = plans[i];
+   }
+   free(plans);
+   ur_free_template(ctx->out_tmplt);
+   ctx->out_tmplt = out_tmplt;
+   for (uint32_t i = 1; i < ctx->output_cnt; i++) {
+      ur_set_output_template(i, out_tmplt);
+   }
+   if (ctx->pipeline != NULL && pipeline_set_out_rec_size(ctx->pipeline, out_rec_size(ctx)) != 0) {
+      fprintf(stderr, "Error: Memory allocation problem (output record).\n");
+      return -1;
+   }
+   if (ctx->hosts != NULL && host_aggr_bind(ctx->hosts, out_tmplt) != 0) {
+      return -1;
+   }
+   if (ctx->hh != NULL && hh_bind(ctx->hh, out_tmplt) != 0) {
+      return -1;
+   }
+   if (ctx->arrow != NULL && arrow_writer_bind(ctx->arrow, out_tmplt) != 0) {
+      return -1;
+   }
+   if (ctx->matrix != NULL && npy_writer_bind(ctx->matrix, out_tmplt) != 0) {
+      return -1;
+   }
    return 0;
 }
 
-int main(int argc, char **argv)
+/**
+ * Switch input interface ifc to the format newly negotiated by libtrap:
+ * rebuild its template, the output template and the access plans. Records
+ * received in the previous format are still in the pipeline, so it is paused
+ * first (all of them are processed and sent with the old templates). On
+ * failure the whole pipeline is stopped, the other receivers must not publish
+ * records for templates which may no longer match the stages.
+ */
+static int update_templates(fe_ctx_t *ctx, uint32_t ifc)
 {
+   const char *spec = NULL;
+   uint8_t data_fmt;
+   int ret = -1;
+
+   if (pipeline_pause(ctx->pipeline) != 0) {
+      return -1;
+   }
+   if (trap_get_data_fmt(TRAPIFC_INPUT, ifc, &data_fmt, &spec) != TRAP_E_OK) {
+      fprintf(stderr, "Error: Data format was not loaded.\n");
+   } else {
+      ur_template_t *in_tmplt = ur_define_fields_and_update_template(spec, ctx->inputs[ifc].tmplt);
+      if (in_tmplt == NULL) {
+         fprintf(stderr, "Error: Input template could not be updated.\n");
+      } else {
+         ctx->inputs[ifc].tmplt = in_tmplt;
+         // Fields added upstream are passed through, so the output format changes as well
+         ret = update_out_template(ctx);
+      }
+   }
+   if (ret != 0) {
+      pipeline_fail(ctx->pipeline);
+   } else {
+      pipeline_resume(ctx->pipeline);
+   }
+   return ret;
+}
+
+/**
+ * Check a record received from input interface ifc and append it to the batch.
+ * Returns 0 when added, 1 to stop receiving, 2 when the batch is full (the record is kept as pending).
+ */
+static int add_record(fe_ctx_t *ctx, uint32_t ifc, pipeline_slot_t *slot, const void *in_rec, uint16_t in_rec_size)
+{
+   fe_input_t *input = &ctx->inputs[ifc];
+
+   // Check size of received data
+   if (in_rec_size < ur_rec_fixlen_size(input->tmplt)) {
+      if (in_rec_size <= 1) {
+         return 1; // End of data (used for testing purposes)
+      } else {
+         fprintf(stderr, "Error: data with wrong size received (expected size: >= %hu, received size: %hu)\n",
+                 ur_rec_fixlen_size(input->tmplt), in_rec_size);
+         stats_count_input(ctx->stats, ifc, STATS_INPUT_SHORT_RECORDS, 1);
+         return 1;
+      }
+   }
+
+   if (pipeline_slot_add(slot, in_rec, in_rec_size) != 0) {
+      input->pending = in_rec;
+      input->pending_size = in_rec_size;
+      return 2;
+   }
+   stats_count_input(ctx->stats, ifc, STATS_INPUT_RECORDS_IN, 1);
+   return 0;
+}
+
+/**
+ * Receive a batch of records from the input interface of the slot's receiver and copy them into the slot.
+ */
+static int receive_records(pipeline_slot_t *slot, fe_ctx_t *ctx)
+{
+   uint32_t ifc = slot->source;
+   fe_input_t *input = &ctx->inputs[ifc];
+   const void *in_rec;
+   uint16_t in_rec_size;
    int ret;
+
+   // Libtrap keeps the buffer of the last received record valid until the next trap_recv()
+   if (input->pending_size > 0) {
+      if (input->format_changed) {
+         input->format_changed = 0;
+         if (update_templates(ctx, ifc) != 0) {
+            return 1;
+         }
+      }
+      in_rec_size = input->pending_size;
+      input->pending_size = 0;
+      if (add_record(ctx, ifc, slot, input->pending, in_rec_size) != 0) {
+         return 1;
+      }
+   }
+
+   while (!stop) {
+      // Receive data from the input interface.
+      // Block if data are not available immediately (unless a timeout is set using trap_ifcctl)
+      ret = trap_recv(ifc, &in_rec, &in_rec_size);
+
+      // Do not hold back a partially filled batch when the input is idle
+      if (ret == TRAP_E_TIMEOUT && slot->count > 0) {
+         slot->flush = 1;
+         return 0;
+      }
+
+      // The record comes in a new format, records of the current batch have to be finished with the old one
+      if (ret == TRAP_E_FORMAT_CHANGED) {
+         if (slot->count > 0) {
+            input->pending = in_rec;
+            input->pending_size = in_rec_size;
+            input->format_changed = 1;
+            return 0;
+         }
+         if (update_templates(ctx, ifc) != 0) {
+            return 1;
+         }
+         ret = TRAP_E_OK;
+      }
+
+      // Handle possible errors
+      TRAP_DEFAULT_RECV_ERROR_HANDLING(ret, continue, return 1);
+
+      ret = add_record(ctx, ifc, slot, in_rec, in_rec_size);
+      if (ret == 1) {
+         return 1;
+      }
+      if (ret == 2 || slot->count == slot->capacity) {
+         return 0;
+      }
+   }
+   return 1;
+}
+
+/**
+ * Pipeline callback: receive a batch of records, the time spent (including
+ * waiting for input) is accounted to the receive stage of the statistics.
+ */
+static int receive_batch(pipeline_slot_t *slot, void *arg)
+{
+   fe_ctx_t *ctx = (fe_ctx_t *)arg;
+
+   if (ctx->stats == NULL) {
+      return receive_records(slot, ctx);
+   }
+   uint64_t start = stats_now();
+   int ret = receive_records(slot, ctx);
+   stats_latency(ctx->stats, STATS_STAGE_RECV, stats_now() - start, slot->count);
+   return ret;
+}
+
+/**
+ * Pipeline callback: compute features of all records in the slot, runs in worker threads.
+ */
+static void process_batch(pipeline_slot_t *slot, void *arg)
+{
+   fe_ctx_t *ctx = (fe_ctx_t *)arg;
+   const access_plan_t *plan = &ctx->inputs[slot->source].plan;
+   uint64_t start = ctx->stats != NULL ? stats_now() : 0;
+
+   for (uint32_t i = 0; i < slot->count; i++) {
+      // The output interface is computed together with the features
+      int ifc = process_flow(plan, pipeline_slot_in_rec(slot, i), slot->in_size[i], pipeline_slot_out_rec(slot, i),
+                             slot->scratch);
+      if (ifc == -1){
+         fprintf(stderr, "Error: Processing error (packet arrays out of the record)\n");
+         stats_count(ctx->stats, STATS_PROCESS_ERRORS, 1);
+         ifc = OUTPUT_DROP;
+      }
+      slot->out_ifc[i] = (uint16_t) ifc;
+   }
+   if (ctx->stats != NULL) {
+      stats_latency(ctx->stats, STATS_STAGE_PROC, stats_now() - start, slot->count);
+   }
+}
+
+/**
+ * Release the pipeline, statistics, templates and access plans of the context
+ */
+static void free_ctx(fe_ctx_t *ctx)
+{
+   pipeline_destroy(ctx->pipeline);
+   stats_destroy(ctx->stats);
+   for (uint32_t i = 0; i < ctx->input_cnt && ctx->inputs != NULL; i++) {
+      ur_free_template(ctx->inputs[i].tmplt);
+      access_plan_free(&ctx->inputs[i].plan);
+   }
+   free(ctx->inputs);
+   host_aggr_destroy(ctx->hosts);
+   hh_destroy(ctx->hh);
+   arrow_writer_destroy(ctx->arrow);
+   npy_writer_destroy(ctx->matrix);
+   ur_free_template(ctx->out_tmplt);
+}
+
+/**
+ * Pipeline callback: send output records of the slot back to back to their output interfaces, called in input order.
+ * Stateful stages (per-host aggregates, heavy hitters) see the records here, in the order they are sent.
+ */
+static int send_batch(pipeline_slot_t *slot, void *arg)
+{
+   fe_ctx_t *ctx = (fe_ctx_t *)arg;
+   uint64_t start = ctx->stats != NULL ? stats_now() : 0;
+   int ret;
+
+   for (uint32_t i = 0; i < slot->count; i++) {
+      void *out_rec = pipeline_slot_out_rec(slot, i);
+      if (slot->out_ifc[i] == OUTPUT_DROP) {
+         continue;
+      }
+      if (ctx->hosts != NULL) {
+         host_aggr_update(ctx->hosts, out_rec);
+      }
+      if (ctx->hh != NULL) {
+         hh_update(ctx->hh, out_rec);
+      }
+      if (ctx->arrow != NULL && arrow_writer_append(ctx->arrow, out_rec) != 0) {
+         return 1;
+      }
+      if (ctx->matrix != NULL && npy_writer_append(ctx->matrix, out_rec) != 0) {
+         return 1;
+      }
+      uint16_t size = ctx->var_copy || (ctx->features & FEATURES_PPI_HIST) ? ur_rec_size(ctx->out_tmplt, out_rec)
+                                                                            : ur_rec_fixlen_size(ctx->out_tmplt);
+
+      // Send record to its output interface.
+      // Block if ifc is not ready (unless a timeout is set using trap_ifcctl)
+      ret = trap_send(slot->out_ifc[i], out_rec, size);
+      if (ret != TRAP_E_OK) {
+         stats_count(ctx->stats, STATS_SEND_ERRORS, 1);
+      }
+
+      // Handle possible errors
+      TRAP_DEFAULT_SEND_ERROR_HANDLING(ret, continue, return 1);
+      stats_count(ctx->stats, STATS_RECORDS_OUT, 1);
+   }
+   if (slot->flush) {
+      for (uint32_t i = 0; i < ctx->output_cnt; i++) {
+         trap_send_flush(i);
+      }
+   }
+   if (ctx->arrow != NULL && arrow_writer_tick(ctx->arrow, time(NULL)) != 0) {
+      return 1;
+   }
+   if (ctx->matrix != NULL && npy_writer_tick(ctx->matrix, time(NULL)) != 0) {
+      return 1;
+   }
+   if (ctx->stats != NULL) {
+      if (ctx->hh != NULL) {
+         hh_publish(ctx->hh, start, 0);
+      }
+      stats_latency(ctx->stats, STATS_STAGE_SEND, stats_now() - start, slot->count);
+   }
+   return 0;
+}
+
+/**
+ * Parse a decimal uint32 option value, returns -1 when it is not a number
+ */
+static int parse_uint32(const char *str, uint32_t *value)
+{
+   char *end;
+   unsigned long v = strtoul(str, &end, 10);
+   if (*str < '0' || *str > '9' || *end != '\0' || v > UINT32_MAX) {
+      return -1;
+   }
+   *value = v;
+   return 0;
+}
+
+int main(int argc, char **argv)
+{
    signed char opt;
+   uint32_t threads = 1;
+   uint32_t batch = 1;
+   feature_set_t features = FEATURES_DEFAULT;
+   int var_copy = 0;
+   int huge_pages = 0;
+   const char *arrow_prefix = NULL;
+   const char *arrow_fields = ARROW_FIELDS_DEFAULT;
+   uint32_t arrow_rows = ARROW_ROWS_DEFAULT;
+   uint32_t arrow_size = 0;
+   uint32_t arrow_interval = 0;
+   const char *matrix_prefix = NULL;
+   const char *matrix_keys = NPY_KEYS_DEFAULT;
+   uint32_t matrix_rows = 0;
+   uint32_t matrix_interval = 0;
+   uint32_t len_bins = PLAN_LEN_BINS_DEFAULT;
+   uint32_t len_bin_width = PLAN_LEN_BIN_WIDTH_DEFAULT;
+   uint32_t burst_gap = PLAN_BURST_GAP_DEFAULT;
+   uint32_t stats_interval = 0;
+   uint32_t inputs = 1;
+   uint32_t outputs = 1;
+   shard_key_t shard_key = SHARD_KEY_SRC_IP;
+   uint32_t window = 0;
+   int dst_hosts = 0;
+   uint32_t max_hosts = HOSTS_DEFAULT;
+   uint32_t precision = 0;
+   uint32_t distinct_memory = DISTINCT_MEMORY_DEFAULT;
+   uint32_t cms_width = 0;
+   uint32_t cms_depth = CMS_DEPTH_DEFAULT;
+   uint32_t cms_window = CMS_WINDOW_DEFAULT;
+   uint32_t topk = 0;
+   int invalid = 0;
+   int ret;
 
    /* **** TRAP initialization **** */
 
    /*
     * Macro allocates and initializes module_info structure according to MODULE_BASIC_INFO and MODULE_PARAMS
-    * definitions on the lines 71 and 84 of this file. It also creates a string with short_opt letters for getopt
+    * definitions above. It also creates a string with short_opt letters for getopt
     * function called "module_getopt_string" and long_options field for getopt_long function in variable "long_options"
     */
    INIT_MODULE_INFO_STRUCT(MODULE_BASIC_INFO, MODULE_PARAMS)
 
    /*
-    * Let TRAP library parse program arguments, extract its parameters and initialize module interfaces
-    */
-   TRAP_DEFAULT_INITIALIZATION(argc, argv, *module_info);
-
-   /*
-    * Register signal handler.
+    * Let TRAP library parse program arguments and extract its parameters. Interfaces are initialized only after
+    * the module parameters are parsed, because they decide the number of interfaces.
     */
-   TRAP_REGISTER_DEFAULT_SIGNAL_HANDLER();
+   trap_ifc_spec_t ifc_spec;
+   ret = trap_parse_params(&argc, argv, &ifc_spec);
+   if (ret != TRAP_E_OK) {
+      if (ret == TRAP_E_HELP) {
+         trap_print_help(module_info);
+         FREE_MODULE_INFO_STRUCT(MODULE_BASIC_INFO, MODULE_PARAMS);
+         return 0;
+      }
+      trap_free_ifc_spec(ifc_spec);
+      fprintf(stderr, "ERROR in parsing of parameters for TRAP: %s\n", trap_last_error_msg);
+      FREE_MODULE_INFO_STRUCT(MODULE_BASIC_INFO, MODULE_PARAMS);
+      return 1;
+   }
 
    /*
     * Parse program arguments defined by MODULE_PARAMS macro with getopt() function (getopt_long() if available)
     * This macro is defined in config.h file generated by configure script
     */
-   while ((opt = TRAP_GETOPT(argc, argv, module_getopt_string, long_options)) != -1) {
+   while (!invalid && (opt = TRAP_GETOPT(argc, argv, module_getopt_string, long_options)) != -1) {
       switch (opt) {
+      case 't':
+         threads = strtoul(optarg, NULL, 10);
+         if (threads == 0) {
+            fprintf(stderr, "Invalid number of threads.\n");
+            invalid = 1;
+         }
+         break;
+      case 'b':
+         batch = strtoul(optarg, NULL, 10);
+         if (batch == 0 || batch > BATCH_MAX) {
+            fprintf(stderr, "Invalid batch size.\n");
+            invalid = 1;
+         }
+         break;
+      case 'f':
+         if (feature_set_parse(optarg, &features) != 0) {
+            invalid = 1;
+         }
+         break;
+      case 'p':
+         var_copy = 1;
+         break;
+      case 'l': {
+         char *end;
+         len_bins = strtoul(optarg, &end, 10);
+         len_bin_width = *end == ':' ? strtoul(end + 1, &end, 10) : 0;
+         if (len_bins == 0 || len_bins > PPI_HIST_BINS_MAX || len_bin_width == 0 || len_bin_width > UINT16_MAX ||
+             *end != '\0') {
+            fprintf(stderr, "Invalid packet length histogram bins.\n");
+            invalid = 1;
+         }
+         break;
+      }
+      case 'g':
+         burst_gap = strtoul(optarg, NULL, 10);
+         if (burst_gap == 0) {
+            fprintf(stderr, "Invalid burst gap.\n");
+            invalid = 1;
+         }
+         break;
+      case 'H':
+         huge_pages = 1;
+         break;
+      case 'A':
+         arrow_prefix = optarg;
+         break;
+      case 'F':
+         arrow_fields = optarg;
+         break;
+      case 'r':
+         if (parse_uint32(optarg, &arrow_rows) != 0 || arrow_rows == 0 || arrow_rows > INT32_MAX) {
+            fprintf(stderr, "Invalid number of Arrow rows.\n");
+            invalid = 1;
+         }
+         break;
+      case 'R':
+         if (parse_uint32(optarg, &arrow_size) != 0) {
+            fprintf(stderr, "Invalid size of Arrow files.\n");
+            invalid = 1;
+         }
+         break;
+      case 'T':
+         if (parse_uint32(optarg, &arrow_interval) != 0) {
+            fprintf(stderr, "Invalid interval of Arrow files.\n");
+            invalid = 1;
+         }
+         break;
+      case 'X':
+         matrix_prefix = optarg;
+         break;
+      case 'Y':
+         matrix_keys = optarg;
+         break;
+      case 'N':
+         if (parse_uint32(optarg, &matrix_rows) != 0) {
+            fprintf(stderr, "Invalid number of rows of matrix files.\n");
+            invalid = 1;
+         }
+         break;
+      case 'Z':
+         if (parse_uint32(optarg, &matrix_interval) != 0) {
+            fprintf(stderr, "Invalid interval of matrix files.\n");
+            invalid = 1;
+         }
+         break;
+      case 's':
+         stats_interval = strtoul(optarg, NULL, 10);
+         if (stats_interval == 0) {
+            fprintf(stderr, "Invalid statistics interval.\n");
+            invalid = 1;
+         }
+         break;
+      case 'n':
+         inputs = strtoul(optarg, NULL, 10);
+         if (inputs == 0 || inputs > INPUTS_MAX) {
+            fprintf(stderr, "Invalid number of input interfaces.\n");
+            invalid = 1;
+         }
+         break;
+      case 'o':
+         outputs = strtoul(optarg, NULL, 10);
+         if (outputs == 0 || outputs > OUTPUTS_MAX) {
+            fprintf(stderr, "Invalid number of output interfaces.\n");
+            invalid = 1;
+         }
+         break;
+      case 'k':
+         if (shard_key_parse(optarg, &shard_key) != 0) {
+            invalid = 1;
+         }
+         break;
+      case 'w':
+         window = strtoul(optarg, NULL, 10);
+         if (window == 0) {
+            fprintf(stderr, "Invalid window.\n");
+            invalid = 1;
+         }
+         break;
+      case 'd':
+         dst_hosts = 1;
+         break;
+      case 'm':
+         max_hosts = strtoul(optarg, NULL, 10);
+         if (max_hosts == 0 || max_hosts > HOST_TABLE_MAX) {
+            fprintf(stderr, "Invalid maximum number of hosts.\n");
+            invalid = 1;
+         }
+         break;
+      case 'u':
+         precision = strtoul(optarg, NULL, 10);
+         if (precision < HLL_PRECISION_MIN || precision > HLL_PRECISION_MAX) {
+            fprintf(stderr, "Invalid precision of distinct destinations.\n");
+            invalid = 1;
+         }
+         break;
+      case 'M':
+         distinct_memory = strtoul(optarg, NULL, 10);
+         if (distinct_memory == 0) {
+            fprintf(stderr, "Invalid memory of distinct destinations.\n");
+            invalid = 1;
+         }
+         break;
+      case 'c':
+         cms_width = strtoul(optarg, NULL, 10);
+         if (cms_width == 0 || cms_width > HH_WIDTH_MAX) {
+            fprintf(stderr, "Invalid width of the Count-Min sketches.\n");
+            invalid = 1;
+         }
+         break;
+      case 'e':
+         cms_depth = strtoul(optarg, NULL, 10);
+         if (cms_depth == 0 || cms_depth > HH_DEPTH_MAX) {
+            fprintf(stderr, "Invalid depth of the Count-Min sketches.\n");
+            invalid = 1;
+         }
+         break;
+      case 'W':
+         cms_window = strtoul(optarg, NULL, 10);
+         if (cms_window == 0) {
+            fprintf(stderr, "Invalid window of the Count-Min sketches.\n");
+            invalid = 1;
+         }
+         break;
+      case 'K':
+         topk = strtoul(optarg, NULL, 10);
+         if (topk == 0 || topk > HH_TOPK_MAX) {
+            fprintf(stderr, "Invalid number of top hosts.\n");
+            invalid = 1;
+         }
+         break;
       default:
          fprintf(stderr, "Invalid arguments.\n");
-         FREE_MODULE_INFO_STRUCT(MODULE_BASIC_INFO, MODULE_PARAMS);
-         TRAP_DEFAULT_FINALIZATION();
-         return -1;
+         invalid = 1;
       }
    }
-
-   /* **** Create UniRec templates **** */
-   ur_template_t *in_tmplt = ur_create_input_template(0, IN_SPEC, NULL);
-   if (in_tmplt == NULL){
-      fprintf(stderr, "Error: Input template could not be created.\n");
-      return -1;
+   if (!invalid && window == 0 && (dst_hosts || precision > 0)) {
+      fprintf(stderr, "Host aggregates (-d, -u) require a window (-w).\n");
+      invalid = 1;
    }
-   ur_template_t *out_tmplt = ur_create_output_template(0, IN_SPEC "," NEW_FEATURES, NULL);
-   if (out_tmplt == NULL){
-      ur_free_template(in_tmplt);
-      fprintf(stderr, "Error: Output template could not be created.\n");
+   if (!invalid && topk > 0 && (cms_width == 0 || stats_interval == 0)) {
+      fprintf(stderr, "Top hosts (-K) require Count-Min sketches (-c) and statistics (-s).\n");
+      invalid = 1;
+   }
+   if (invalid) {
+      trap_free_ifc_spec(ifc_spec);
+      FREE_MODULE_INFO_STRUCT(MODULE_BASIC_INFO, MODULE_PARAMS);
       return -1;
    }
 
-   // Allocate memory for output record
-   void *out_rec = ur_create_record(out_tmplt, 0);
-   if (out_rec == NULL){
-      ur_free_template(in_tmplt);
-      ur_free_template(out_tmplt);
-      fprintf(stderr, "Error: Memory allocation problem (output record).\n");
-      return -1;
+   // Statistics are sent to an additional output interface following the data outputs
+   module_info->num_ifc_in = inputs;
+   module_info->num_ifc_out = outputs;
+   uint32_t stats_ifc = outputs;
+   if (stats_interval > 0) {
+      module_info->num_ifc_out++;
+   }
+   ret = trap_init(module_info, ifc_spec);
+   trap_free_ifc_spec(ifc_spec);
+   if (ret != TRAP_E_OK) {
+      fprintf(stderr, "ERROR in TRAP initialization: %s\n", trap_last_error_msg);
+      FREE_MODULE_INFO_STRUCT(MODULE_BASIC_INFO, MODULE_PARAMS);
+      return 1;
    }
 
-   fprintf(stdout, "Info: Input template is set as \n" IN_SPEC "\n");
+   /*
+    * Register signal handler.
+    */
+   TRAP_REGISTER_DEFAULT_SIGNAL_HANDLER();
 
+   /* **** Create UniRec templates **** */
+   fe_ctx_t ctx = { .input_cnt = inputs, .output_cnt = outputs, .features = features, .var_copy = var_copy,
+                    .len_bins = len_bins };
+   if (window > 0) {
+      ctx.hosts = host_aggr_create(window, max_hosts, dst_hosts, precision, (uint64_t) distinct_memory << 20);
+      if (ctx.hosts == NULL) {
+         fprintf(stderr, "Error: Memory allocation problem (host tables).\n");
+         goto failure;
+      }
+   }
+   if (cms_width > 0) {
+      ctx.hh = hh_create(cms_window, cms_width, cms_depth, topk);
+      if (ctx.hh == NULL) {
+         fprintf(stderr, "Error: Memory allocation problem (Count-Min sketches).\n");
+         goto failure;
+      }
+   }
+   if (arrow_prefix != NULL) {
+      // computed fields of the output template: the features and the fields of the stateful stages
+      char *fields = feature_set_spec(arrow_fields, features);
+      if (fields != NULL && ctx.hosts != NULL) {
+         fields = append_spec(fields, host_aggr_spec(ctx.hosts));
+      }
+      if (fields != NULL && ctx.hh != NULL) {
+         fields = append_spec(fields, hh_spec());
+      }
+      ctx.arrow = fields != NULL ? arrow_writer_create(arrow_prefix, fields, arrow_rows, (uint64_t) arrow_size << 20,
+                                                       arrow_interval) : NULL;
+      free(fields);
+      if (ctx.arrow == NULL) {
+         fprintf(stderr, "Error: Memory allocation problem (Arrow writer).\n");
+         goto failure;
+      }
+   }
+   if (matrix_prefix != NULL) {
+      char *fields = matrix_spec(features, len_bins);
+      if (fields != NULL && ctx.hosts != NULL) {
+         fields = append_spec(fields, host_aggr_spec(ctx.hosts));
+      }
+      if (fields != NULL && ctx.hh != NULL) {
+         fields = append_spec(fields, hh_spec());
+      }
+      ctx.matrix = fields != NULL ? npy_writer_create(matrix_prefix, fields, matrix_keys, matrix_rows,
+                                                      matrix_interval) : NULL;
+      free(fields);
+      if (ctx.matrix == NULL) {
+         fprintf(stderr, "Error: Memory allocation problem (NumPy writer).\n");
+         goto failure;
+      }
+   }
+   ctx.inputs = calloc(inputs, sizeof(fe_input_t));
+   if (ctx.inputs == NULL) {
+      fprintf(stderr, "Error: Memory allocation problem (inputs).\n");
+      goto failure;
+   }
+   for (uint32_t i = 0; i < inputs; i++) {
+      ctx.inputs[i].tmplt = ur_create_input_template(i, IN_SPEC, NULL);
+      if (ctx.inputs[i].tmplt == NULL) {
+         fprintf(stderr, "Error: Input template could not be created.\n");
+         goto failure;
+      }
+      ctx.inputs[i].plan.shard_cnt = outputs;
+      ctx.inputs[i].plan.shard_key = shard_key;
+      ctx.inputs[i].plan.len_bins = len_bins;
+      ctx.inputs[i].plan.len_bin_width = len_bin_width;
+      ctx.inputs[i].plan.burst_gap_us = burst_gap;
+   }
+   // Output contains the input fields and the selected features only,
+   // offsets of all fields used by process_flow() are resolved for each input
+   if (update_out_template(&ctx) != 0) {
+      goto failure;
+   }
 
-   /* **** Main processing loop **** */
+   // One block of counters for each receiving thread, each worker and the sender
+   if (stats_interval > 0) {
+      ctx.stats = stats_create(inputs + threads + 1, inputs, stats_ifc, stats_interval);
+      if (ctx.stats == NULL) {
+         fprintf(stderr, "Error: Statistics could not be created.\n");
+         goto failure;
+      }
+      if (topk > 0 && stats_extend(ctx.stats, hh_stats_spec(), hh_stats_size(ctx.hh), hh_stats_fill, ctx.hh) != 0) {
+         fprintf(stderr, "Error: Statistics could not be created.\n");
+         goto failure;
+      }
+   }
 
-   // Read data from input, process them and write to output
-   while (!stop) {
-      const void *in_rec;
-      uint16_t in_rec_size;
+   // Allocate the pipeline together with memory for received and output records
+   ctx.pipeline = pipeline_create(inputs, threads, batch, out_rec_size(&ctx), var_copy, FLOW_FEATURES_SCRATCH_SIZE,
+                                  huge_pages, receive_batch, process_batch, send_batch, &ctx);
+   if (ctx.pipeline == NULL){
+      fprintf(stderr, "Error: Memory allocation problem (output record).\n");
+      goto failure;
+   }
 
-      // Receive data from input interface 0.
-      // Block if data are not available immediately (unless a timeout is set using trap_ifcctl)
-      ret = TRAP_RECEIVE(0, in_rec, in_rec_size, in_tmplt);
+   fprintf(stdout, "Info: Input template is set as \n" IN_SPEC "\n");
+   fprintf(stdout, "Info: Using %s PPI kernels\n", ppi_kernels_init());
 
-      // Handle possible errors
-      TRAP_DEFAULT_RECV_ERROR_HANDLING(ret, continue, break);
-
-      // Check size of received data
-      if (in_rec_size < ur_rec_fixlen_size(in_tmplt)) {
-         if (in_rec_size <= 1) {
-            break; // End of data (used for testing purposes)
-         } else {
-            fprintf(stderr, "Error: data with wrong size received (expected size: >= %hu, received size: %hu)\n",
-                    ur_rec_fixlen_size(in_tmplt), in_rec_size);
-            break;
-         }
+   // In batch mode wait for further records of a batch only for a limited time
+   if (batch > 1) {
+      for (uint32_t i = 0; i < inputs; i++) {
+         trap_ifcctl(TRAPIFC_INPUT, i, TRAPCTL_SETTIMEOUT, BATCH_TIMEOUT);
       }
+   }
 
-      // PROCESS THE DATA
-      if (process_flow(in_tmplt, in_rec, out_tmplt, out_rec) == -1){
-         fprintf(stderr, "Error: Processing error");
-      }
+   if (ctx.stats != NULL && stats_start(ctx.stats) != 0) {
+      fprintf(stderr, "Error: Statistics thread could not be started.\n");
+   }
 
-      // Send record to interface 0.
-      // Block if ifc is not ready (unless a timeout is set using trap_ifcctl)
-      ret = trap_send(0, out_rec, ur_rec_fixlen_size(out_tmplt));
 
-      // Handle possible errors
-      TRAP_DEFAULT_SEND_ERROR_HANDLING(ret, continue, break);
+   /* **** Main processing loop **** */
+
+   // Read data from inputs, process them and write to output
+   if (pipeline_run(ctx.pipeline) != 0) {
+      fprintf(stderr, "Error: Worker threads could not be started.\n");
+   }
+
+   // Send statistics of the whole run before the interfaces are closed
+   if (ctx.stats != NULL && ctx.hh != NULL) {
+      hh_publish(ctx.hh, stats_now(), 1);
    }
+   stats_destroy(ctx.stats);
+   ctx.stats = NULL;
 
 
    /* **** Cleanup **** */
@@ -318,12 +1114,17 @@ int main(int argc, char **argv)
    // Release allocated memory for module_info structure
    FREE_MODULE_INFO_STRUCT(MODULE_BASIC_INFO, MODULE_PARAMS)
 
-   // Free unirec templates and output record
-   ur_free_record(out_rec);
-   ur_free_template(in_tmplt);
-   ur_free_template(out_tmplt);
+   // Free unirec templates and records
+   free_ctx(&ctx);
    ur_finalize();
 
    return 0;
+
+failure:
+   TRAP_DEFAULT_FINALIZATION();
+   FREE_MODULE_INFO_STRUCT(MODULE_BASIC_INFO, MODULE_PARAMS)
+   free_ctx(&ctx);
+   ur_finalize();
+   return -1;
 }
 
@@ -0,0 +1,117 @@
+/**
+ * \file feature_set.c
+ * \brief Selectable features computed by the module.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "feature_set.h"
+
+#define FEATURE_NAME(name) #name,
+
+/**
+ * Names of the features indexed by FEATURE_*, equal to names of the UniRec fields
+ */
+static const char *feature_names[FEATURE_CNT] = {
+   FEATURE_FIELDS(FEATURE_NAME)
+};
+
+int feature_set_parse(const char *list, feature_set_t *set)
+{
+   const char *name = list;
+
+   *set = 0;
+   while (*name != '\0') {
+      size_t len = strcspn(name, ",");
+      int found = 0;
+
+      if (len == 3 && strncmp(name, "ALL", len) == 0) {
+         *set |= FEATURES_ALL;
+         found = 1;
+      }
+      for (int i = 0; i < FEATURE_CNT && !found; i++) {
+         if (strlen(feature_names[i]) == len && strncmp(feature_names[i], name, len) == 0) {
+            *set |= (feature_set_t) 1 << i;
+            found = 1;
+            break;
+         }
+      }
+      if (!found) {
+         fprintf(stderr, "Error: Unknown feature %.*s.\n", (int) len, name);
+         return -1;
+      }
+      name += len;
+      if (*name == ',') {
+         name++;
+      }
+   }
+   if (*set == 0) {
+      fprintf(stderr, "Error: No feature selected.\n");
+      return -1;
+   }
+   return 0;
+}
+
+char *feature_set_spec(const char *prefix, feature_set_t set)
+{
+   size_t size = strlen(prefix) + 1;
+
+   for (int i = 0; i < FEATURE_CNT; i++) {
+      if (set & ((feature_set_t) 1 << i)) {
+         size += strlen(feature_names[i]) + 1;
+      }
+   }
+   char *spec = malloc(size);
+   if (spec == NULL) {
+      return NULL;
+   }
+   strcpy(spec, prefix);
+   for (int i = 0; i < FEATURE_CNT; i++) {
+      if (set & ((feature_set_t) 1 << i)) {
+         if (spec[0] != '\0') {
+            strcat(spec, ",");
+         }
+         strcat(spec, feature_names[i]);
+      }
+   }
+   return spec;
+}
@@ -0,0 +1,227 @@
+/**
+ * \file feature_set.h
+ * \brief Selectable features computed by the module.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef _FEATURE_SET_H_
+#define _FEATURE_SET_H_
+
+#include <stdint.h>
+
+/**
+ * Features computed by process_flow(), in the order of the default output
+ */
+#define FEATURE_FIELDS(X) \
+   X(MAX_PKT_LEN) \
+   X(MIN_PKT_LEN) \
+   X(VAR_PKT_LENGTH) \
+   X(MEAN_PKT_LENGTH) \
+   X(MEAN_TIME_BETWEEN_PKTS) \
+   X(RECV_PERCENTAGE) \
+   X(SENT_PERCENTAGE) \
+   X(BYTES_TOTAL) \
+   X(PACKETS_TOTAL) \
+   X(PACKETS_RATIO) \
+   X(PACKETS_PER_MS) \
+   X(BYTES_PER_MS) \
+   X(BYTES_RATIO) \
+   X(TIME_DUR_MS) \
+   X(DATA_SYMMETRY) \
+   X(PKT_LEN_HIST_SENT) \
+   X(PKT_LEN_HIST_RECV) \
+   X(PKT_LEN_LOG_HIST_SENT) \
+   X(PKT_LEN_LOG_HIST_RECV) \
+   X(MIN_IAT_US) \
+   X(MAX_IAT_US) \
+   X(STD_IAT_US) \
+   X(MEDIAN_IAT_US) \
+   X(MIN_SENT_IAT_US) \
+   X(MAX_SENT_IAT_US) \
+   X(STD_SENT_IAT_US) \
+   X(MEDIAN_SENT_IAT_US) \
+   X(MIN_RECV_IAT_US) \
+   X(MAX_RECV_IAT_US) \
+   X(STD_RECV_IAT_US) \
+   X(MEDIAN_RECV_IAT_US) \
+   X(SENT_PKT_CNT) \
+   X(RECV_PKT_CNT) \
+   X(MEAN_SENT_PKT_LENGTH) \
+   X(MEAN_RECV_PKT_LENGTH) \
+   X(VAR_SENT_PKT_LENGTH) \
+   X(VAR_RECV_PKT_LENGTH) \
+   X(MIN_SENT_PKT_LEN) \
+   X(MIN_RECV_PKT_LEN) \
+   X(MAX_SENT_PKT_LEN) \
+   X(MAX_RECV_PKT_LEN) \
+   X(MEAN_SENT_IAT_US) \
+   X(MEAN_RECV_IAT_US) \
+   X(FIN_CNT) \
+   X(SYN_CNT) \
+   X(RST_CNT) \
+   X(PSH_CNT) \
+   X(ACK_CNT) \
+   X(URG_CNT) \
+   X(SENT_FIN_CNT) \
+   X(SENT_SYN_CNT) \
+   X(SENT_RST_CNT) \
+   X(SENT_PSH_CNT) \
+   X(SENT_ACK_CNT) \
+   X(SENT_URG_CNT) \
+   X(RECV_FIN_CNT) \
+   X(RECV_SYN_CNT) \
+   X(RECV_RST_CNT) \
+   X(RECV_PSH_CNT) \
+   X(RECV_ACK_CNT) \
+   X(RECV_URG_CNT) \
+   X(FIRST_FLAGS) \
+   X(HANDSHAKE_SYNACK_US) \
+   X(HANDSHAKE_ACK_US) \
+   X(PKT_LEN_ENTROPY) \
+   X(IAT_ENTROPY) \
+   X(BURST_CNT) \
+   X(MEAN_BURST_PKTS) \
+   X(MEAN_BURST_BYTES) \
+   X(MAX_IDLE_US) \
+   X(BURST_DIR_CHANGES)
+
+#define FEATURE_ENUM(name) FEATURE_##name,
+
+enum {
+   FEATURE_FIELDS(FEATURE_ENUM)
+   FEATURE_CNT
+};
+
+/**
+ * Set of features, one bit per FEATURE_* index (more than 64 features, so a GCC/Clang 128 bit integer)
+ */
+__extension__ typedef unsigned __int128 feature_set_t;
+
+#define FEATURE_BIT(name) ((feature_set_t) 1 << FEATURE_##name)
+#define FEATURES_ALL (((feature_set_t) 1 << FEATURE_CNT) - 1)
+
+/**
+ * Features computed without -f, the original output of the module; the
+ * others (histograms, intervals, per direction statistics, TCP flags,
+ * entropies and bursts) are selected explicitly
+ */
+#define FEATURES_DEFAULT (FEATURE_BIT(MAX_PKT_LEN) | FEATURE_BIT(MIN_PKT_LEN) | FEATURE_BIT(VAR_PKT_LENGTH) | \
+                          FEATURE_BIT(MEAN_PKT_LENGTH) | FEATURE_BIT(MEAN_TIME_BETWEEN_PKTS) | \
+                          FEATURE_BIT(RECV_PERCENTAGE) | FEATURE_BIT(SENT_PERCENTAGE) | FEATURE_BIT(BYTES_TOTAL) | \
+                          FEATURE_BIT(PACKETS_TOTAL) | FEATURE_BIT(PACKETS_RATIO) | FEATURE_BIT(PACKETS_PER_MS) | \
+                          FEATURE_BIT(BYTES_PER_MS) | FEATURE_BIT(BYTES_RATIO) | FEATURE_BIT(TIME_DUR_MS) | \
+                          FEATURE_BIT(DATA_SYMMETRY))
+
+/**
+ * Variances of packet lengths, they need the sums of squares
+ */
+#define FEATURES_PPI_LEN_VAR (FEATURE_BIT(VAR_PKT_LENGTH) | FEATURE_BIT(VAR_SENT_PKT_LENGTH) | \
+                              FEATURE_BIT(VAR_RECV_PKT_LENGTH))
+
+/**
+ * Features computed from the packet length/direction reduction (ppi_len_stats), overall and per direction
+ */
+#define FEATURES_PPI_LEN (FEATURE_BIT(MAX_PKT_LEN) | FEATURE_BIT(MIN_PKT_LEN) | FEATURE_BIT(MEAN_PKT_LENGTH) | \
+                          FEATURE_BIT(RECV_PERCENTAGE) | FEATURE_BIT(SENT_PERCENTAGE) | \
+                          FEATURE_BIT(DATA_SYMMETRY) | FEATURE_BIT(SENT_PKT_CNT) | FEATURE_BIT(RECV_PKT_CNT) | \
+                          FEATURE_BIT(MEAN_SENT_PKT_LENGTH) | FEATURE_BIT(MEAN_RECV_PKT_LENGTH) | \
+                          FEATURE_BIT(MIN_SENT_PKT_LEN) | FEATURE_BIT(MIN_RECV_PKT_LEN) | \
+                          FEATURE_BIT(MAX_SENT_PKT_LEN) | FEATURE_BIT(MAX_RECV_PKT_LEN) | FEATURES_PPI_LEN_VAR)
+
+/**
+ * Packet length histograms, arrays computed together with FEATURES_PPI_LEN
+ */
+#define FEATURES_PPI_HIST (FEATURE_BIT(PKT_LEN_HIST_SENT) | FEATURE_BIT(PKT_LEN_HIST_RECV) | \
+                           FEATURE_BIT(PKT_LEN_LOG_HIST_SENT) | FEATURE_BIT(PKT_LEN_LOG_HIST_RECV))
+
+/**
+ * Features computed from the fixed width histograms, the arrays and the entropy of packet lengths
+ */
+#define FEATURES_PPI_LEN_BINNED (FEATURES_PPI_HIST | FEATURE_BIT(PKT_LEN_ENTROPY))
+
+/**
+ * Statistics of the intervals between sent and between received packets
+ */
+#define FEATURES_PPI_IAT_SENT (FEATURE_BIT(MIN_SENT_IAT_US) | FEATURE_BIT(MAX_SENT_IAT_US) | \
+                               FEATURE_BIT(STD_SENT_IAT_US) | FEATURE_BIT(MEDIAN_SENT_IAT_US) | \
+                               FEATURE_BIT(MEAN_SENT_IAT_US))
+#define FEATURES_PPI_IAT_RECV (FEATURE_BIT(MIN_RECV_IAT_US) | FEATURE_BIT(MAX_RECV_IAT_US) | \
+                               FEATURE_BIT(STD_RECV_IAT_US) | FEATURE_BIT(MEDIAN_RECV_IAT_US) | \
+                               FEATURE_BIT(MEAN_RECV_IAT_US))
+
+/**
+ * Features computed from the TCP flags (with the timestamps for the handshake)
+ */
+#define FEATURES_PPI_FLAGS (FEATURE_BIT(FIN_CNT) | FEATURE_BIT(SYN_CNT) | FEATURE_BIT(RST_CNT) | \
+                            FEATURE_BIT(PSH_CNT) | FEATURE_BIT(ACK_CNT) | FEATURE_BIT(URG_CNT) | \
+                            FEATURE_BIT(SENT_FIN_CNT) | FEATURE_BIT(SENT_SYN_CNT) | FEATURE_BIT(SENT_RST_CNT) | \
+                            FEATURE_BIT(SENT_PSH_CNT) | FEATURE_BIT(SENT_ACK_CNT) | FEATURE_BIT(SENT_URG_CNT) | \
+                            FEATURE_BIT(RECV_FIN_CNT) | FEATURE_BIT(RECV_SYN_CNT) | FEATURE_BIT(RECV_RST_CNT) | \
+                            FEATURE_BIT(RECV_PSH_CNT) | FEATURE_BIT(RECV_ACK_CNT) | FEATURE_BIT(RECV_URG_CNT) | \
+                            FEATURE_BIT(FIRST_FLAGS) | FEATURE_BIT(HANDSHAKE_SYNACK_US) | \
+                            FEATURE_BIT(HANDSHAKE_ACK_US))
+
+/**
+ * Bursts of packets separated by intervals of at most the burst gap
+ */
+#define FEATURES_PPI_BURST (FEATURE_BIT(BURST_CNT) | FEATURE_BIT(MEAN_BURST_PKTS) | FEATURE_BIT(MEAN_BURST_BYTES) | \
+                            FEATURE_BIT(MAX_IDLE_US) | FEATURE_BIT(BURST_DIR_CHANGES))
+
+/**
+ * Features computed from the packet timestamps (intervals between all packets and per direction)
+ */
+#define FEATURES_PPI_TIME (FEATURE_BIT(MEAN_TIME_BETWEEN_PKTS) | FEATURE_BIT(MIN_IAT_US) | FEATURE_BIT(MAX_IAT_US) | \
+                           FEATURE_BIT(STD_IAT_US) | FEATURE_BIT(MEDIAN_IAT_US) | FEATURES_PPI_IAT_SENT | \
+                           FEATURES_PPI_IAT_RECV | FEATURE_BIT(IAT_ENTROPY) | \
+                           FEATURES_PPI_BURST)
+
+/**
+ * Parse a comma separated list of feature names, ALL selects every feature.
+ * Returns 0 on success, -1 when a name is unknown or the list is empty.
+ */
+int feature_set_parse(const char *list, feature_set_t *set);
+
+/**
+ * Build UniRec template specification "prefix,FEATURE,..." with the features
+ * of the set. Returns a string allocated by malloc() or NULL.
+ */
+char *feature_set_spec(const char *prefix, feature_set_t set);
+
+#endif
@@ -0,0 +1,471 @@
+/**
+ * \file flow_features.c
+ * \brief Computation of flow features.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <math.h>
+#include <unirec/unirec.h>
+#include <unirec/ur_time.h>
+#include "fields.h"
+#include "flow_features.h"
+#include "ppi_kernels.h"
+
+/**
+ * Write a feature only when it is selected, the value is not evaluated otherwise
+ */
+#define SET_FEATURE(name, value) \
+   if (features & FEATURE_BIT(name)) { \
+      PLAN_SET(plan, out_rec, name, value); \
+   }
+
+/**
+ * Element k (from 0) of the n values in ascending order, found by
+ * quickselect. The values are reordered, those before k are not greater.
+ */
+static uint64_t iat_select(uint64_t *v, uint32_t n, uint32_t k)
+{
+   int32_t lo = 0, hi = n - 1;
+
+   while (lo < hi) {
+      uint64_t pivot = v[lo + (hi - lo) / 2];
+      int32_t i = lo, j = hi;
+      while (i <= j) {
+         while (v[i] < pivot) {
+            i++;
+         }
+         while (v[j] > pivot) {
+            j--;
+         }
+         if (i <= j) {
+            uint64_t tmp = v[i];
+            v[i++] = v[j];
+            v[j--] = tmp;
+         }
+      }
+      if ((int32_t) k <= j) {
+         hi = j;
+      } else if ((int32_t) k >= i) {
+         lo = i;
+      } else {
+         break; // k is between the parts, equal to the pivot
+      }
+   }
+   return v[k];
+}
+
+/**
+ * Up to this many intervals (all of them for usual PPI arrays) the median is found by insertion sort
+ */
+#define IAT_SORT_MAX 64
+
+/**
+ * Median of the n intervals, the intervals are reordered
+ */
+static double iat_median(uint64_t *iat, uint32_t n)
+{
+   if (n == 0) {
+      return 0;
+   }
+   if (n <= IAT_SORT_MAX) {
+      for (uint32_t i = 1; i < n; i++) {
+         uint64_t v = iat[i];
+         uint32_t j = i;
+         for (; j > 0 && iat[j - 1] > v; j--) {
+            iat[j] = iat[j - 1];
+         }
+         iat[j] = v;
+      }
+      return ((double) iat[(n - 1) / 2] + (double) iat[n / 2]) / 2;
+   }
+   uint64_t upper = iat_select(iat, n, n / 2);
+   if (n % 2 == 1) {
+      return upper;
+   }
+   uint64_t lower = iat[0];
+   for (uint32_t i = 1; i < n / 2; i++) {
+      lower = iat[i] > lower ? iat[i] : lower;
+   }
+   return ((double) lower + (double) upper) / 2;
+}
+
+/**
+ * Standard deviation of the intervals, two passes over the stored intervals are exact also for long ones
+ */
+static double iat_std(const uint64_t *iat, const ppi_iat_stats_t *stats)
+{
+   if (stats->cnt == 0) {
+      return 0;
+   }
+   double mean = (double) stats->sum / stats->cnt, sum_sq = 0;
+   for (uint32_t i = 0; i < stats->cnt; i++) {
+      double d = (double) iat[i] - mean;
+      sum_sq += d * d;
+   }
+   return sqrt(sum_sq / stats->cnt);
+}
+
+/**
+ * Number of interval bins of IAT_ENTROPY, bin k counts intervals in
+ * [2^k, 2^(k+1)) microseconds (bin 0 also 0)
+ */
+#define IAT_ENTROPY_BINS 64
+
+/**
+ * Bursts of a flow: runs of packets separated by intervals of at most the
+ * burst gap
+ */
+typedef struct burst_stats_s {
+   uint32_t cnt;         ///< number of bursts, a single packet is a burst as well
+   uint32_t dir_changes; ///< bursts starting in another direction than the previous burst
+   uint64_t bytes;       ///< length of all packets
+   uint64_t max_idle;    ///< longest interval between bursts, 0 with one burst
+} burst_stats_t;
+
+/**
+ * One pass over the intervals of pkts packets (iat[i - 1] precedes packet i)
+ * computing their entropy (with_entropy) and bursts (with_bursts, longer
+ * intervals than gap start a new burst). Both are updated per interval
+ * without branches: the sum of x log2 x over the power of two bins grows by
+ * (c + 1) log2(c + 1) - c log2(c) when a bin goes from c to c + 1, the burst
+ * state is the direction of the current burst. Returns the entropy.
+ */
+__attribute__((always_inline))
+static inline double iat_scan(const uint64_t *iat, const int8_t *dirs, const uint16_t *lens, uint32_t pkts,
+                              uint64_t gap, int with_entropy, int with_bursts, burst_stats_t *bursts)
+{
+   uint16_t bins[IAT_ENTROPY_BINS] = { 0 };
+   double sum_xlog2x = 0;
+   uint32_t n = pkts == 0 ? 0 : pkts - 1;
+   int8_t burst_dir = pkts == 0 ? 0 : dirs[0];
+
+   *bursts = (burst_stats_t) { .cnt = pkts != 0, .bytes = pkts == 0 ? 0 : ppi_len_at(lens, 0) };
+   for (uint32_t i = 0; i < n; i++) {
+      if (with_entropy) {
+         uint32_t c = bins[63 - __builtin_clzll(iat[i] | 1)]++;
+         sum_xlog2x += ppi_xlog2x(c + 1) - ppi_xlog2x(c);
+      }
+      if (with_bursts) {
+         uint32_t idle = iat[i] > gap;
+         int8_t dir = dirs[i + 1];
+         bursts->cnt += idle;
+         bursts->dir_changes += idle & (dir != burst_dir);
+         uint64_t idle_iat = iat[i] & -(uint64_t) idle;
+         bursts->max_idle = idle_iat > bursts->max_idle ? idle_iat : bursts->max_idle;
+         bursts->bytes += ppi_len_at(lens, i + 1);
+         burst_dir = idle ? dir : burst_dir;
+      }
+   }
+   return with_entropy ? ppi_entropy(n, sum_xlog2x) : 0;
+}
+
+/**
+ * Gather timestamps of the packets of one direction (sent or received) without branches, returns their number
+ */
+static uint32_t iat_gather(const ur_time_t *times, const int8_t *dirs, uint32_t cnt, int sent, uint64_t *out)
+{
+   uint32_t n = 0;
+   for (uint32_t i = 0; i < cnt; i++) {
+      out[n] = ppi_time_at(times, i);
+      n += (dirs[i] == 1) == sent;
+   }
+   return n;
+}
+
+/**
+ * Write the interval statistics of all packets (dir empty) or of one direction (dir SENT_ or RECV_), the
+ * intervals are reordered
+ */
+#define SET_IAT_FEATURES(dir, iat, stats) \
+   SET_FEATURE(MIN_##dir##IAT_US, (stats).min); \
+   SET_FEATURE(MAX_##dir##IAT_US, (stats).max); \
+   SET_FEATURE(STD_##dir##IAT_US, iat_std(iat, &(stats))); \
+   SET_FEATURE(MEDIAN_##dir##IAT_US, iat_median(iat, (stats).cnt));
+
+/**
+ * Write the counts of packets with a TCP flag (FIN, SYN, ...), all and per direction
+ */
+#define SET_FLAG_FEATURES(flag, stats) \
+   SET_FEATURE(flag##_CNT, (stats).total[__builtin_ctz(PPI_FLAG_##flag)]); \
+   SET_FEATURE(SENT_##flag##_CNT, (stats).sent[__builtin_ctz(PPI_FLAG_##flag)]); \
+   SET_FEATURE(RECV_##flag##_CNT, (stats).total[__builtin_ctz(PPI_FLAG_##flag)] - \
+                                  (stats).sent[__builtin_ctz(PPI_FLAG_##flag)]);
+
+/**
+ * Packets of the first flags pattern, FIRST_FLAGS holds their flags one byte each, the first packet in the lowest one
+ */
+#define FIRST_FLAGS_PKTS 4
+
+/**
+ * Timing of the TCP handshake in microseconds: from the first SYN (without
+ * ACK) to the first SYN+ACK of the other direction, and from it to the next
+ * ACK (without SYN) of the SYN direction. Zero when a step is missing.
+ */
+static void tcp_handshake(const ur_time_t *times, const int8_t *dirs, const uint8_t *flags, uint32_t cnt,
+                          uint64_t *syn_ack, uint64_t *ack)
+{
+   const uint8_t mask = PPI_FLAG_SYN | PPI_FLAG_ACK;
+   uint32_t syn = 0, reply;
+
+   *syn_ack = 0;
+   *ack = 0;
+   while (syn < cnt && (flags[syn] & mask) != PPI_FLAG_SYN) {
+      syn++;
+   }
+   for (reply = syn + 1; reply < cnt; reply++) {
+      if ((flags[reply] & mask) == mask && (dirs[reply] == 1) != (dirs[syn] == 1)) {
+         break;
+      }
+   }
+   if (reply >= cnt) {
+      return;
+   }
+   *syn_ack = ppi_timediff_us(ppi_time_at(times, reply), ppi_time_at(times, syn));
+   for (uint32_t i = reply + 1; i < cnt; i++) {
+      if ((flags[i] & mask) == PPI_FLAG_ACK && (dirs[i] == 1) == (dirs[syn] == 1)) {
+         *ack = ppi_timediff_us(ppi_time_at(times, i), ppi_time_at(times, reply));
+         break;
+      }
+   }
+}
+
+/**
+ *  Processing function. Computes only the features present in the output
+ *  template, the packet arrays are not touched when no selected feature needs them.
+ */
+int process_flow(const access_plan_t *plan, const void* in_rec, uint16_t in_rec_size, void* out_rec,
+                 uint64_t *scratch) {
+   const feature_set_t features = plan->features;
+
+   // First read input fields
+   // scalars:
+   uint64_t bytes = PLAN_GET(plan, in_rec, BYTES);
+   uint64_t bytes_rev = PLAN_GET(plan, in_rec, BYTES_REV);
+   ur_time_t time_start = PLAN_GET(plan, in_rec, TIME_FIRST);
+   ur_time_t time_last = PLAN_GET(plan, in_rec, TIME_LAST);
+   uint32_t packets = PLAN_GET(plan, in_rec, PACKETS);
+   uint32_t packets_rev = PLAN_GET(plan, in_rec, PACKETS_REV);
+   // output interface, while the addresses are at hand
+   int shard = 0;
+   if (plan->shard_cnt > 1) {
+      shard = shard_of(plan->shard_key, plan->shard_cnt, &PLAN_GET(plan, in_rec, SRC_IP),
+                       &PLAN_GET(plan, in_rec, DST_IP));
+   }
+
+   // Original fields (including those unknown to the module), copied as a few contiguous blocks
+   access_plan_copy(plan, in_rec, out_rec);
+   // PPI arrays and other variable length fields, or their empty headers, array features follow them
+   uint32_t var_used = access_plan_copy_var(plan, in_rec, in_rec_size, out_rec);
+
+   // Then compute features
+   // 1. Duration
+   uint64_t time_duration_ms = ur_timediff(time_last, time_start);
+   SET_FEATURE(TIME_DUR_MS, time_duration_ms);
+   // 2. Totals
+   SET_FEATURE(BYTES_TOTAL, bytes + bytes_rev);
+   SET_FEATURE(PACKETS_TOTAL, packets + packets_rev);
+   // 3. Feature ratios
+   SET_FEATURE(BYTES_RATIO, bytes_rev == 0 ? 0 : (double)bytes/(double)bytes_rev);
+   SET_FEATURE(PACKETS_RATIO, packets_rev == 0 ? 0 : (double)packets/(double)packets_rev);
+   // 4. "Features" per milisecond
+   SET_FEATURE(BYTES_PER_MS, (double)(bytes+bytes_rev)/(double)time_duration_ms);
+   SET_FEATURE(PACKETS_PER_MS, (double)(packets+packets_rev)/(double)time_duration_ms);
+
+   if (!(features & (FEATURES_PPI_LEN | FEATURES_PPI_LEN_BINNED | FEATURES_PPI_TIME | FEATURES_PPI_FLAGS))) {
+      return shard;
+   }
+   // 5. Arrays, only those within the input record are read
+   if (!PLAN_VAR_FITS(plan, in_rec, in_rec_size, PPI_PKT_DIRECTIONS) ||
+       !PLAN_VAR_FITS(plan, in_rec, in_rec_size, PPI_PKT_LENGTHS) ||
+       ((features & (FEATURES_PPI_TIME | FEATURE_BIT(HANDSHAKE_SYNACK_US) | FEATURE_BIT(HANDSHAKE_ACK_US))) &&
+        !PLAN_VAR_FITS(plan, in_rec, in_rec_size, PPI_PKT_TIMES)) ||
+       ((features & FEATURES_PPI_FLAGS) && !PLAN_VAR_FITS(plan, in_rec, in_rec_size, PPI_PKT_FLAGS))) {
+      return -1;
+   }
+   // Invariant is all arrays are always the same length, take the shortest one to be safe
+   uint32_t pkt_cnt = PLAN_GET_CNT(plan, in_rec, PPI_PKT_DIRECTIONS);
+   uint32_t lens_cnt = PLAN_GET_CNT(plan, in_rec, PPI_PKT_LENGTHS);
+   pkt_cnt = lens_cnt < pkt_cnt ? lens_cnt : pkt_cnt;
+
+   if (features & (FEATURES_PPI_LEN | FEATURES_PPI_LEN_BINNED)) {
+      const int8_t* pkt_dirs = PLAN_GET_PTR(plan, in_rec, PPI_PKT_DIRECTIONS);
+      const uint16_t* pkt_lens = PLAN_GET_PTR(plan, in_rec, PPI_PKT_LENGTHS);
+      // counts, byte sums per direction, sum and sum of squares (mean and var), min and max in one vectorized pass,
+      // overall and per direction (masked), the sums of squares are skipped when no variance is selected and the
+      // histograms when none is
+      ppi_len_stats_t len_stats;
+      ppi_hist_t hist = { .bins = plan->len_bins, .width = plan->len_bin_width, .inv_width = plan->len_bin_inv };
+      uint32_t flags = ((features & FEATURES_PPI_LEN_VAR) ? PPI_LEN_SQ : 0) |
+                       ((features & FEATURES_PPI_LEN_BINNED) ? PPI_LEN_HIST : 0);
+      ppi_len_stats(pkt_lens, pkt_dirs, pkt_cnt, &len_stats, &hist, flags);
+      uint32_t sent = len_stats.sent, recv = len_stats.recv;
+      double mean_pkt_len = pkt_cnt == 0 ? 0 : (double)len_stats.sum / (double)pkt_cnt;
+
+      SET_FEATURE(SENT_PERCENTAGE, sent+recv == 0 ? 0 : (double)sent/(sent+recv));
+      SET_FEATURE(RECV_PERCENTAGE, sent+recv == 0 ? 0 : (double)recv/(sent+recv));
+      SET_FEATURE(MEAN_PKT_LENGTH, mean_pkt_len);
+      SET_FEATURE(VAR_PKT_LENGTH, mean_pkt_len == 0 ? 0 : ((double)len_stats.sum_sq/(double)pkt_cnt) - (mean_pkt_len*mean_pkt_len));
+      SET_FEATURE(MIN_PKT_LEN, len_stats.min);
+      SET_FEATURE(MAX_PKT_LEN, len_stats.max);
+      SET_FEATURE(DATA_SYMMETRY, len_stats.bytes_recv == 0 ? 0 : (double)len_stats.bytes_sent / (double)len_stats.bytes_recv);
+      // forward (sent) and backward (received) variants
+      double mean_sent_len = sent == 0 ? 0 : (double)len_stats.bytes_sent / (double)sent;
+      double mean_recv_len = recv == 0 ? 0 : (double)len_stats.bytes_recv / (double)recv;
+      SET_FEATURE(SENT_PKT_CNT, sent);
+      SET_FEATURE(RECV_PKT_CNT, recv);
+      SET_FEATURE(MEAN_SENT_PKT_LENGTH, mean_sent_len);
+      SET_FEATURE(MEAN_RECV_PKT_LENGTH, mean_recv_len);
+      SET_FEATURE(VAR_SENT_PKT_LENGTH, mean_sent_len == 0 ? 0 : ((double)len_stats.sum_sq_sent/(double)sent) - (mean_sent_len*mean_sent_len));
+      SET_FEATURE(VAR_RECV_PKT_LENGTH, mean_recv_len == 0 ? 0 : ((double)len_stats.sum_sq_recv/(double)recv) - (mean_recv_len*mean_recv_len));
+      SET_FEATURE(MIN_SENT_PKT_LEN, len_stats.min_sent);
+      SET_FEATURE(MIN_RECV_PKT_LEN, len_stats.min_recv);
+      SET_FEATURE(MAX_SENT_PKT_LEN, len_stats.max_sent);
+      SET_FEATURE(MAX_RECV_PKT_LEN, len_stats.max_recv);
+      if (features & FEATURE_BIT(PKT_LEN_ENTROPY)) {
+         double sum_xlog2x = 0;
+         for (uint32_t b = 0; b < hist.bins; b++) {
+            sum_xlog2x += ppi_xlog2x(hist.lin[0][b] + hist.lin[1][b]);
+         }
+         SET_FEATURE(PKT_LEN_ENTROPY, ppi_entropy(sent + recv, sum_xlog2x));
+      }
+      // histograms have always all bins, also for flows without packet arrays
+      if (features & FEATURE_BIT(PKT_LEN_HIST_SENT)) {
+         var_used = PLAN_APPEND(plan, out_rec, PKT_LEN_HIST_SENT, var_used, hist.lin[0], hist.bins);
+      }
+      if (features & FEATURE_BIT(PKT_LEN_HIST_RECV)) {
+         var_used = PLAN_APPEND(plan, out_rec, PKT_LEN_HIST_RECV, var_used, hist.lin[1], hist.bins);
+      }
+      if (features & FEATURE_BIT(PKT_LEN_LOG_HIST_SENT)) {
+         var_used = PLAN_APPEND(plan, out_rec, PKT_LEN_LOG_HIST_SENT, var_used, hist.log[0], PPI_LOG_BINS);
+      }
+      if (features & FEATURE_BIT(PKT_LEN_LOG_HIST_RECV)) {
+         var_used = PLAN_APPEND(plan, out_rec, PKT_LEN_LOG_HIST_RECV, var_used, hist.log[1], PPI_LOG_BINS);
+      }
+   }
+
+   if (features & FEATURES_PPI_TIME) {
+      // intervals in microseconds by the vectorized differencing kernel, the minimum, maximum and sum with them,
+      // then per direction over the gathered timestamps of the direction
+      const ur_time_t* pkt_times = PLAN_GET_PTR(plan, in_rec, PPI_PKT_TIMES);
+      const int8_t* pkt_dirs = PLAN_GET_PTR(plan, in_rec, PPI_PKT_DIRECTIONS);
+      uint32_t times_cnt = PLAN_GET_CNT(plan, in_rec, PPI_PKT_TIMES);
+      uint32_t interval_cnt = pkt_cnt;
+      times_cnt = times_cnt < pkt_cnt ? times_cnt : pkt_cnt;
+      uint64_t *iat = scratch;
+      ppi_iat_stats_t iat_stats;
+
+      ppi_iat(pkt_times, times_cnt, iat, &iat_stats);
+      SET_FEATURE(MEAN_TIME_BETWEEN_PKTS, interval_cnt == 0 ? 0 : (double)iat_stats.sum / 1000 / (double)interval_cnt);
+      // entropy and bursts in one pass over the intervals, before the median reorders them
+      if (features & (FEATURE_BIT(IAT_ENTROPY) | FEATURES_PPI_BURST)) {
+         const uint16_t* pkt_lens = PLAN_GET_PTR(plan, in_rec, PPI_PKT_LENGTHS);
+         burst_stats_t bursts;
+         double entropy;
+         if (!(features & FEATURES_PPI_BURST)) {
+            entropy = iat_scan(iat, pkt_dirs, pkt_lens, times_cnt, plan->burst_gap_us, 1, 0, &bursts);
+         } else if (!(features & FEATURE_BIT(IAT_ENTROPY))) {
+            entropy = iat_scan(iat, pkt_dirs, pkt_lens, times_cnt, plan->burst_gap_us, 0, 1, &bursts);
+         } else {
+            entropy = iat_scan(iat, pkt_dirs, pkt_lens, times_cnt, plan->burst_gap_us, 1, 1, &bursts);
+         }
+         SET_FEATURE(IAT_ENTROPY, entropy);
+         SET_FEATURE(BURST_CNT, bursts.cnt);
+         SET_FEATURE(MEAN_BURST_PKTS, bursts.cnt == 0 ? 0 : (double)times_cnt / (double)bursts.cnt);
+         SET_FEATURE(MEAN_BURST_BYTES, bursts.cnt == 0 ? 0 : (double)bursts.bytes / (double)bursts.cnt);
+         SET_FEATURE(MAX_IDLE_US, bursts.max_idle);
+         SET_FEATURE(BURST_DIR_CHANGES, bursts.dir_changes);
+      }
+      SET_IAT_FEATURES(, iat, iat_stats);
+      if (features & FEATURES_PPI_IAT_SENT) {
+         ppi_iat(iat, iat_gather(pkt_times, pkt_dirs, times_cnt, 1, iat), iat, &iat_stats);
+         SET_FEATURE(MEAN_SENT_IAT_US, iat_stats.cnt == 0 ? 0 : (double)iat_stats.sum / (double)iat_stats.cnt);
+         SET_IAT_FEATURES(SENT_, iat, iat_stats);
+      }
+      if (features & FEATURES_PPI_IAT_RECV) {
+         ppi_iat(iat, iat_gather(pkt_times, pkt_dirs, times_cnt, 0, iat), iat, &iat_stats);
+         SET_FEATURE(MEAN_RECV_IAT_US, iat_stats.cnt == 0 ? 0 : (double)iat_stats.sum / (double)iat_stats.cnt);
+         SET_IAT_FEATURES(RECV_, iat, iat_stats);
+      }
+   }
+
+   if (features & FEATURES_PPI_FLAGS) {
+      // flag counts by the bitwise/popcount kernel, first flags and handshake from the first packets
+      const uint8_t* pkt_flags = PLAN_GET_PTR(plan, in_rec, PPI_PKT_FLAGS);
+      const int8_t* pkt_dirs = PLAN_GET_PTR(plan, in_rec, PPI_PKT_DIRECTIONS);
+      uint32_t flags_cnt = PLAN_GET_CNT(plan, in_rec, PPI_PKT_FLAGS);
+      flags_cnt = flags_cnt < pkt_cnt ? flags_cnt : pkt_cnt;
+      ppi_flag_stats_t flag_stats;
+
+      ppi_flag_stats(pkt_flags, pkt_dirs, flags_cnt, &flag_stats);
+      SET_FLAG_FEATURES(FIN, flag_stats);
+      SET_FLAG_FEATURES(SYN, flag_stats);
+      SET_FLAG_FEATURES(RST, flag_stats);
+      SET_FLAG_FEATURES(PSH, flag_stats);
+      SET_FLAG_FEATURES(ACK, flag_stats);
+      SET_FLAG_FEATURES(URG, flag_stats);
+
+      uint32_t first_flags = 0;
+      for (uint32_t i = 0; i < flags_cnt && i < FIRST_FLAGS_PKTS; i++) {
+         first_flags |= (uint32_t) pkt_flags[i] << (8 * i);
+      }
+      SET_FEATURE(FIRST_FLAGS, first_flags);
+
+      if (features & (FEATURE_BIT(HANDSHAKE_SYNACK_US) | FEATURE_BIT(HANDSHAKE_ACK_US))) {
+         const ur_time_t* pkt_times = PLAN_GET_PTR(plan, in_rec, PPI_PKT_TIMES);
+         uint32_t times_cnt = PLAN_GET_CNT(plan, in_rec, PPI_PKT_TIMES);
+         uint64_t syn_ack, ack;
+         tcp_handshake(pkt_times, pkt_dirs, pkt_flags, times_cnt < flags_cnt ? times_cnt : flags_cnt, &syn_ack, &ack);
+         SET_FEATURE(HANDSHAKE_SYNACK_US, syn_ack);
+         SET_FEATURE(HANDSHAKE_ACK_US, ack);
+      }
+   }
+
+   return shard;
+}
+
+uint32_t flow_features_var_size(feature_set_t features, uint32_t len_bins)
+{
+   uint32_t size = 0;
+   size += (features & FEATURE_BIT(PKT_LEN_HIST_SENT)) ? len_bins * sizeof(uint16_t) : 0;
+   size += (features & FEATURE_BIT(PKT_LEN_HIST_RECV)) ? len_bins * sizeof(uint16_t) : 0;
+   size += (features & FEATURE_BIT(PKT_LEN_LOG_HIST_SENT)) ? PPI_LOG_BINS * sizeof(uint16_t) : 0;
+   size += (features & FEATURE_BIT(PKT_LEN_LOG_HIST_RECV)) ? PPI_LOG_BINS * sizeof(uint16_t) : 0;
+   return size;
+}
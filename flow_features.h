@@ -0,0 +1,84 @@
+/**
+ * \file flow_features.h
+ * \brief Computation of flow features.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef _FLOW_FEATURES_H_
+#define _FLOW_FEATURES_H_
+
+#include <stdint.h>
+#include "access_plan.h"
+
+/**
+ * Define input template spec, all input fields are passed to the output, newly calculated features are listed in feature_set.h
+ */
+#define IN_SPEC "DST_IP,SRC_IP,BYTES,BYTES_REV,TIME_FIRST,TIME_LAST,PACKETS,PACKETS_REV,PPI_PKT_DIRECTIONS,PPI_PKT_LENGTHS,PPI_PKT_TIMES,PPI_PKT_FLAGS"
+
+/**
+ * Upper limit of the number of timestamps in a UniRec record
+ */
+#define IAT_MAX (UR_MAX_SIZE / sizeof(ur_time_t))
+
+/**
+ * Size of the scratch memory of process_flow() (the intervals between packet timestamps)
+ */
+#define FLOW_FEATURES_SCRATCH_SIZE (IAT_MAX * sizeof(uint64_t))
+
+/**
+ * Fill the output record from the input record of in_rec_size bytes: copy
+ * the input fields and compute the features selected in the plan. Scratch
+ * of FLOW_FEATURES_SCRATCH_SIZE bytes is used during the call only, so one
+ * buffer per thread (or batch) is enough.
+ * Returns the output interface of the record (shard of its IP addresses with
+ * plan->shard_cnt > 1, otherwise 0), -1 when a packet array needed by the
+ * selected features does not lie within the input record.
+ */
+int process_flow(const access_plan_t *plan, const void *in_rec, uint16_t in_rec_size, void *out_rec,
+                 uint64_t *scratch);
+
+/**
+ * Upper limit of the size of the array features of the set with len_bins
+ * histogram bins, output records need this much space besides their fixed
+ * part (and the copied variable length fields).
+ */
+uint32_t flow_features_var_size(feature_set_t features, uint32_t len_bins);
+
+#endif
@@ -0,0 +1,465 @@
+/**
+ * \file heavy_hitters.c
+ * \brief Heavy hitter estimates of hosts by Count-Min sketches and top-K heaps.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unirec/unirec.h>
+#include <unirec/ur_time.h>
+#include "fields.h"
+#include "heavy_hitters.h"
+#include "shard.h"
+
+/**
+ * Fields added to the output template and top-K fields of the statistics records
+ */
+UR_FIELDS (
+   uint64 SRC_HEAVY_FLOWS,
+   uint64 SRC_HEAVY_BYTES,
+   uint64 DST_HEAVY_FLOWS,
+   uint64 DST_HEAVY_BYTES,
+   ipaddr* TOP_SRC_IP,
+   uint64* TOP_SRC_FLOWS,
+   uint64* TOP_SRC_BYTES,
+   ipaddr* TOP_DST_IP,
+   uint64* TOP_DST_FLOWS,
+   uint64* TOP_DST_BYTES
+)
+
+#define HH_NAME(name) "," #name
+
+/**
+ * Minimum time between two snapshots of the top-K heaps in nanoseconds
+ */
+#define HH_PUBLISH_INTERVAL 100000000ULL
+
+#define HH_GET(hh, rec, name) (*(const F_##name##_T *) ((const uint8_t *) (rec) + (hh)->in[HH_##name]))
+#define HH_SET(hh, rec, name, value) (*(F_##name##_T *) ((uint8_t *) (rec) + (hh)->out[HH_##name]) = (value))
+
+enum {
+   HH_SRC,
+   HH_DST
+};
+
+static const ur_field_id_t hh_top_ids[2][3] = {
+   {F_TOP_SRC_IP, F_TOP_SRC_FLOWS, F_TOP_SRC_BYTES},
+   {F_TOP_DST_IP, F_TOP_DST_FLOWS, F_TOP_DST_BYTES}
+};
+
+hh_t *hh_create(uint32_t window, uint32_t width, uint32_t depth, uint32_t topk)
+{
+   hh_t *hh = calloc(1, sizeof(hh_t));
+   if (hh == NULL) {
+      return NULL;
+   }
+   hh->width = 1;
+   while (hh->width < width) {
+      hh->width <<= 1;
+   }
+   hh->depth = depth;
+   hh->topk = topk;
+   hh->window_ms = (uint64_t) window * 1000;
+   hh->index_mask = 1;
+   while (hh->index_mask + 1 < 2 * topk) {
+      hh->index_mask = (hh->index_mask << 1) | 1;
+   }
+   pthread_mutex_init(&hh->lock, NULL);
+
+   size_t cells = (size_t) hh->width * depth;
+   for (int s = 0; s < 2; s++) {
+      hh_side_t *side = &hh->side[s];
+      side->cur = calloc(cells, sizeof(hh_cell_t));
+      side->prev = calloc(cells, sizeof(hh_cell_t));
+      if (side->cur == NULL || side->prev == NULL) {
+         hh_destroy(hh);
+         return NULL;
+      }
+      if (topk > 0) {
+         side->heap = calloc(topk, sizeof(hh_top_t));
+         side->snapshot = calloc(topk, sizeof(hh_top_t));
+         side->index = calloc((size_t) hh->index_mask + 1, sizeof(uint16_t));
+         if (side->heap == NULL || side->snapshot == NULL || side->index == NULL) {
+            hh_destroy(hh);
+            return NULL;
+         }
+      }
+   }
+   return hh;
+}
+
+void hh_destroy(hh_t *hh)
+{
+   if (hh == NULL) {
+      return;
+   }
+   for (int s = 0; s < 2; s++) {
+      free(hh->side[s].cur);
+      free(hh->side[s].prev);
+      free(hh->side[s].heap);
+      free(hh->side[s].snapshot);
+      free(hh->side[s].index);
+   }
+   pthread_mutex_destroy(&hh->lock);
+   free(hh);
+}
+
+const char *hh_spec(void)
+{
+   static const char spec[] = HH_OUT_FIELDS(HH_NAME);
+   return spec + 1;
+}
+
+const char *hh_stats_spec(void)
+{
+   return "TOP_SRC_IP,TOP_SRC_FLOWS,TOP_SRC_BYTES,TOP_DST_IP,TOP_DST_FLOWS,TOP_DST_BYTES";
+}
+
+uint32_t hh_stats_size(const hh_t *hh)
+{
+   return 2 * hh->topk * (sizeof(ip_addr_t) + 2 * sizeof(uint64_t));
+}
+
+#define HH_RESOLVE(name, array) \
+   if (!ur_is_present(out_tmplt, F_##name)) { \
+      fprintf(stderr, "Error: Output template does not contain field " #name ".\n"); \
+      return -1; \
+   } \
+   hh->array[HH_##name] = out_tmplt->offset[F_##name];
+#define HH_RESOLVE_IN(name) HH_RESOLVE(name, in)
+#define HH_RESOLVE_OUT(name) HH_RESOLVE(name, out)
+
+int hh_bind(hh_t *hh, const ur_template_t *out_tmplt)
+{
+   HH_IN_FIELDS(HH_RESOLVE_IN)
+   HH_OUT_FIELDS(HH_RESOLVE_OUT)
+   return 0;
+}
+
+/**
+ * Part of the previous window still covered by the sliding window
+ */
+static inline double hh_weight(const hh_t *hh)
+{
+   return (double) (hh->window_ms - hh->now_ms % hh->window_ms) / (double) hh->window_ms;
+}
+
+/**
+ * Cells of the host in the rows of a sketch, derived from one 64 bit hash
+ */
+static inline void hh_cells(const hh_t *hh, const ip_addr_t *ip, uint32_t *cell)
+{
+   uint64_t h = shard_ip_hash(ip);
+   uint32_t h1 = (uint32_t) h;
+   uint32_t h2 = (uint32_t) (h >> 32) | 1;
+
+   cell[0] = h1 & (hh->width - 1);
+   for (uint32_t r = 1; r < hh->depth; r++) {
+      cell[r] = r * hh->width + ((h1 + r * h2) & (hh->width - 1));
+   }
+}
+
+/**
+ * Count-Min estimate: minimum of the host's cells over all rows
+ */
+static inline hh_cell_t hh_query(const hh_t *hh, const hh_cell_t *cells, const uint32_t *cell)
+{
+   hh_cell_t min = cells[cell[0]];
+
+   for (uint32_t r = 1; r < hh->depth; r++) {
+      const hh_cell_t *c = &cells[cell[r]];
+      min.flows = c->flows < min.flows ? c->flows : min.flows;
+      min.bytes = c->bytes < min.bytes ? c->bytes : min.bytes;
+   }
+   return min;
+}
+
+/**
+ * Slot of the host in the heap index, or the empty slot where it would be inserted
+ */
+static uint32_t hh_index_find(const hh_t *hh, const hh_side_t *side, const ip_addr_t *ip)
+{
+   uint32_t slot = (uint32_t) (shard_ip_hash(ip) >> 32) & hh->index_mask;
+
+   while (side->index[slot] != 0 && memcmp(&side->heap[side->index[slot] - 1].ip, ip, sizeof(ip_addr_t)) != 0) {
+      slot = (slot + 1) & hh->index_mask;
+   }
+   return slot;
+}
+
+/**
+ * Remove the host from the heap index, following slots are shifted back instead of leaving tombstones
+ */
+static void hh_index_remove(const hh_t *hh, hh_side_t *side, const ip_addr_t *ip)
+{
+   uint32_t hole = hh_index_find(hh, side, ip);
+
+   side->index[hole] = 0;
+   for (uint32_t slot = (hole + 1) & hh->index_mask; side->index[slot] != 0; slot = (slot + 1) & hh->index_mask) {
+      const ip_addr_t *key = &side->heap[side->index[slot] - 1].ip;
+      uint32_t home = (uint32_t) (shard_ip_hash(key) >> 32) & hh->index_mask;
+      if (((slot - home) & hh->index_mask) >= ((slot - hole) & hh->index_mask)) {
+         side->index[hole] = side->index[slot];
+         side->index[slot] = 0;
+         hole = slot;
+      }
+   }
+}
+
+static void hh_heap_swap(const hh_t *hh, hh_side_t *side, uint32_t a, uint32_t b)
+{
+   // Slots are found through the heap, so before the entries move
+   uint32_t slot_a = hh_index_find(hh, side, &side->heap[a].ip);
+   uint32_t slot_b = hh_index_find(hh, side, &side->heap[b].ip);
+   hh_top_t tmp = side->heap[a];
+
+   side->heap[a] = side->heap[b];
+   side->heap[b] = tmp;
+   side->index[slot_a] = (uint16_t) (b + 1);
+   side->index[slot_b] = (uint16_t) (a + 1);
+}
+
+/**
+ * Restore the heap order after the bytes of the host at pos changed
+ */
+static void hh_heap_fix(const hh_t *hh, hh_side_t *side, uint32_t pos)
+{
+   while (pos > 0 && side->heap[pos].bytes < side->heap[(pos - 1) / 2].bytes) {
+      hh_heap_swap(hh, side, pos, (pos - 1) / 2);
+      pos = (pos - 1) / 2;
+   }
+   while (1) {
+      uint32_t min = pos;
+      uint32_t child = 2 * pos + 1;
+      if (child < side->heap_cnt && side->heap[child].bytes < side->heap[min].bytes) {
+         min = child;
+      }
+      if (child + 1 < side->heap_cnt && side->heap[child + 1].bytes < side->heap[min].bytes) {
+         min = child + 1;
+      }
+      if (min == pos) {
+         break;
+      }
+      hh_heap_swap(hh, side, pos, min);
+      pos = min;
+   }
+}
+
+/**
+ * Offer the host with its new estimates to the top-K heap
+ */
+static void hh_top_offer(const hh_t *hh, hh_side_t *side, const ip_addr_t *ip, uint64_t flows, uint64_t bytes)
+{
+   uint32_t slot = hh_index_find(hh, side, ip);
+   uint32_t pos;
+
+   if (side->index[slot] != 0) {
+      pos = side->index[slot] - 1;
+   } else if (side->heap_cnt < hh->topk) {
+      pos = side->heap_cnt++;
+      side->index[slot] = (uint16_t) (pos + 1);
+   } else if (bytes > side->heap[0].bytes) {
+      // Replace the smallest host, its removal may move the empty slot of the new one
+      pos = 0;
+      hh_index_remove(hh, side, &side->heap[0].ip);
+      side->index[hh_index_find(hh, side, ip)] = 1;
+   } else {
+      return;
+   }
+   side->heap[pos].ip = *ip;
+   side->heap[pos].flows = flows;
+   side->heap[pos].bytes = bytes;
+   hh_heap_fix(hh, side, pos);
+}
+
+static int hh_top_cmp(const void *a, const void *b)
+{
+   uint64_t x = ((const hh_top_t *) a)->bytes;
+   uint64_t y = ((const hh_top_t *) b)->bytes;
+   return x < y ? -1 : x > y;
+}
+
+/**
+ * Re-estimate the hosts of the top-K heap at the current time, the estimates
+ * of hosts without recent flows decay with the previous window. An ascending
+ * array is a valid min-heap, so sorting rebuilds the heap.
+ */
+static void hh_top_refresh(const hh_t *hh, hh_side_t *side)
+{
+   double weight = hh_weight(hh);
+   uint32_t cell[HH_DEPTH_MAX];
+
+   for (uint32_t i = 0; i < side->heap_cnt; i++) {
+      hh_cells(hh, &side->heap[i].ip, cell);
+      hh_cell_t cur = hh_query(hh, side->cur, cell);
+      hh_cell_t prev = hh_query(hh, side->prev, cell);
+      side->heap[i].flows = cur.flows + (uint64_t) (prev.flows * weight + 0.5);
+      side->heap[i].bytes = cur.bytes + (uint64_t) (prev.bytes * weight + 0.5);
+   }
+   qsort(side->heap, side->heap_cnt, sizeof(hh_top_t), hh_top_cmp);
+   memset(side->index, 0, ((size_t) hh->index_mask + 1) * sizeof(uint16_t));
+   for (uint32_t i = 0; i < side->heap_cnt; i++) {
+      side->index[hh_index_find(hh, side, &side->heap[i].ip)] = (uint16_t) (i + 1);
+   }
+}
+
+/**
+ * Start a new window. The sketch of the last window becomes the previous one
+ * when the windows are consecutive.
+ */
+static void hh_shift(hh_t *hh, uint64_t window)
+{
+   size_t size = (size_t) hh->width * hh->depth * sizeof(hh_cell_t);
+   int consecutive = hh->window + 1 == window;
+
+   hh->window = window;
+   for (int s = 0; s < 2; s++) {
+      hh_side_t *side = &hh->side[s];
+      if (consecutive) {
+         hh_cell_t *tmp = side->prev;
+         side->prev = side->cur;
+         side->cur = tmp;
+      } else {
+         memset(side->prev, 0, size);
+      }
+      memset(side->cur, 0, size);
+
+      if (hh->topk > 0) {
+         if (!consecutive) {
+            side->heap_cnt = 0;
+         }
+         hh_top_refresh(hh, side);
+      }
+   }
+}
+
+/**
+ * Add a flow of the host with conservative update (cells are raised only up
+ * to the new estimate) and return the estimates over the sliding window
+ */
+static hh_cell_t hh_side_update(const hh_t *hh, hh_side_t *side, const ip_addr_t *ip, uint64_t bytes, double weight)
+{
+   uint32_t cell[HH_DEPTH_MAX];
+
+   hh_cells(hh, ip, cell);
+   hh_cell_t est = hh_query(hh, side->cur, cell);
+   est.flows++;
+   est.bytes += bytes;
+   for (uint32_t r = 0; r < hh->depth; r++) {
+      hh_cell_t *c = &side->cur[cell[r]];
+      c->flows = c->flows < est.flows ? est.flows : c->flows;
+      c->bytes = c->bytes < est.bytes ? est.bytes : c->bytes;
+   }
+   hh_cell_t prev = hh_query(hh, side->prev, cell);
+   est.flows += (uint64_t) (prev.flows * weight + 0.5);
+   est.bytes += (uint64_t) (prev.bytes * weight + 0.5);
+
+   if (hh->topk > 0) {
+      hh_top_offer(hh, side, ip, est.flows, est.bytes);
+   }
+   return est;
+}
+
+void hh_update(hh_t *hh, void *out_rec)
+{
+   ur_time_t time_last = HH_GET(hh, out_rec, TIME_LAST);
+   uint64_t now_ms = (uint64_t) ur_time_get_sec(time_last) * 1000 + ur_time_get_msec(time_last);
+   uint64_t bytes = HH_GET(hh, out_rec, BYTES) + HH_GET(hh, out_rec, BYTES_REV);
+
+   if (now_ms > hh->now_ms) {
+      hh->now_ms = now_ms;
+   }
+   if (hh->now_ms / hh->window_ms != hh->window) {
+      hh_shift(hh, hh->now_ms / hh->window_ms);
+   }
+   double weight = hh_weight(hh);
+
+   hh_cell_t est = hh_side_update(hh, &hh->side[HH_SRC], &HH_GET(hh, out_rec, SRC_IP), bytes, weight);
+   HH_SET(hh, out_rec, SRC_HEAVY_FLOWS, est.flows);
+   HH_SET(hh, out_rec, SRC_HEAVY_BYTES, est.bytes);
+   est = hh_side_update(hh, &hh->side[HH_DST], &HH_GET(hh, out_rec, DST_IP), bytes, weight);
+   HH_SET(hh, out_rec, DST_HEAVY_FLOWS, est.flows);
+   HH_SET(hh, out_rec, DST_HEAVY_BYTES, est.bytes);
+}
+
+void hh_publish(hh_t *hh, uint64_t now, int force)
+{
+   if (hh->topk == 0 || (!force && now - hh->published < HH_PUBLISH_INTERVAL)) {
+      return;
+   }
+   hh->published = now;
+   pthread_mutex_lock(&hh->lock);
+   for (int s = 0; s < 2; s++) {
+      hh_side_t *side = &hh->side[s];
+      hh_top_refresh(hh, side);
+      memcpy(side->snapshot, side->heap, side->heap_cnt * sizeof(hh_top_t));
+      side->snapshot_cnt = side->heap_cnt;
+   }
+   pthread_mutex_unlock(&hh->lock);
+}
+
+void hh_stats_fill(const ur_template_t *tmplt, void *rec, void *arg)
+{
+   hh_t *hh = (hh_t *)arg;
+   hh_top_t top[HH_TOPK_MAX];
+   ip_addr_t ip[HH_TOPK_MAX];
+   uint64_t flows[HH_TOPK_MAX];
+   uint64_t bytes[HH_TOPK_MAX];
+
+   for (int s = 0; s < 2; s++) {
+      pthread_mutex_lock(&hh->lock);
+      uint32_t cnt = hh->side[s].snapshot_cnt;
+      memcpy(top, hh->side[s].snapshot, cnt * sizeof(hh_top_t));
+      pthread_mutex_unlock(&hh->lock);
+
+      // Heaviest hosts first
+      qsort(top, cnt, sizeof(hh_top_t), hh_top_cmp);
+      for (uint32_t i = 0; i < cnt; i++) {
+         ip[i] = top[cnt - 1 - i].ip;
+         flows[i] = top[cnt - 1 - i].flows;
+         bytes[i] = top[cnt - 1 - i].bytes;
+      }
+      ur_set_var(tmplt, rec, hh_top_ids[s][0], ip, cnt * sizeof(ip_addr_t));
+      ur_set_var(tmplt, rec, hh_top_ids[s][1], flows, cnt * sizeof(uint64_t));
+      ur_set_var(tmplt, rec, hh_top_ids[s][2], bytes, cnt * sizeof(uint64_t));
+   }
+}
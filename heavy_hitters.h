@@ -0,0 +1,187 @@
+/**
+ * \file heavy_hitters.h
+ * \brief Heavy hitter estimates of hosts by Count-Min sketches and top-K heaps.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef _HEAVY_HITTERS_H_
+#define _HEAVY_HITTERS_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <unirec/unirec.h>
+
+/**
+ * Limits of the sketch and top-K parameters
+ */
+#define HH_DEPTH_MAX 8
+#define HH_WIDTH_MAX (1u << 24)
+#define HH_TOPK_MAX 256
+
+/**
+ * Output record fields read by the stage
+ */
+#define HH_IN_FIELDS(X) \
+   X(SRC_IP) \
+   X(DST_IP) \
+   X(BYTES) \
+   X(BYTES_REV) \
+   X(TIME_LAST)
+
+/**
+ * Estimates written to the output record
+ */
+#define HH_OUT_FIELDS(X) \
+   X(SRC_HEAVY_FLOWS) \
+   X(SRC_HEAVY_BYTES) \
+   X(DST_HEAVY_FLOWS) \
+   X(DST_HEAVY_BYTES)
+
+#define HH_ENUM(name) HH_##name,
+
+enum {
+   HH_IN_FIELDS(HH_ENUM)
+   HH_IN_CNT
+};
+
+enum {
+   HH_OUT_FIELDS(HH_ENUM)
+   HH_OUT_CNT
+};
+
+/**
+ * Counters of one sketch cell, flows and bytes share the hash of the host
+ */
+typedef struct hh_cell_s {
+   uint64_t flows;
+   uint64_t bytes;
+} hh_cell_t;
+
+/**
+ * Host of a top-K heap with its estimates
+ */
+typedef struct hh_top_s {
+   ip_addr_t ip;
+   uint64_t flows;
+   uint64_t bytes;
+} hh_top_t;
+
+/**
+ * Count-Min sketches of the current and the previous window and the top-K
+ * heap (by bytes) of one side of the flows (sources or destinations)
+ */
+typedef struct hh_side_s {
+   hh_cell_t *cur;         ///< depth rows of width cells
+   hh_cell_t *prev;
+   hh_top_t *heap;         ///< min-heap of the top-K hosts by bytes
+   uint32_t heap_cnt;
+   uint16_t *index;        ///< open addressing index of the heap, heap position + 1 (0 if empty)
+   hh_top_t *snapshot;     ///< copy of the heap for the statistics thread
+   uint32_t snapshot_cnt;
+} hh_side_t;
+
+/**
+ * Stateful stage adding to each output record the estimated number of flows
+ * and bytes (both directions) of its source and destination hosts in the
+ * sliding window, using Count-Min sketches with conservative update. As with
+ * the host aggregates, the sliding window is estimated from two tumbling
+ * windows by TIME_LAST of the records and the stage runs in the sender.
+ * Optionally the top-K hosts by bytes are tracked and exported with the
+ * statistics records.
+ */
+typedef struct hh_s {
+   hh_side_t side[2];      ///< sources and destinations
+   uint32_t width;         ///< cells per row, a power of two
+   uint32_t depth;         ///< rows
+   uint32_t topk;          ///< size of the top-K heaps, 0 if disabled
+   uint32_t index_mask;    ///< slots of a heap index - 1
+   uint64_t window_ms;
+   uint64_t window;        ///< index of the current window
+   uint64_t now_ms;        ///< time of the newest record
+   uint64_t published;     ///< stats_now() of the last snapshot
+   pthread_mutex_t lock;   ///< protects the snapshots
+   uint16_t in[HH_IN_CNT];   ///< offsets of the read fields in the output template
+   uint16_t out[HH_OUT_CNT]; ///< offsets of the estimates in the output template
+} hh_t;
+
+/**
+ * Create the stage with sketches of depth rows of width cells (rounded up to
+ * a power of two) per window of window seconds and top-K heaps of topk hosts
+ * (0 disables them). Returns NULL on failure.
+ */
+hh_t *hh_create(uint32_t window, uint32_t width, uint32_t depth, uint32_t topk);
+
+/**
+ * Comma separated names of the fields added to the output template
+ */
+const char *hh_spec(void);
+
+/**
+ * Resolve offsets of the used fields in the output template.
+ * Returns 0 on success, -1 when a field is missing.
+ */
+int hh_bind(hh_t *hh, const ur_template_t *out_tmplt);
+
+/**
+ * Account the flow of the output record to its hosts and write their estimates into the record
+ */
+void hh_update(hh_t *hh, void *out_rec);
+
+/**
+ * Re-estimate the top-K hosts and copy the heaps for the statistics thread, at most every 100 ms
+ * (now is stats_now()) unless force is set
+ */
+void hh_publish(hh_t *hh, uint64_t now, int force);
+
+/**
+ * Comma separated names of the top-K fields of the statistics records and
+ * the size of their data
+ */
+const char *hh_stats_spec(void);
+uint32_t hh_stats_size(const hh_t *hh);
+
+/**
+ * Fill the top-K fields of a statistics record (stats_fill_t)
+ */
+void hh_stats_fill(const ur_template_t *tmplt, void *rec, void *arg);
+
+void hh_destroy(hh_t *hh);
+
+#endif
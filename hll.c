@@ -0,0 +1,129 @@
+/**
+ * \file hll.c
+ * \brief HyperLogLog sketches of two consecutive windows.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <math.h>
+#include <string.h>
+#include "hll.h"
+
+#define HLL_TERM(reg) ((reg) > HLL_SUM_BITS ? 0 : 1ULL << (HLL_SUM_BITS - (reg)))
+
+/**
+ * Reset both sketches, previous holds the current sketch when shift is set
+ */
+static void hll_window_start(hll_window_t *h, uint32_t precision, uint64_t window, int shift)
+{
+   uint32_t m = 1u << precision;
+
+   if (shift) {
+      memcpy(h->reg + m, h->reg, m);
+      h->sum[1] = h->sum[0];
+      h->zeros[1] = h->zeros[0];
+   } else {
+      memset(h->reg + m, 0, m);
+      h->sum[1] = (uint64_t) m << HLL_SUM_BITS;
+      h->zeros[1] = m;
+   }
+   memset(h->reg, 0, m);
+   h->sum[0] = (uint64_t) m << HLL_SUM_BITS;
+   h->zeros[0] = m;
+   h->window = window;
+}
+
+void hll_window_add(hll_window_t *h, uint32_t precision, uint64_t window, uint64_t hash)
+{
+   uint32_t m = 1u << precision;
+
+   // The sum of a started sketch is never 0
+   if (h->window != window || h->sum[0] == 0) {
+      hll_window_start(h, precision, window, h->window + 1 == window && h->sum[0] != 0);
+   }
+
+   // Cheap remix (the first step of the MurmurHash3 finalizer) of the already finalized address hash, the index
+   // and the rank take different bits
+   hash ^= hash >> 33;
+   hash *= 0xff51afd7ed558ccdULL;
+   hash ^= hash >> 33;
+   uint32_t idx = (uint32_t) (hash >> (64 - precision));
+   uint64_t rest = hash << precision;
+   uint8_t rank = (uint8_t) (rest == 0 ? 64 - precision + 1 : (uint32_t) __builtin_clzll(rest) + 1);
+
+   uint8_t cur = h->reg[idx];
+   if (rank <= cur) {
+      return;
+   }
+   h->reg[idx] = rank;
+   h->sum[0] += HLL_TERM(rank) - HLL_TERM(cur);
+   h->zeros[0] -= cur == 0;
+
+   uint8_t uni = h->reg[m + idx] > cur ? h->reg[m + idx] : cur;
+   if (rank > uni) {
+      h->sum[1] += HLL_TERM(rank) - HLL_TERM(uni);
+      h->zeros[1] -= uni == 0;
+   }
+}
+
+/**
+ * HyperLogLog estimate with the linear counting correction of small cardinalities
+ */
+static double hll_estimate(uint32_t m, uint64_t sum, uint32_t zeros)
+{
+   double alpha = m == 16 ? 0.673 : m == 32 ? 0.697 : m == 64 ? 0.709 : 0.7213 / (1.0 + 1.079 / m);
+   double est = alpha * m * m / ((double) sum / (double) (1ULL << HLL_SUM_BITS));
+
+   if (est <= 2.5 * m && zeros > 0) {
+      est = m * log((double) m / zeros);
+   }
+   return est;
+}
+
+double hll_window_estimate(const hll_window_t *h, uint32_t precision, double weight)
+{
+   uint32_t m = 1u << precision;
+
+   if (h->sum[0] == 0) {
+      return 0;
+   }
+   double cur = hll_estimate(m, h->sum[0], h->zeros[0]);
+   double uni = hll_estimate(m, h->sum[1], h->zeros[1]);
+   return uni > cur ? cur + (uni - cur) * weight : cur;
+}
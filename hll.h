@@ -0,0 +1,96 @@
+/**
+ * \file hll.h
+ * \brief HyperLogLog sketches of two consecutive windows.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef _HLL_H_
+#define _HLL_H_
+
+#include <stdint.h>
+
+/**
+ * Supported precision (bits of the hash selecting a register)
+ */
+#define HLL_PRECISION_MIN 4
+#define HLL_PRECISION_MAX 16
+
+/**
+ * Fixed point scale of the register sums, terms of ranks above it are 0
+ * (they occur with probability 2^-HLL_SUM_BITS, the error is negligible)
+ */
+#define HLL_SUM_BITS 47
+
+/**
+ * HyperLogLog sketches of the current and the previous window, followed by
+ * 2 * 2^precision one byte registers. Besides the registers of the current
+ * sketch, the sum of 2^-register and the number of zero registers are kept
+ * for the current sketch and for the union of both sketches, so an estimate
+ * costs O(1) instead of a pass over the registers.
+ */
+typedef struct hll_window_s {
+   uint64_t window;   ///< index of the current window
+   uint64_t sum[2];   ///< sums of 2^-register (fixed point) of the current sketch and of the union
+   uint32_t zeros[2]; ///< zero registers of the current sketch and of the union
+   uint8_t reg[];     ///< registers of the current sketch followed by the previous one
+} hll_window_t;
+
+/**
+ * Size of the sketches with 2^precision registers each
+ */
+static inline uint32_t hll_window_size(uint32_t precision)
+{
+   return sizeof(hll_window_t) + 2 * (1u << precision);
+}
+
+/**
+ * Add an item given by its 64 bit hash to the sketch of window (windows are
+ * numbered by time / length, the window never goes back). A zeroed
+ * hll_window_t is valid and empty.
+ */
+void hll_window_add(hll_window_t *h, uint32_t precision, uint64_t window, uint64_t hash);
+
+/**
+ * Estimate the number of distinct items in the sliding window ending in the
+ * current window, weight is the part of the previous window still inside it.
+ */
+double hll_window_estimate(const hll_window_t *h, uint32_t precision, double weight);
+
+#endif
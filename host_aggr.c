@@ -0,0 +1,216 @@
+/**
+ * \file host_aggr.c
+ * \brief Per-host windowed aggregates of flow counts, bytes and packets.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unirec/unirec.h>
+#include <unirec/ur_time.h>
+#include "fields.h"
+#include "host_aggr.h"
+#include "shard.h"
+
+/**
+ * Fields added to the output template
+ */
+UR_FIELDS (
+   uint64 SRC_FLOW_CNT,
+   uint64 SRC_BYTES_SUM,
+   uint64 SRC_PACKETS_SUM,
+   uint64 DST_FLOW_CNT,
+   uint64 DST_BYTES_SUM,
+   uint64 DST_PACKETS_SUM,
+   uint64 DISTINCT_DST_CNT
+)
+
+#define HOST_AGGR_NAME(name) "," #name
+
+/**
+ * Entries are kept two windows after their last update, older counters would not be used anyway
+ */
+#define HOST_AGGR_TTL(window) (2 * (window) + 1)
+
+#define HOST_AGGR_GET(a, rec, name) (*(const F_##name##_T *) ((const uint8_t *) (rec) + (a)->in[HOST_AGGR_##name]))
+#define HOST_AGGR_SET(a, rec, name, value) \
+   (*(F_##name##_T *) ((uint8_t *) (rec) + (a)->out[HOST_AGGR_##name]) = (value))
+
+host_aggr_t *host_aggr_create(uint32_t window, uint32_t max_hosts, int dst, uint32_t precision,
+                              uint64_t distinct_memory)
+{
+   static const char src_spec[] = HOST_AGGR_SRC_FIELDS(HOST_AGGR_NAME);
+   static const char dst_spec[] = HOST_AGGR_DST_FIELDS(HOST_AGGR_NAME);
+   static const char distinct_spec[] = HOST_AGGR_DISTINCT_FIELDS(HOST_AGGR_NAME);
+
+   host_aggr_t *a = calloc(1, sizeof(host_aggr_t));
+   if (a == NULL) {
+      return NULL;
+   }
+   a->window_ms = (uint64_t) window * 1000;
+   a->src = host_table_create(max_hosts, sizeof(host_window_t), HOST_AGGR_TTL(window));
+   if (dst) {
+      a->dst = host_table_create(max_hosts, sizeof(host_window_t), HOST_AGGR_TTL(window));
+   }
+   if (precision > 0) {
+      uint32_t distinct_hosts = host_table_max_hosts(distinct_memory, hll_window_size(precision),
+                                                     HOST_AGGR_TTL(window));
+      if (distinct_hosts == 0) {
+         fprintf(stderr, "Error: Memory of the distinct destination sketches is too small.\n");
+         host_aggr_destroy(a);
+         return NULL;
+      }
+      a->precision = precision;
+      a->distinct = host_table_create(distinct_hosts, hll_window_size(precision), HOST_AGGR_TTL(window));
+   }
+   if (a->src == NULL || (dst && a->dst == NULL) || (precision > 0 && a->distinct == NULL)) {
+      host_aggr_destroy(a);
+      return NULL;
+   }
+   snprintf(a->spec, sizeof(a->spec), "%s%s%s", src_spec + 1, dst ? dst_spec : "", precision > 0 ? distinct_spec : "");
+   return a;
+}
+
+void host_aggr_destroy(host_aggr_t *a)
+{
+   if (a == NULL) {
+      return;
+   }
+   host_table_destroy(a->src);
+   host_table_destroy(a->dst);
+   host_table_destroy(a->distinct);
+   free(a);
+}
+
+const char *host_aggr_spec(const host_aggr_t *a)
+{
+   return a->spec;
+}
+
+#define HOST_AGGR_RESOLVE(name, array) \
+   if (!ur_is_present(out_tmplt, F_##name)) { \
+      fprintf(stderr, "Error: Output template does not contain field " #name ".\n"); \
+      return -1; \
+   } \
+   a->array[HOST_AGGR_##name] = out_tmplt->offset[F_##name];
+#define HOST_AGGR_RESOLVE_IN(name) HOST_AGGR_RESOLVE(name, in)
+#define HOST_AGGR_RESOLVE_OUT(name) HOST_AGGR_RESOLVE(name, out)
+
+int host_aggr_bind(host_aggr_t *a, const ur_template_t *out_tmplt)
+{
+   HOST_AGGR_IN_FIELDS(HOST_AGGR_RESOLVE_IN)
+   HOST_AGGR_SRC_FIELDS(HOST_AGGR_RESOLVE_OUT)
+   if (a->dst != NULL) {
+      HOST_AGGR_DST_FIELDS(HOST_AGGR_RESOLVE_OUT)
+   }
+   if (a->distinct != NULL) {
+      HOST_AGGR_DISTINCT_FIELDS(HOST_AGGR_RESOLVE_OUT)
+   }
+   return 0;
+}
+
+/**
+ * Part of the previous window still covered by the sliding window
+ */
+static inline double host_aggr_weight(const host_aggr_t *a)
+{
+   return (double) (a->window_ms - a->now_ms % a->window_ms) / (double) a->window_ms;
+}
+
+/**
+ * Add a flow to the counters of a host and estimate its totals over the sliding window
+ */
+static void host_window_update(const host_aggr_t *a, host_window_t *w, uint64_t bytes, uint64_t packets,
+                               uint64_t est[3])
+{
+   uint64_t window = a->now_ms / a->window_ms;
+
+   if (w->window != window) {
+      int shift = w->window + 1 == window;
+      w->flows[1] = shift ? w->flows[0] : 0;
+      w->bytes[1] = shift ? w->bytes[0] : 0;
+      w->packets[1] = shift ? w->packets[0] : 0;
+      w->flows[0] = w->bytes[0] = w->packets[0] = 0;
+      w->window = window;
+   }
+   w->flows[0]++;
+   w->bytes[0] += bytes;
+   w->packets[0] += packets;
+
+   double weight = host_aggr_weight(a);
+   est[0] = w->flows[0] + (uint64_t) (w->flows[1] * weight + 0.5);
+   est[1] = w->bytes[0] + (uint64_t) (w->bytes[1] * weight + 0.5);
+   est[2] = w->packets[0] + (uint64_t) (w->packets[1] * weight + 0.5);
+}
+
+void host_aggr_update(host_aggr_t *a, void *out_rec)
+{
+   ur_time_t time_last = HOST_AGGR_GET(a, out_rec, TIME_LAST);
+   uint64_t now_ms = (uint64_t) ur_time_get_sec(time_last) * 1000 + ur_time_get_msec(time_last);
+   uint64_t bytes = HOST_AGGR_GET(a, out_rec, BYTES) + HOST_AGGR_GET(a, out_rec, BYTES_REV);
+   uint64_t packets = (uint64_t) HOST_AGGR_GET(a, out_rec, PACKETS) + HOST_AGGR_GET(a, out_rec, PACKETS_REV);
+   uint64_t est[3];
+
+   if (now_ms > a->now_ms) {
+      a->now_ms = now_ms;
+   }
+   host_table_advance(a->src, (uint32_t) (a->now_ms / 1000));
+   host_window_update(a, host_table_get(a->src, &HOST_AGGR_GET(a, out_rec, SRC_IP)), bytes, packets, est);
+   HOST_AGGR_SET(a, out_rec, SRC_FLOW_CNT, est[0]);
+   HOST_AGGR_SET(a, out_rec, SRC_BYTES_SUM, est[1]);
+   HOST_AGGR_SET(a, out_rec, SRC_PACKETS_SUM, est[2]);
+
+   if (a->dst != NULL) {
+      host_table_advance(a->dst, (uint32_t) (a->now_ms / 1000));
+      host_window_update(a, host_table_get(a->dst, &HOST_AGGR_GET(a, out_rec, DST_IP)), bytes, packets, est);
+      HOST_AGGR_SET(a, out_rec, DST_FLOW_CNT, est[0]);
+      HOST_AGGR_SET(a, out_rec, DST_BYTES_SUM, est[1]);
+      HOST_AGGR_SET(a, out_rec, DST_PACKETS_SUM, est[2]);
+   }
+
+   if (a->distinct != NULL) {
+      host_table_advance(a->distinct, (uint32_t) (a->now_ms / 1000));
+      hll_window_t *h = host_table_get(a->distinct, &HOST_AGGR_GET(a, out_rec, SRC_IP));
+      hll_window_add(h, a->precision, a->now_ms / a->window_ms, shard_ip_hash(&HOST_AGGR_GET(a, out_rec, DST_IP)));
+      double distinct = hll_window_estimate(h, a->precision, host_aggr_weight(a));
+      HOST_AGGR_SET(a, out_rec, DISTINCT_DST_CNT, (uint64_t) (distinct + 0.5));
+   }
+}
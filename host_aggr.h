@@ -0,0 +1,161 @@
+/**
+ * \file host_aggr.h
+ * \brief Per-host windowed aggregates of flow counts, bytes and packets.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef _HOST_AGGR_H_
+#define _HOST_AGGR_H_
+
+#include <stdint.h>
+#include <unirec/unirec.h>
+#include "host_table.h"
+#include "hll.h"
+
+/**
+ * Output record fields read by the stage
+ */
+#define HOST_AGGR_IN_FIELDS(X) \
+   X(SRC_IP) \
+   X(DST_IP) \
+   X(BYTES) \
+   X(BYTES_REV) \
+   X(PACKETS) \
+   X(PACKETS_REV) \
+   X(TIME_LAST)
+
+/**
+ * Aggregates of the source host, written to the output record
+ */
+#define HOST_AGGR_SRC_FIELDS(X) \
+   X(SRC_FLOW_CNT) \
+   X(SRC_BYTES_SUM) \
+   X(SRC_PACKETS_SUM)
+
+/**
+ * Aggregates of the destination host (-d), written to the output record
+ */
+#define HOST_AGGR_DST_FIELDS(X) \
+   X(DST_FLOW_CNT) \
+   X(DST_BYTES_SUM) \
+   X(DST_PACKETS_SUM)
+
+/**
+ * Distinct destinations of the source host (-u), written to the output record
+ */
+#define HOST_AGGR_DISTINCT_FIELDS(X) \
+   X(DISTINCT_DST_CNT)
+
+#define HOST_AGGR_ENUM(name) HOST_AGGR_##name,
+
+enum {
+   HOST_AGGR_IN_FIELDS(HOST_AGGR_ENUM)
+   HOST_AGGR_IN_CNT
+};
+
+enum {
+   HOST_AGGR_SRC_FIELDS(HOST_AGGR_ENUM)
+   HOST_AGGR_DST_FIELDS(HOST_AGGR_ENUM)
+   HOST_AGGR_DISTINCT_FIELDS(HOST_AGGR_ENUM)
+   HOST_AGGR_OUT_CNT
+};
+
+/**
+ * Counters of a host in the current and the previous window ([0] and [1])
+ */
+typedef struct host_window_s {
+   uint64_t window; ///< index of the current window
+   uint64_t flows[2];
+   uint64_t bytes[2];
+   uint64_t packets[2];
+} host_window_t;
+
+/**
+ * Stateful stage adding to each output record the number of flows, bytes
+ * and packets (both directions) of its source host - and optionally of its
+ * destination host - seen in the last window seconds. The sliding window is
+ * estimated from two tumbling windows: the previous one is weighted by the
+ * part of it still inside the sliding window. Time is given by TIME_LAST of
+ * the records. Runs in the sender, so records are seen in output order.
+ * Optionally, the number of distinct destinations of the source host is
+ * estimated by HyperLogLog sketches of the same two windows, kept in a
+ * separate table sized by a memory budget.
+ */
+typedef struct host_aggr_s {
+   host_table_t *src;         ///< state of source hosts
+   host_table_t *dst;         ///< state of destination hosts, NULL without -d
+   host_table_t *distinct;    ///< sketches of destinations of source hosts, NULL without -u
+   uint32_t precision;        ///< bits of the sketch register index
+   uint64_t window_ms;
+   uint64_t now_ms;           ///< time of the newest record
+   uint16_t in[HOST_AGGR_IN_CNT];   ///< offsets of the read fields in the output template
+   uint16_t out[HOST_AGGR_OUT_CNT]; ///< offsets of the aggregates in the output template
+   char spec[256];            ///< names of the added fields
+} host_aggr_t;
+
+/**
+ * Create the stage with a window of window seconds and at most max_hosts
+ * hosts per table, with dst the destination hosts are aggregated as well.
+ * With precision > 0, distinct destinations are counted by sketches of
+ * 2^precision registers fitting into distinct_memory bytes.
+ * Returns NULL on failure.
+ */
+host_aggr_t *host_aggr_create(uint32_t window, uint32_t max_hosts, int dst, uint32_t precision,
+                              uint64_t distinct_memory);
+
+/**
+ * Comma separated names of the fields added to the output template
+ */
+const char *host_aggr_spec(const host_aggr_t *a);
+
+/**
+ * Resolve offsets of the used fields in the output template.
+ * Returns 0 on success, -1 when a field is missing.
+ */
+int host_aggr_bind(host_aggr_t *a, const ur_template_t *out_tmplt);
+
+/**
+ * Account the flow of the output record to its hosts and write their aggregates into the record
+ */
+void host_aggr_update(host_aggr_t *a, void *out_rec);
+
+void host_aggr_destroy(host_aggr_t *a);
+
+#endif
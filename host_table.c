@@ -0,0 +1,245 @@
+/**
+ * \file host_table.c
+ * \brief Open addressing table of per-host state with time wheel expiration.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "host_table.h"
+#include "shard.h"
+
+#define HOST_SLOT_HASH(slot) ((uint32_t) ((slot) >> 32))
+#define HOST_SLOT_ENTRY(slot) ((uint32_t) (slot) - 1)
+#define HOST_SLOT(hash, entry) (((uint64_t) (hash) << 32) | ((uint64_t) (entry) + 1))
+
+host_table_t *host_table_create(uint32_t max_hosts, uint32_t payload_size, uint32_t ttl)
+{
+   host_table_t *t = calloc(1, sizeof(host_table_t));
+   if (t == NULL) {
+      return NULL;
+   }
+   uint64_t slot_cnt = 2;
+   while (slot_cnt < (uint64_t) max_hosts * 2) {
+      slot_cnt <<= 1;
+   }
+   t->mask = (uint32_t) (slot_cnt - 1);
+   t->max_hosts = max_hosts;
+   t->payload_size = (payload_size + 7) & ~7u;
+   t->ttl = ttl;
+   t->wheel_size = ttl + 1; // entries of one bucket expire in the same second
+   t->free_list = HOST_TABLE_NIL;
+   t->slots = calloc(slot_cnt, sizeof(uint64_t));
+   t->entries = malloc((size_t) max_hosts * sizeof(host_entry_t));
+   t->payload = malloc((size_t) max_hosts * t->payload_size);
+   t->wheel = malloc((size_t) t->wheel_size * sizeof(uint32_t));
+   if (t->slots == NULL || t->entries == NULL || t->payload == NULL || t->wheel == NULL) {
+      host_table_destroy(t);
+      return NULL;
+   }
+   for (uint32_t i = 0; i < t->wheel_size; i++) {
+      t->wheel[i] = HOST_TABLE_NIL;
+   }
+   return t;
+}
+
+uint32_t host_table_max_hosts(uint64_t memory, uint32_t payload_size, uint32_t ttl)
+{
+   uint64_t entry_size = sizeof(host_entry_t) + ((payload_size + 7) & ~7u);
+   uint64_t wheel_size = ((uint64_t) ttl + 1) * sizeof(uint32_t);
+   uint64_t best = 0;
+
+   // Slots are a power of two at least twice the number of entries, try all sizes of the slot array
+   for (uint64_t slot_cnt = 2; slot_cnt <= 2 * (uint64_t) HOST_TABLE_MAX; slot_cnt <<= 1) {
+      uint64_t fixed = slot_cnt * sizeof(uint64_t) + wheel_size;
+      if (fixed >= memory) {
+         break;
+      }
+      uint64_t cnt = (memory - fixed) / entry_size;
+      if (cnt > slot_cnt / 2) {
+         cnt = slot_cnt / 2;
+      }
+      if (cnt > best) {
+         best = cnt;
+      }
+   }
+   return (uint32_t) best;
+}
+
+void host_table_destroy(host_table_t *t)
+{
+   if (t == NULL) {
+      return;
+   }
+   free(t->slots);
+   free(t->entries);
+   free(t->payload);
+   free(t->wheel);
+   free(t);
+}
+
+static void host_wheel_link(host_table_t *t, uint32_t idx)
+{
+   host_entry_t *e = &t->entries[idx];
+   uint32_t *head = &t->wheel[e->expire % t->wheel_size];
+
+   e->prev = HOST_TABLE_NIL;
+   e->next = *head;
+   if (*head != HOST_TABLE_NIL) {
+      t->entries[*head].prev = idx;
+   }
+   *head = idx;
+}
+
+static void host_wheel_unlink(host_table_t *t, uint32_t idx)
+{
+   host_entry_t *e = &t->entries[idx];
+
+   if (e->prev != HOST_TABLE_NIL) {
+      t->entries[e->prev].next = e->next;
+   } else {
+      t->wheel[e->expire % t->wheel_size] = e->next;
+   }
+   if (e->next != HOST_TABLE_NIL) {
+      t->entries[e->next].prev = e->prev;
+   }
+}
+
+/**
+ * Remove the entry from the hash slots (backward shift deletion) and the wheel.
+ */
+static void host_table_remove(host_table_t *t, uint32_t idx)
+{
+   uint32_t hash = (uint32_t) (shard_ip_hash(&t->entries[idx].key) >> 32);
+   uint32_t i = hash & t->mask;
+
+   while (HOST_SLOT_ENTRY(t->slots[i]) != idx) {
+      i = (i + 1) & t->mask;
+   }
+   // Move following entries of the probe sequence back unless it would put them before their home slot
+   for (uint32_t j = (i + 1) & t->mask; t->slots[j] != 0; j = (j + 1) & t->mask) {
+      uint32_t home = HOST_SLOT_HASH(t->slots[j]) & t->mask;
+      if (((j - home) & t->mask) >= ((j - i) & t->mask)) {
+         t->slots[i] = t->slots[j];
+         i = j;
+      }
+   }
+   t->slots[i] = 0;
+
+   host_wheel_unlink(t, idx);
+   t->entries[idx].next = t->free_list;
+   t->free_list = idx;
+   t->cnt--;
+}
+
+void host_table_advance(host_table_t *t, uint32_t now)
+{
+   if (!t->started) {
+      t->now = now;
+      t->started = 1;
+      return;
+   }
+   if (now <= t->now) {
+      return;
+   }
+   // Each bucket holds entries expiring in one second, so passed buckets are emptied completely
+   uint32_t steps = now - t->now < t->wheel_size ? now - t->now : t->wheel_size;
+   for (uint32_t s = 1; s <= steps; s++) {
+      uint32_t *head = &t->wheel[(t->now + s) % t->wheel_size];
+      while (*head != HOST_TABLE_NIL) {
+         host_table_remove(t, *head);
+      }
+   }
+   t->now = now;
+}
+
+/**
+ * Evict the entry which would expire first
+ */
+static void host_table_evict(host_table_t *t)
+{
+   for (uint32_t s = 0; s < t->wheel_size; s++) {
+      uint32_t idx = t->wheel[(t->now + s) % t->wheel_size];
+      if (idx != HOST_TABLE_NIL) {
+         host_table_remove(t, idx);
+         t->evicted++;
+         return;
+      }
+   }
+}
+
+void *host_table_get(host_table_t *t, const ip_addr_t *key)
+{
+   uint32_t hash = (uint32_t) (shard_ip_hash(key) >> 32);
+   uint32_t i = hash & t->mask;
+   uint32_t idx;
+
+   for (; t->slots[i] != 0; i = (i + 1) & t->mask) {
+      idx = HOST_SLOT_ENTRY(t->slots[i]);
+      if (HOST_SLOT_HASH(t->slots[i]) == hash && memcmp(&t->entries[idx].key, key, sizeof(ip_addr_t)) == 0) {
+         host_wheel_unlink(t, idx);
+         t->entries[idx].expire = t->now + t->ttl;
+         host_wheel_link(t, idx);
+         return t->payload + (size_t) idx * t->payload_size;
+      }
+   }
+
+   if (t->cnt == t->max_hosts) {
+      host_table_evict(t);
+      // The eviction may have shifted the probe sequence, find the free slot again
+      for (i = hash & t->mask; t->slots[i] != 0; i = (i + 1) & t->mask) {
+      }
+   }
+   if (t->free_list != HOST_TABLE_NIL) {
+      idx = t->free_list;
+      t->free_list = t->entries[idx].next;
+   } else {
+      idx = t->used++;
+   }
+   t->slots[i] = HOST_SLOT(hash, idx);
+   t->cnt++;
+   host_entry_t *e = &t->entries[idx];
+   memcpy(&e->key, key, sizeof(ip_addr_t));
+   e->expire = t->now + t->ttl;
+   host_wheel_link(t, idx);
+   void *payload = t->payload + (size_t) idx * t->payload_size;
+   memset(payload, 0, t->payload_size);
+   return payload;
+}
@@ -0,0 +1,120 @@
+/**
+ * \file host_table.h
+ * \brief Open addressing table of per-host state with time wheel expiration.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef _HOST_TABLE_H_
+#define _HOST_TABLE_H_
+
+#include <stdint.h>
+#include <unirec/unirec.h>
+
+#define HOST_TABLE_NIL UINT32_MAX
+
+/**
+ * Upper limit of the number of entries (the slots have to fit 32 bit indexes)
+ */
+#define HOST_TABLE_MAX (1u << 30)
+
+/**
+ * Entry of a host, its state (payload) is stored separately.
+ */
+typedef struct host_entry_s {
+   ip_addr_t key;   ///< address of the host
+   uint32_t next;   ///< next entry in the same wheel bucket
+   uint32_t prev;   ///< previous entry in the same wheel bucket
+   uint32_t expire; ///< second at which the entry expires
+} host_entry_t;
+
+/**
+ * Table of at most max_hosts entries with payload_size bytes of state each.
+ * Hash slots are kept at most half full and deleted slots are backward
+ * shifted, so lookups never pass tombstones. Every entry is linked into the
+ * bucket of the time wheel (one bucket per second) in which it expires; the
+ * wheel is advanced with the time of the processed records, so expiration
+ * costs O(1) per expired entry and no full scans are needed. When the table
+ * is full, the entry closest to expiration is evicted.
+ */
+typedef struct host_table_s {
+   uint64_t *slots;        ///< hash (upper 32 bits) and entry index + 1 (lower 32 bits), 0 if empty
+   uint32_t mask;          ///< number of slots - 1
+   host_entry_t *entries;
+   uint8_t *payload;       ///< payload_size bytes of state per entry
+   uint32_t payload_size;
+   uint32_t max_hosts;
+   uint32_t used;          ///< entries ever allocated (the rest were never used)
+   uint32_t free_list;     ///< released entries linked through next
+   uint32_t cnt;           ///< entries in the table
+   uint32_t *wheel;        ///< first entry of each bucket
+   uint32_t wheel_size;
+   uint32_t ttl;           ///< seconds an entry lives after its last update
+   uint32_t now;           ///< time of the newest record (seconds)
+   int started;            ///< now is valid
+   uint64_t evicted;       ///< entries removed before their expiration
+} host_table_t;
+
+/**
+ * Create a table of at most max_hosts entries, which expire ttl seconds
+ * after their last update. Returns NULL on failure.
+ */
+host_table_t *host_table_create(uint32_t max_hosts, uint32_t payload_size, uint32_t ttl);
+
+/**
+ * Maximum number of entries with payload_size bytes of state fitting into
+ * memory bytes together with the hash slots and the wheel of ttl seconds
+ */
+uint32_t host_table_max_hosts(uint64_t memory, uint32_t payload_size, uint32_t ttl);
+
+/**
+ * Advance the time of the table to now (seconds), expiring the entries on the
+ * way. Time never goes back, older records are accounted to the current time.
+ */
+void host_table_advance(host_table_t *t, uint32_t now);
+
+/**
+ * Payload of the host, created (zeroed) when missing. The expiration of the
+ * entry is postponed to now + ttl. Never fails, a full table evicts an entry.
+ */
+void *host_table_get(host_table_t *t, const ip_addr_t *key);
+
+void host_table_destroy(host_table_t *t);
+
+#endif
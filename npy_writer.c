@@ -0,0 +1,552 @@
+/**
+ * \file npy_writer.c
+ * \brief Dense feature matrix written to memory mapped NumPy files.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "npy_writer.h"
+
+/**
+ * Magic string and version 1.0 of the format, followed by the little endian
+ * 16 bit length of the header text
+ */
+#define NPY_MAGIC "\x93NUMPY\x01\x00"
+#define NPY_MAGIC_LEN 8
+#define NPY_PREAMBLE_LEN 10
+
+/**
+ * Byte order character of the dtypes, values are written in the host order
+ */
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define NPY_ORDER ">"
+#else
+#define NPY_ORDER "<"
+#endif
+
+/**
+ * Format the dictionary of the header describing rows rows, returns its length as snprintf()
+ */
+static int npy_dict(const npy_file_t *f, uint64_t rows, char *buf, size_t size)
+{
+   if (f->cols > 0) {
+      return snprintf(buf, size, "{'descr': %s, 'fortran_order': False, 'shape': (%" PRIu64 ", %" PRIu32 "), }",
+                      f->descr, rows, f->cols);
+   }
+   return snprintf(buf, size, "{'descr': %s, 'fortran_order': False, 'shape': (%" PRIu64 ",), }", f->descr, rows);
+}
+
+/**
+ * Write the header text describing rows rows (the dictionary padded by
+ * spaces and ended by a newline) to buf of the header length
+ */
+static void npy_header_text(const npy_file_t *f, uint64_t rows, char *buf, size_t size)
+{
+   int len = npy_dict(f, rows, buf, size);
+   if (len >= 0 && (size_t) len < size) {
+      memset(buf + len, ' ', size - len - 1);
+      buf[size - 1] = '\n';
+   }
+}
+
+/**
+ * Rewrite the shape in the header by the rows written
+ */
+static void npy_file_patch(npy_file_t *f)
+{
+   npy_header_text(f, f->rows, (char *) f->map + NPY_PREAMBLE_LEN, f->header_len - NPY_PREAMBLE_LEN);
+}
+
+/**
+ * Extend the file by up to NPY_GROW_ROWS rows (at most limit rows in total,
+ * 0 = unlimited) and map it again. The space is allocated on the disk, so
+ * writes through the mapping cannot fail for lack of space.
+ */
+static int npy_file_grow(npy_file_t *f, uint64_t limit)
+{
+   uint64_t capacity = f->capacity + NPY_GROW_ROWS;
+   if (limit > 0 && capacity > limit) {
+      capacity = limit;
+   }
+   size_t size = f->header_len + capacity * f->row_size;
+
+   int err = posix_fallocate(f->fd, 0, size);
+   if (err == EINVAL || err == EOPNOTSUPP) {
+      err = ftruncate(f->fd, size) != 0 ? errno : 0;
+   }
+   if (err != 0) {
+      fprintf(stderr, "Error: NumPy file could not be extended (%s).\n", strerror(err));
+      return -1;
+   }
+   if (f->map != NULL) {
+      munmap(f->map, f->map_size);
+   }
+   f->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, f->fd, 0);
+   if (f->map == MAP_FAILED) {
+      f->map = NULL;
+      fprintf(stderr, "Error: NumPy file could not be mapped (%s).\n", strerror(errno));
+      return -1;
+   }
+   f->map_size = size;
+   f->capacity = capacity;
+   return 0;
+}
+
+/**
+ * Create the file path with the header of an empty array of descr elements,
+ * a matrix of cols columns or a vector of records (cols 0)
+ */
+static int npy_file_open(npy_file_t *f, const char *path, const char *descr, uint32_t cols, size_t row_size,
+                         uint64_t limit)
+{
+   f->descr = descr;
+   f->cols = cols;
+   f->row_size = row_size;
+   f->rows = 0;
+   f->capacity = 0;
+   f->map = NULL;
+   f->map_size = 0;
+   // space for the largest number of rows, so the header never moves
+   int len = npy_dict(f, UINT64_MAX, NULL, 0);
+   f->header_len = (NPY_PREAMBLE_LEN + len + 1 + NPY_HEADER_ALIGN - 1) & ~(size_t) (NPY_HEADER_ALIGN - 1);
+   if (f->header_len - NPY_PREAMBLE_LEN > UINT16_MAX) {
+      fprintf(stderr, "Error: Header of NumPy file %s is too long.\n", path);
+      return -1;
+   }
+   f->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+   if (f->fd < 0) {
+      fprintf(stderr, "Error: NumPy file %s could not be created.\n", path);
+      return -1;
+   }
+   if (npy_file_grow(f, limit) != 0) {
+      return -1;
+   }
+   uint16_t text_len = f->header_len - NPY_PREAMBLE_LEN;
+   memcpy(f->map, NPY_MAGIC, NPY_MAGIC_LEN);
+   f->map[NPY_MAGIC_LEN] = text_len & 0xff;
+   f->map[NPY_MAGIC_LEN + 1] = text_len >> 8;
+   npy_file_patch(f);
+   return 0;
+}
+
+/**
+ * Write the final header, drop the space allocated beyond the rows and close the file
+ */
+static int npy_file_close(npy_file_t *f)
+{
+   int ret = 0;
+
+   if (f->fd < 0) {
+      return 0;
+   }
+   if (f->map != NULL) {
+      npy_file_patch(f);
+      munmap(f->map, f->map_size);
+      f->map = NULL;
+      if (ftruncate(f->fd, f->header_len + f->rows * f->row_size) != 0) {
+         ret = -1;
+      }
+   }
+   if (close(f->fd) != 0) {
+      ret = -1;
+   }
+   f->fd = -1;
+   return ret;
+}
+
+/**
+ * Open the next matrix and key files
+ */
+static int npy_open(npy_writer_t *w)
+{
+   static const char matrix_descr[] = "'" NPY_ORDER "f4'";
+   size_t len = strlen(w->prefix) + 32;
+   char *path = malloc(len);
+   int ret = -1;
+
+   if (path == NULL) {
+      fprintf(stderr, "Error: Memory allocation problem (NumPy writer).\n");
+      return -1;
+   }
+   uint32_t cols = 0;
+   for (uint32_t i = 0; i < w->col_cnt; i++) {
+      cols += w->cols[i].width > 0 ? w->cols[i].width : 1;
+   }
+   size_t key_size = 0;
+   for (uint32_t i = 0; i < w->key_cnt; i++) {
+      key_size += ur_size_of(w->key_cols[i].type);
+   }
+   snprintf(path, len, "%s.%06u.npy", w->prefix, w->file_seq);
+   if (npy_file_open(&w->matrix, path, matrix_descr, cols, cols * sizeof(float), w->max_rows) == 0) {
+      snprintf(path, len, "%s.%06u.keys.npy", w->prefix, w->file_seq);
+      ret = npy_file_open(&w->key_file, path, w->key_descr, 0, key_size, w->max_rows);
+   }
+   free(path);
+   w->file_seq++;
+   w->file_opened = time(NULL);
+   if (ret != 0) {
+      npy_writer_close(w);
+   }
+   return ret;
+}
+
+int npy_writer_close(npy_writer_t *w)
+{
+   int ret = npy_file_close(&w->matrix);
+   if (npy_file_close(&w->key_file) != 0) {
+      ret = -1;
+   }
+   if (ret != 0) {
+      fprintf(stderr, "Error: Write of NumPy files %s.%06u.*npy failed.\n", w->prefix, w->file_seq - 1);
+   }
+   return ret;
+}
+
+int npy_writer_tick(npy_writer_t *w, time_t now)
+{
+   if (w->matrix.fd < 0) {
+      return 0;
+   }
+   if (w->interval > 0 && now - w->file_opened >= (time_t) w->interval) {
+      return npy_writer_close(w);
+   }
+   npy_file_patch(&w->matrix);
+   npy_file_patch(&w->key_file);
+   return 0;
+}
+
+#define NPY_LOAD(ctype, p) { ctype v; memcpy(&v, p, sizeof(v)); return (float) v; }
+
+/**
+ * Value of a numeric field (array element) at p as float
+ */
+static inline float npy_value(const uint8_t *p, ur_field_type_t type)
+{
+   switch (type) {
+   case UR_TYPE_CHAR:
+   case UR_TYPE_UINT8:
+      return *p;
+   case UR_TYPE_INT8:
+      return (int8_t) *p;
+   case UR_TYPE_UINT16:
+      NPY_LOAD(uint16_t, p)
+   case UR_TYPE_INT16:
+      NPY_LOAD(int16_t, p)
+   case UR_TYPE_UINT32:
+      NPY_LOAD(uint32_t, p)
+   case UR_TYPE_INT32:
+      NPY_LOAD(int32_t, p)
+   case UR_TYPE_UINT64:
+      NPY_LOAD(uint64_t, p)
+   case UR_TYPE_INT64:
+      NPY_LOAD(int64_t, p)
+   case UR_TYPE_FLOAT:
+      NPY_LOAD(float, p)
+   case UR_TYPE_DOUBLE:
+      NPY_LOAD(double, p)
+   default:
+      return 0;
+   }
+}
+
+int npy_writer_append(npy_writer_t *w, const void *rec)
+{
+   if (w->matrix.fd < 0 && npy_open(w) != 0) {
+      return -1;
+   }
+   // both files always have space for the same number of rows
+   if (w->matrix.rows == w->matrix.capacity &&
+       (npy_file_grow(&w->matrix, w->max_rows) != 0 || npy_file_grow(&w->key_file, w->max_rows) != 0)) {
+      return -1;
+   }
+   float *row = (float *) (w->matrix.map + w->matrix.header_len + w->matrix.rows * w->matrix.row_size);
+   for (uint32_t i = 0; i < w->col_cnt; i++) {
+      const npy_col_t *c = &w->cols[i];
+      if (c->width == 0) {
+         *row++ = npy_value((const uint8_t *) rec + c->offset, c->type);
+         continue;
+      }
+      // arrays are truncated or padded by zeros to their columns
+      const uint8_t *values = ur_get_ptr_by_id(w->tmplt, rec, c->id);
+      uint32_t elem_size = ur_size_of(c->type);
+      uint32_t cnt = ur_get_var_len(w->tmplt, rec, c->id) / elem_size;
+      cnt = cnt < c->width ? cnt : c->width;
+      for (uint32_t j = 0; j < cnt; j++) {
+         row[j] = npy_value(values + j * elem_size, c->type);
+      }
+      for (uint32_t j = cnt; j < c->width; j++) {
+         row[j] = 0;
+      }
+      row += c->width;
+   }
+   uint8_t *key = w->key_file.map + w->key_file.header_len + w->key_file.rows * w->key_file.row_size;
+   for (uint32_t i = 0; i < w->key_cnt; i++) {
+      const npy_col_t *c = &w->key_cols[i];
+      const uint8_t *field = (const uint8_t *) rec + c->offset;
+      if (c->type == UR_TYPE_TIME) {
+         ur_time_t t;
+         memcpy(&t, field, sizeof(t));
+         int64_t us = (int64_t) ur_time_get_sec(t) * 1000000 + ur_time_get_usec(t);
+         memcpy(key, &us, sizeof(us));
+         key += sizeof(us);
+      } else {
+         uint32_t size = ur_size_of(c->type);
+         memcpy(key, field, size);
+         key += size;
+      }
+   }
+   w->matrix.rows++;
+   w->key_file.rows++;
+   if (w->max_rows > 0 && w->matrix.rows == w->max_rows) {
+      return npy_writer_close(w);
+   }
+   return 0;
+}
+
+/**
+ * Whether values of type can be converted to float
+ */
+static int npy_numeric(ur_field_type_t type)
+{
+   return type >= UR_TYPE_CHAR && type <= UR_TYPE_DOUBLE;
+}
+
+/**
+ * Resolve a field of the output template, -1 when it is missing
+ */
+static int npy_field_id(const npy_writer_t *w, const char *name)
+{
+   int id = ur_get_id_by_name(name);
+   if (id < 0 || !ur_is_present(w->tmplt, id)) {
+      fprintf(stderr, "Error: Output template does not contain field %s written to NumPy files.\n", name);
+      return -1;
+   }
+   return id;
+}
+
+/**
+ * Resolve a column NAME or NAME:N of the feature matrix
+ */
+static int npy_col_init(npy_writer_t *w, npy_col_t *c, char *name)
+{
+   char *width = strchr(name, ':');
+   if (width != NULL) {
+      *width++ = '\0';
+   }
+   int id = npy_field_id(w, name);
+   if (id < 0) {
+      return -1;
+   }
+   c->id = id;
+   c->type = ur_get_type(id);
+   c->width = 0;
+   if (ur_is_static(id)) {
+      if (width != NULL) {
+         fprintf(stderr, "Error: Field %s is not an array, it takes no number of columns (%s:%s).\n", name, name,
+                 width);
+         return -1;
+      }
+      c->offset = w->tmplt->offset[id];
+   } else if (width != NULL && c->type >= UR_TYPE_A_UINT8) {
+      char *end;
+      unsigned long cols = strtoul(width, &end, 10);
+      if (*width < '0' || *width > '9' || *end != '\0' || cols == 0 || cols > UINT32_MAX) {
+         fprintf(stderr, "Error: Invalid number of columns of field %s: %s\n", name, width);
+         return -1;
+      }
+      c->type = ur_array_get_elem_type(id);
+      c->width = cols;
+   } else if (width == NULL && c->type >= UR_TYPE_A_UINT8) {
+      fprintf(stderr, "Error: Field %s is an array, it needs its number of columns (%s:N).\n", name, name);
+      return -1;
+   }
+   if (!npy_numeric(c->type)) {
+      fprintf(stderr, "Error: Field %s is not numeric, it cannot be written to the feature matrix.\n", name);
+      return -1;
+   }
+   return 0;
+}
+
+/**
+ * Resolve a key field and append its part of the dtype of the key records
+ */
+static int npy_key_init(npy_writer_t *w, npy_col_t *c, const char *name, char *descr, size_t size)
+{
+   static const char *dtypes[] = {
+      [UR_TYPE_CHAR] = "'|S1'", [UR_TYPE_UINT8] = "'|u1'", [UR_TYPE_INT8] = "'|i1'",
+      [UR_TYPE_UINT16] = "'" NPY_ORDER "u2'", [UR_TYPE_INT16] = "'" NPY_ORDER "i2'",
+      [UR_TYPE_UINT32] = "'" NPY_ORDER "u4'", [UR_TYPE_INT32] = "'" NPY_ORDER "i4'",
+      [UR_TYPE_UINT64] = "'" NPY_ORDER "u8'", [UR_TYPE_INT64] = "'" NPY_ORDER "i8'",
+      [UR_TYPE_FLOAT] = "'" NPY_ORDER "f4'", [UR_TYPE_DOUBLE] = "'" NPY_ORDER "f8'",
+      [UR_TYPE_IP] = "'|u1', (16,)", [UR_TYPE_MAC] = "'|u1', (6,)", [UR_TYPE_TIME] = "'" NPY_ORDER "M8[us]'"
+   };
+   int id = npy_field_id(w, name);
+   if (id < 0) {
+      return -1;
+   }
+   c->id = id;
+   c->type = ur_get_type(id);
+   if (!ur_is_static(id) || c->type > UR_TYPE_TIME || dtypes[c->type] == NULL) {
+      fprintf(stderr, "Error: Field %s is of variable length, it cannot be a flow key.\n", name);
+      return -1;
+   }
+   c->offset = w->tmplt->offset[id];
+   c->width = 0;
+   size_t len = strlen(descr);
+   snprintf(descr + len, size - len, "%s('%s', %s)", len > 1 ? ", " : "", name, dtypes[c->type]);
+   return 0;
+}
+
+/**
+ * Number of the fields of a comma separated list
+ */
+static uint32_t npy_list_cnt(const char *list)
+{
+   uint32_t cnt = 1;
+   for (const char *p = list; *p != '\0'; p++) {
+      cnt += *p == ',';
+   }
+   return cnt;
+}
+
+/**
+ * Free the resolved columns
+ */
+static void npy_free_cols(npy_writer_t *w)
+{
+   free(w->cols);
+   w->cols = NULL;
+   w->col_cnt = 0;
+   free(w->key_cols);
+   w->key_cols = NULL;
+   w->key_cnt = 0;
+}
+
+int npy_writer_bind(npy_writer_t *w, const ur_template_t *tmplt)
+{
+   npy_free_cols(w);
+   w->tmplt = tmplt;
+
+   // every key takes at most the quoted name and its longest dtype
+   size_t descr_size = 2 * strlen(w->keys) + 32 * npy_list_cnt(w->keys) + 3;
+   char *descr = malloc(descr_size);
+   char *names = strdup(w->fields);
+   char *keys = strdup(w->keys);
+   w->cols = calloc(npy_list_cnt(w->fields), sizeof(npy_col_t));
+   w->key_cols = calloc(npy_list_cnt(w->keys), sizeof(npy_col_t));
+   int ret = descr == NULL || names == NULL || keys == NULL || w->cols == NULL || w->key_cols == NULL ? -1 : 0;
+   if (ret != 0) {
+      fprintf(stderr, "Error: Memory allocation problem (NumPy writer).\n");
+   }
+   char *save = NULL;
+   for (char *name = ret == 0 ? strtok_r(names, ",", &save) : NULL; name != NULL; name = strtok_r(NULL, ",", &save)) {
+      if (npy_col_init(w, &w->cols[w->col_cnt++], name) != 0) {
+         ret = -1;
+         break;
+      }
+   }
+   if (ret == 0) {
+      strcpy(descr, "[");
+   }
+   for (char *name = ret == 0 ? strtok_r(keys, ",", &save) : NULL; name != NULL; name = strtok_r(NULL, ",", &save)) {
+      if (npy_key_init(w, &w->key_cols[w->key_cnt++], name, descr, descr_size) != 0) {
+         ret = -1;
+         break;
+      }
+   }
+   free(names);
+   free(keys);
+   if (ret != 0) {
+      free(descr);
+      return -1;
+   }
+   strcat(descr, "]");
+   // the columns are given by names, the files continue unless the dtype of a key changed
+   if (w->key_descr != NULL && strcmp(w->key_descr, descr) != 0 && npy_writer_close(w) != 0) {
+      free(descr);
+      return -1;
+   }
+   free(w->key_descr);
+   w->key_descr = descr;
+   w->key_file.descr = descr;
+   return 0;
+}
+
+npy_writer_t *npy_writer_create(const char *prefix, const char *fields, const char *keys, uint64_t max_rows,
+                                uint32_t interval)
+{
+   npy_writer_t *w = calloc(1, sizeof(npy_writer_t));
+   if (w == NULL) {
+      return NULL;
+   }
+   w->matrix.fd = -1;
+   w->key_file.fd = -1;
+   w->prefix = strdup(prefix);
+   w->fields = strdup(fields);
+   w->keys = strdup(keys);
+   w->max_rows = max_rows;
+   w->interval = interval;
+   if (w->prefix == NULL || w->fields == NULL || w->keys == NULL) {
+      npy_writer_destroy(w);
+      return NULL;
+   }
+   return w;
+}
+
+void npy_writer_destroy(npy_writer_t *w)
+{
+   if (w == NULL) {
+      return;
+   }
+   npy_writer_close(w);
+   npy_free_cols(w);
+   free(w->key_descr);
+   free(w->prefix);
+   free(w->fields);
+   free(w->keys);
+   free(w);
+}
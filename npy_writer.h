@@ -0,0 +1,160 @@
+/**
+ * \file npy_writer.h
+ * \brief Dense feature matrix written to memory mapped NumPy files.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef _NPY_WRITER_H_
+#define _NPY_WRITER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <unirec/unirec.h>
+
+/**
+ * Flow key fields written to the companion file by default
+ */
+#define NPY_KEYS_DEFAULT "SRC_IP,DST_IP,TIME_FIRST,TIME_LAST"
+
+/**
+ * Rows added to the files at once when they are full
+ */
+#define NPY_GROW_ROWS 262144
+
+/**
+ * Headers are padded to a multiple of this size, so rows start aligned
+ */
+#define NPY_HEADER_ALIGN 64
+
+/**
+ * File in the NumPy .npy format (version 1.0) mapped to memory: a header
+ * describing the array followed by rows of row_size bytes. The file is
+ * extended (and mapped again) by NPY_GROW_ROWS rows whenever it is full,
+ * the header reserves space for any number of rows and the shape in it is
+ * rewritten by npy_file_patch().
+ */
+typedef struct npy_file_s {
+   int fd;                ///< -1 when the file is not open
+   uint8_t *map;          ///< mapping of the whole file
+   size_t map_size;       ///< size of the file and of the mapping
+   size_t header_len;     ///< size of the header, rows start here
+   size_t row_size;
+   uint64_t rows;         ///< rows written
+   uint64_t capacity;     ///< rows the file has space for
+   const char *descr;     ///< dtype of the array elements (of the records)
+   uint32_t cols;         ///< columns of a matrix, 0 for a vector of records
+} npy_file_t;
+
+/**
+ * Column group of the feature matrix, a scalar field is one column, an array
+ * field width columns
+ */
+typedef struct npy_col_s {
+   ur_field_id_t id;      ///< UniRec field
+   ur_field_type_t type;  ///< type of the value (of the array elements)
+   uint16_t offset;       ///< offset of a fixed length field in the record
+   uint32_t width;        ///< columns of an array field, 0 for a scalar
+} npy_col_t;
+
+/**
+ * Writer of the computed fields of output records into a float32 matrix
+ * PREFIX.NNNNNN.npy, one row per record, and of their flow keys into
+ * PREFIX.NNNNNN.keys.npy, a vector of records with a field per key (packed
+ * structured dtype, timestamps as datetime64[us]) with the same row order.
+ * Both can be loaded by np.load(mmap_mode='r') without parsing. Rows are
+ * written through the mappings, so appending a record makes no system call.
+ * Files are rotated after max_rows rows and when they are older than
+ * interval seconds (0 = never).
+ */
+typedef struct npy_writer_s {
+   char *prefix;
+   char *fields;          ///< comma separated columns, NAME or NAME:N for an array field of N columns
+   char *keys;            ///< comma separated key fields
+   uint64_t max_rows;     ///< rows of a file, 0 = unlimited
+   uint32_t interval;     ///< rotation interval in seconds, 0 = off
+   const ur_template_t *tmplt; ///< template of the appended records
+   npy_col_t *cols;
+   uint32_t col_cnt;
+   npy_col_t *key_cols;
+   uint32_t key_cnt;
+   char *key_descr;       ///< dtype of the key records
+   npy_file_t matrix;     ///< current feature matrix
+   npy_file_t key_file;   ///< current flow keys
+   time_t file_opened;    ///< time the current files were opened
+   uint32_t file_seq;     ///< number of the next files
+} npy_writer_t;
+
+/**
+ * Create a writer of the comma separated feature columns and key fields
+ * (names of the output template). Returns NULL on failure.
+ */
+npy_writer_t *npy_writer_create(const char *prefix, const char *fields, const char *keys, uint64_t max_rows,
+                                uint32_t interval);
+
+/**
+ * Resolve the columns in a new output template. The columns of the files do
+ * not change, so they are continued. Returns 0 on success, -1 when a field is
+ * missing or of an unsupported type.
+ */
+int npy_writer_bind(npy_writer_t *w, const ur_template_t *tmplt);
+
+/**
+ * Append a record of the bound template.
+ * Returns 0 on success, -1 when the files could not be created or extended.
+ */
+int npy_writer_append(npy_writer_t *w, const void *rec);
+
+/**
+ * Update the number of rows in the headers, so the files can be read while
+ * they are written, and rotate the files when they are older than the
+ * interval. Called regularly with the current time.
+ * Returns 0 on success, -1 on a write error.
+ */
+int npy_writer_tick(npy_writer_t *w, time_t now);
+
+/**
+ * Truncate the files to their rows, write the final headers and close them
+ */
+int npy_writer_close(npy_writer_t *w);
+
+void npy_writer_destroy(npy_writer_t *w);
+
+#endif
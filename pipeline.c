@@ -0,0 +1,468 @@
+/**
+ * \file pipeline.c
+ * \brief Ordered receive -> process -> send pipeline with a pool of worker threads.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdlib.h>
+#include "pipeline.h"
+
+/**
+ * Maximal size of a received UniRec record.
+ */
+#define PIPELINE_MAX_REC_SIZE 65535
+
+/**
+ * Expected average size of a received record, used to size the batch buffers.
+ * Batches of larger records are closed before reaching the batch size.
+ */
+#define PIPELINE_AVG_REC_SIZE 512
+
+/**
+ * Number of slots per worker, gives the workers some slack when batches take
+ * different time to process while the sender waits for the oldest one.
+ */
+#define PIPELINE_SLOTS_PER_WORKER 4
+
+enum {
+   PIPELINE_SLOT_FREE,
+   PIPELINE_SLOT_RECEIVING,
+   PIPELINE_SLOT_FILLED,
+   PIPELINE_SLOT_DONE
+};
+
+/**
+ * Size of the output buffer of a slot
+ */
+static size_t pipeline_out_buf_size(const pipeline_slot_t *slot, uint16_t out_rec_size)
+{
+   return (size_t) slot->capacity * ARENA_ROUND(out_rec_size) + (slot->out_var ? slot->in_buf_size : 0);
+}
+
+/**
+ * Allocate the buffers of a slot from its arena, the output records last, so
+ * they can be replaced by pipeline_set_out_rec_size()
+ */
+static int pipeline_slot_alloc(pipeline_slot_t *slot, uint32_t batch_size, uint32_t in_buf_size,
+                               uint16_t out_rec_size, int out_var, size_t scratch_size, int huge)
+{
+   slot->capacity = batch_size;
+   slot->in_buf_size = in_buf_size;
+   slot->out_rec_size = out_rec_size;
+   slot->out_stride = ARENA_ROUND(out_rec_size);
+   slot->out_var = out_var;
+   slot->out_buf_size = pipeline_out_buf_size(slot, out_rec_size);
+   size_t size = ARENA_ROUND(in_buf_size) + ARENA_ROUND(batch_size * sizeof(uint32_t)) +
+                 2 * ARENA_ROUND(batch_size * sizeof(uint16_t)) + ARENA_ROUND(scratch_size) + slot->out_buf_size;
+   if (arena_init(&slot->arena, size, huge) != 0) {
+      return -1;
+   }
+   slot->in_buf = arena_alloc(&slot->arena, in_buf_size);
+   slot->in_off = arena_alloc(&slot->arena, batch_size * sizeof(uint32_t));
+   slot->in_size = arena_alloc(&slot->arena, batch_size * sizeof(uint16_t));
+   slot->out_ifc = arena_alloc(&slot->arena, batch_size * sizeof(uint16_t));
+   slot->scratch = scratch_size > 0 ? arena_alloc(&slot->arena, scratch_size) : NULL;
+   slot->out_mark = arena_mark(&slot->arena);
+   slot->out_buf = arena_alloc(&slot->arena, slot->out_buf_size);
+   return 0;
+}
+
+pipeline_t *pipeline_create(uint32_t receiver_cnt, uint32_t worker_cnt, uint32_t batch_size, uint16_t out_rec_size,
+                            int out_var, size_t scratch_size, int huge, pipeline_receive_cb receive, pipeline_process_cb process,
+                            pipeline_send_cb send, void *arg)
+{
+   uint32_t in_buf_size = (batch_size ? batch_size : 1) * PIPELINE_AVG_REC_SIZE;
+
+   pipeline_t *p = calloc(1, sizeof(pipeline_t));
+   if (p == NULL) {
+      return NULL;
+   }
+   p->receiver_cnt = receiver_cnt > 1 ? receiver_cnt : 1;
+   // Receivers run in their own threads, so more of them need at least one worker
+   if (p->receiver_cnt > 1) {
+      p->worker_cnt = worker_cnt > 1 ? worker_cnt : 1;
+   } else {
+      p->worker_cnt = worker_cnt > 1 ? worker_cnt : 0;
+   }
+   // Each receiver fills one slot while the others are being processed
+   p->slot_cnt = p->worker_cnt > 0 ? p->worker_cnt * PIPELINE_SLOTS_PER_WORKER + p->receiver_cnt : 1;
+   p->receive = receive;
+   p->process = process;
+   p->send = send;
+   p->arg = arg;
+
+   p->slots = calloc(p->slot_cnt, sizeof(pipeline_slot_t));
+   p->order = calloc(p->slot_cnt, sizeof(pipeline_slot_t *));
+   p->workers = calloc(p->worker_cnt + 1, sizeof(pthread_t));
+   p->receivers = calloc(p->receiver_cnt, sizeof(pthread_t));
+   if (p->slots == NULL || p->order == NULL || p->workers == NULL || p->receivers == NULL) {
+      pipeline_destroy(p);
+      return NULL;
+   }
+   if (batch_size == 0) {
+      batch_size = 1;
+   }
+   if (in_buf_size < PIPELINE_MAX_REC_SIZE) {
+      in_buf_size = PIPELINE_MAX_REC_SIZE; // any single record always fits
+   }
+   for (uint32_t i = 0; i < p->slot_cnt; i++) {
+      if (pipeline_slot_alloc(&p->slots[i], batch_size, in_buf_size, out_rec_size, out_var, scratch_size, huge) != 0) {
+         pipeline_destroy(p);
+         return NULL;
+      }
+   }
+
+   pthread_mutex_init(&p->lock, NULL);
+   pthread_cond_init(&p->cond_free, NULL);
+   pthread_cond_init(&p->cond_filled, NULL);
+   pthread_cond_init(&p->cond_done, NULL);
+   return p;
+}
+
+void pipeline_destroy(pipeline_t *p)
+{
+   if (p == NULL) {
+      return;
+   }
+   if (p->slots != NULL) {
+      for (uint32_t i = 0; i < p->slot_cnt; i++) {
+         arena_free(&p->slots[i].arena);
+      }
+      pthread_mutex_destroy(&p->lock);
+      pthread_cond_destroy(&p->cond_free);
+      pthread_cond_destroy(&p->cond_filled);
+      pthread_cond_destroy(&p->cond_done);
+   }
+   free(p->slots);
+   free(p->order);
+   free(p->workers);
+   free(p->receivers);
+   free(p);
+}
+
+int pipeline_pause(pipeline_t *p)
+{
+   int ret;
+
+   if (p->worker_cnt == 0) {
+      return 0; // the inline loop sends each batch before receiving the next one
+   }
+   pthread_mutex_lock(&p->lock);
+   while (p->paused && !p->failed) {
+      pthread_cond_wait(&p->cond_free, &p->lock);
+   }
+   p->paused = 1;
+   while (p->next_send != p->next_fill && !p->failed) {
+      pthread_cond_wait(&p->cond_free, &p->lock);
+   }
+   ret = p->failed ? -1 : 0;
+   if (ret != 0) {
+      p->paused = 0;
+      pthread_cond_broadcast(&p->cond_free);
+   }
+   pthread_mutex_unlock(&p->lock);
+   return ret;
+}
+
+void pipeline_resume(pipeline_t *p)
+{
+   if (p->worker_cnt == 0) {
+      return;
+   }
+   pthread_mutex_lock(&p->lock);
+   p->paused = 0;
+   pthread_cond_broadcast(&p->cond_free);
+   pthread_mutex_unlock(&p->lock);
+}
+
+void pipeline_fail(pipeline_t *p)
+{
+   pthread_mutex_lock(&p->lock);
+   p->failed = 1;
+   p->paused = 0;
+   pthread_cond_broadcast(&p->cond_free);
+   pthread_cond_broadcast(&p->cond_filled);
+   pthread_cond_broadcast(&p->cond_done);
+   pthread_mutex_unlock(&p->lock);
+}
+
+int pipeline_set_out_rec_size(pipeline_t *p, uint16_t out_rec_size)
+{
+   for (uint32_t i = 0; i < p->slot_cnt; i++) {
+      pipeline_slot_t *slot = &p->slots[i];
+      size_t out_buf_size = pipeline_out_buf_size(slot, out_rec_size);
+      if (out_buf_size > slot->out_buf_size) {
+         // the output records are the last allocation of the arena, only they are replaced
+         arena_release(&slot->arena, slot->out_mark);
+         uint8_t *out_buf = arena_alloc(&slot->arena, out_buf_size);
+         if (out_buf == NULL) {
+            slot->out_buf = arena_alloc(&slot->arena, slot->out_buf_size);
+            return -1;
+         }
+         memset(out_buf, 0, out_buf_size);
+         slot->out_buf = out_buf;
+         slot->out_buf_size = out_buf_size;
+      }
+      slot->out_rec_size = out_rec_size;
+      slot->out_stride = ARENA_ROUND(out_rec_size);
+   }
+   return 0;
+}
+
+/**
+ * Worker thread: take filled slots in sequence and process them.
+ */
+static void *pipeline_worker(void *arg)
+{
+   pipeline_t *p = (pipeline_t *) arg;
+
+   pthread_mutex_lock(&p->lock);
+   while (1) {
+      while (p->next_process == p->next_fill && !p->closing && !p->failed) {
+         pthread_cond_wait(&p->cond_filled, &p->lock);
+      }
+      if (p->failed || p->next_process == p->next_fill) {
+         break;
+      }
+      pipeline_slot_t *slot = p->order[p->next_process++ % p->slot_cnt];
+      pthread_mutex_unlock(&p->lock);
+
+      p->process(slot, p->arg);
+
+      pthread_mutex_lock(&p->lock);
+      slot->state = PIPELINE_SLOT_DONE;
+      pthread_cond_broadcast(&p->cond_done);
+   }
+   pthread_mutex_unlock(&p->lock);
+   return NULL;
+}
+
+/**
+ * Sender thread: wait for the oldest slot to be processed and send it, so the
+ * output keeps the input order regardless of which worker finished first.
+ */
+static void *pipeline_sender(void *arg)
+{
+   pipeline_t *p = (pipeline_t *) arg;
+
+   pthread_mutex_lock(&p->lock);
+   while (1) {
+      // The order entry is valid only for slots received already
+      while (!p->failed && !(p->closing && p->next_send == p->next_fill) &&
+             !(p->next_send < p->next_fill && p->order[p->next_send % p->slot_cnt]->state == PIPELINE_SLOT_DONE)) {
+         pthread_cond_wait(&p->cond_done, &p->lock);
+      }
+      if (p->failed || p->next_send == p->next_fill) {
+         break;
+      }
+      pipeline_slot_t *slot = p->order[p->next_send % p->slot_cnt];
+      pthread_mutex_unlock(&p->lock);
+
+      int ret = p->send(slot, p->arg);
+
+      pthread_mutex_lock(&p->lock);
+      slot->state = PIPELINE_SLOT_FREE;
+      p->next_send++;
+      // Receivers wait for a free slot, for the end of a pause or for the pipeline to be drained
+      pthread_cond_broadcast(&p->cond_free);
+      if (ret != 0) {
+         p->failed = 1;
+         pthread_cond_broadcast(&p->cond_filled);
+         break;
+      }
+   }
+   pthread_mutex_unlock(&p->lock);
+   return NULL;
+}
+
+/**
+ * Single threaded variant, receive -> process -> send one batch at a time.
+ */
+static int pipeline_run_inline(pipeline_t *p)
+{
+   pipeline_slot_t *slot = &p->slots[0];
+   int last = 0;
+
+   while (!last) {
+      slot->count = 0;
+      slot->in_used = 0;
+      slot->flush = 0;
+      slot->source = 0;
+      last = p->receive(slot, p->arg) != 0;
+      if (slot->count == 0 || p->failed) {
+         break;
+      }
+      p->process(slot, p->arg);
+      if (p->send(slot, p->arg) != 0) {
+         break;
+      }
+   }
+   return 0;
+}
+
+/**
+ * Receiver of a threaded pipeline: take a free slot, let the receive callback
+ * fill it and publish it with the next sequence number.
+ */
+static void pipeline_receive_loop(pipeline_t *p, uint32_t source)
+{
+   int last = 0;
+
+   while (!last) {
+      pipeline_slot_t *slot = NULL;
+      pthread_mutex_lock(&p->lock);
+      while (!p->failed) {
+         for (uint32_t i = 0; i < p->slot_cnt && slot == NULL; i++) {
+            if (p->slots[i].state == PIPELINE_SLOT_FREE) {
+               slot = &p->slots[i];
+            }
+         }
+         if (slot != NULL) {
+            break;
+         }
+         pthread_cond_wait(&p->cond_free, &p->lock);
+      }
+      if (slot == NULL) {
+         pthread_mutex_unlock(&p->lock);
+         break;
+      }
+      slot->state = PIPELINE_SLOT_RECEIVING;
+      pthread_mutex_unlock(&p->lock);
+
+      slot->count = 0;
+      slot->in_used = 0;
+      slot->flush = 0;
+      slot->source = source;
+      last = p->receive(slot, p->arg) != 0;
+
+      pthread_mutex_lock(&p->lock);
+      while (p->paused && !p->failed && slot->count > 0) {
+         pthread_cond_wait(&p->cond_free, &p->lock);
+      }
+      if (slot->count > 0 && !p->failed) {
+         p->order[p->next_fill % p->slot_cnt] = slot;
+         slot->state = PIPELINE_SLOT_FILLED;
+         p->next_fill++;
+         pthread_cond_signal(&p->cond_filled);
+      } else {
+         slot->state = PIPELINE_SLOT_FREE;
+         pthread_cond_broadcast(&p->cond_free);
+      }
+      pthread_mutex_unlock(&p->lock);
+   }
+}
+
+typedef struct pipeline_receiver_arg_s {
+   pipeline_t *p;
+   uint32_t source;
+} pipeline_receiver_arg_t;
+
+static void *pipeline_receiver(void *arg)
+{
+   pipeline_receiver_arg_t *r = (pipeline_receiver_arg_t *) arg;
+
+   pipeline_receive_loop(r->p, r->source);
+   return NULL;
+}
+
+int pipeline_run(pipeline_t *p)
+{
+   uint32_t started = 0;
+   uint32_t receivers_started = 0;
+   int sender_started = 0;
+   int ret = 0;
+
+   if (p->worker_cnt == 0) {
+      return pipeline_run_inline(p);
+   }
+
+   pipeline_receiver_arg_t *receiver_args = calloc(p->receiver_cnt, sizeof(pipeline_receiver_arg_t));
+   if (receiver_args == NULL) {
+      return -1;
+   }
+   for (started = 0; started < p->worker_cnt; started++) {
+      if (pthread_create(&p->workers[started], NULL, pipeline_worker, p) != 0) {
+         ret = -1;
+         break;
+      }
+   }
+   if (ret == 0 && pthread_create(&p->sender, NULL, pipeline_sender, p) == 0) {
+      sender_started = 1;
+   } else {
+      ret = -1;
+   }
+   for (receivers_started = 1; ret == 0 && receivers_started < p->receiver_cnt; receivers_started++) {
+      receiver_args[receivers_started] = (pipeline_receiver_arg_t) { .p = p, .source = receivers_started };
+      if (pthread_create(&p->receivers[receivers_started], NULL, pipeline_receiver,
+                         &receiver_args[receivers_started]) != 0) {
+         ret = -1;
+         pthread_mutex_lock(&p->lock);
+         p->failed = 1;
+         pthread_cond_broadcast(&p->cond_free);
+         pthread_mutex_unlock(&p->lock);
+         break;
+      }
+   }
+
+   if (ret == 0) {
+      pipeline_receive_loop(p, 0);
+   }
+   for (uint32_t i = 1; i < receivers_started; i++) {
+      pthread_join(p->receivers[i], NULL);
+   }
+   free(receiver_args);
+
+   pthread_mutex_lock(&p->lock);
+   p->closing = 1;
+   if (ret != 0) {
+      p->failed = 1;
+   }
+   pthread_cond_broadcast(&p->cond_filled);
+   pthread_cond_broadcast(&p->cond_done);
+   pthread_mutex_unlock(&p->lock);
+
+   for (uint32_t i = 0; i < started; i++) {
+      pthread_join(p->workers[i], NULL);
+   }
+   if (sender_started) {
+      pthread_join(p->sender, NULL);
+   }
+   return ret;
+}
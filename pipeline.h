@@ -0,0 +1,224 @@
+/**
+ * \file pipeline.h
+ * \brief Ordered receive -> process -> send pipeline with a pool of worker threads.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "arena.h"
+
+/**
+ * Batch of records travelling through the pipeline. Received records are
+ * copied into the slot because libtrap reuses its buffer on the next
+ * trap_recv(), output records are preallocated as one contiguous array.
+ * With out_var set, output record i is followed by space for a variable
+ * length part as large as received record i.
+ *
+ * All buffers of the slot are allocated from its arena once (the output
+ * records again when their size changes), every received and output record
+ * starts on a cache line. A slot is used by one thread at a time, so is its
+ * arena.
+ */
+typedef struct pipeline_slot_s {
+   uint32_t count;        ///< number of records in the batch
+   uint32_t capacity;     ///< maximal number of records in the batch
+   uint8_t *in_buf;       ///< copies of the received records, back to back
+   uint32_t in_buf_size;  ///< allocated size of in_buf
+   uint32_t in_used;      ///< used part of in_buf
+   uint32_t *in_off;      ///< offset of each received record in in_buf
+   uint16_t *in_size;     ///< size of each received record
+   uint16_t *out_ifc;     ///< output interface of each output record, set by the process callback
+   void *scratch;         ///< scratch memory of the process callback, NULL without it
+   uint8_t *out_buf;      ///< capacity output records, out_rec_size bytes each
+   size_t out_buf_size;   ///< allocated size of out_buf
+   uint16_t out_rec_size; ///< size of one output record (its fixed part with out_var)
+   uint32_t out_stride;   ///< out_rec_size rounded up to a cache line
+   int out_var;           ///< output records have a variable length part
+   int flush;             ///< batch was closed by a receive timeout, flush the output after sending
+   uint32_t source;       ///< index of the receiver which filled the batch
+   int state;             ///< PIPELINE_SLOT_* state, guarded by the pipeline lock
+   arena_t arena;         ///< memory of the buffers
+   arena_mark_t out_mark; ///< arena position before out_buf, the last buffer
+} pipeline_slot_t;
+
+/**
+ * Append a copy of a received record to the batch. Returns 0 on success, -1 when the batch is full.
+ */
+static inline int pipeline_slot_add(pipeline_slot_t *slot, const void *rec, uint16_t size)
+{
+   if (slot->count == slot->capacity || slot->in_used + size > slot->in_buf_size) {
+      return -1;
+   }
+   memcpy(slot->in_buf + slot->in_used, rec, size);
+   slot->in_off[slot->count] = slot->in_used;
+   slot->in_size[slot->count] = size;
+   slot->in_used += ARENA_ROUND(size);
+   slot->count++;
+   return 0;
+}
+
+/**
+ * Received record i of the batch.
+ */
+static inline const void *pipeline_slot_in_rec(const pipeline_slot_t *slot, uint32_t i)
+{
+   return slot->in_buf + slot->in_off[i];
+}
+
+/**
+ * Output record i of the batch.
+ */
+static inline void *pipeline_slot_out_rec(const pipeline_slot_t *slot, uint32_t i)
+{
+   size_t off = (size_t) i * slot->out_stride;
+   if (slot->out_var) {
+      off += slot->in_off[i];
+   }
+   return slot->out_buf + off;
+}
+
+/**
+ * Fill the batch with received records, slot->count is zero on entry and
+ * slot->source identifies the calling receiver. Returns 0 on success, nonzero
+ * to stop the receiver (records already added to the batch are still processed
+ * and sent). The pipeline stops when all receivers have stopped.
+ */
+typedef int (*pipeline_receive_cb)(pipeline_slot_t *slot, void *arg);
+/**
+ * Compute output records of the batch. Called concurrently from worker threads.
+ */
+typedef void (*pipeline_process_cb)(pipeline_slot_t *slot, void *arg);
+/**
+ * Send output records of the batch. Called in input order. Returns 0 on success, nonzero to stop the pipeline.
+ */
+typedef int (*pipeline_send_cb)(pipeline_slot_t *slot, void *arg);
+
+typedef struct pipeline_s {
+   pipeline_slot_t *slots;
+   pipeline_slot_t **order; ///< received slots indexed by sequence number modulo slot_cnt
+   uint32_t slot_cnt;
+   uint64_t next_fill;    ///< sequence number of the next slot to be received
+   uint64_t next_process; ///< sequence number of the next slot to be processed
+   uint64_t next_send;    ///< sequence number of the next slot to be sent
+   int closing;           ///< receiving finished, drain the remaining slots
+   int failed;            ///< sending failed (or pipeline_fail()), stop as soon as possible
+   int paused;            ///< a receiver paused the pipeline, others must not publish slots
+
+   pthread_mutex_t lock;
+   pthread_cond_t cond_free;   ///< a slot was sent and can be reused or the pipeline was resumed
+   pthread_cond_t cond_filled; ///< a slot was received
+   pthread_cond_t cond_done;   ///< a slot was processed
+
+   pthread_t *workers;
+   uint32_t worker_cnt;
+   pthread_t *receivers;  ///< threads of receivers 1.., receiver 0 runs in pipeline_run()
+   uint32_t receiver_cnt;
+   pthread_t sender;
+
+   pipeline_receive_cb receive;
+   pipeline_process_cb process;
+   pipeline_send_cb send;
+   void *arg;
+} pipeline_t;
+
+/**
+ * Create a pipeline with receiver_cnt receiving threads, worker_cnt processing
+ * threads and batches of up to batch_size records. With a single receiver and
+ * worker_cnt <= 1 no threads are started and pipeline_run() processes batches
+ * in the calling thread.
+ *
+ * Output records of the slots are allocated with out_rec_size bytes, plus the
+ * size of the corresponding received record when out_var is set. Each slot
+ * has scratch_size bytes of scratch memory for the process callback (it is
+ * used by one worker at a time). With huge set, buffers of the slots are
+ * backed by huge pages when possible.
+ */
+pipeline_t *pipeline_create(uint32_t receiver_cnt, uint32_t worker_cnt, uint32_t batch_size, uint16_t out_rec_size,
+                            int out_var, size_t scratch_size, int huge,
+                            pipeline_receive_cb receive, pipeline_process_cb process, pipeline_send_cb send,
+                            void *arg);
+
+/**
+ * Run the pipeline until all receivers or the send callback ask to stop. The
+ * calling thread and one thread per further receiver receive batches, worker
+ * threads process them and a sender thread sends the results in the order in
+ * which the receivers finished them (the input order of each receiver is kept).
+ *
+ * Returns 0 on success, -1 when threads could not be started.
+ */
+int pipeline_run(pipeline_t *p);
+
+/**
+ * Stop publishing of received batches and wait until all published batches
+ * are processed and sent. Called from the receive callback, e.g. before the
+ * templates used by the other callbacks are replaced; other receivers keep
+ * filling their current batches but wait with them until pipeline_resume().
+ * Returns 0 on success, -1 when the pipeline failed meanwhile (it is not
+ * paused then).
+ */
+int pipeline_pause(pipeline_t *p);
+
+/**
+ * Let the other receivers publish their batches again.
+ */
+void pipeline_resume(pipeline_t *p);
+
+/**
+ * Stop the whole pipeline as after a failed send, e.g. when the templates
+ * could not be replaced during a pause: batches not sent yet are dropped, no
+ * further batch is published and pipeline_run() returns when the threads
+ * finish. Ends a pause of the calling receiver as well.
+ */
+void pipeline_fail(pipeline_t *p);
+
+/**
+ * Change size of output records of all slots. The pipeline must be drained.
+ * Returns 0 on success, -1 on memory allocation failure.
+ */
+int pipeline_set_out_rec_size(pipeline_t *p, uint16_t out_rec_size);
+
+void pipeline_destroy(pipeline_t *p);
+
+#endif
@@ -0,0 +1,603 @@
+/**
+ * \file ppi_kernels.c
+ * \brief Vectorized reductions over PPI (per packet information) arrays.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <string.h>
+#include "ppi_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PPI_KERNELS_X86
+#endif
+
+/**
+ * Instantiate the variants of a kernel body, in the order of ppi_len_kernels
+ */
+#define PPI_LEN_VARIANT(name, attr, suffix, with_sq, with_hist) \
+   attr static void name##suffix(const uint16_t *lens, const int8_t *dirs, uint32_t cnt, ppi_len_stats_t *out, \
+                                 ppi_hist_t *hist) \
+   { \
+      name##_body(lens, dirs, cnt, out, hist, with_sq, with_hist); \
+   }
+#define PPI_LEN_VARIANTS_OF(name, attr) \
+   PPI_LEN_VARIANT(name, attr, _plain, 0, 0) \
+   PPI_LEN_VARIANT(name, attr, _sq, 1, 0) \
+   PPI_LEN_VARIANT(name, attr, _hist, 0, 1) \
+   PPI_LEN_VARIANT(name, attr, _sq_hist, 1, 1)
+#define PPI_LEN_TABLE(name) {name##_plain, name##_sq, name##_hist, name##_sq_hist}
+
+/**
+ * Initial values of the reductions
+ */
+#define PPI_LEN_STATS_INIT ((ppi_len_stats_t) { .min_sent = UINT16_MAX, .min_recv = UINT16_MAX })
+
+/**
+ * Finish the statistics from the partial sums and per direction extremes, shared by all kernel variants.
+ */
+static inline void ppi_len_stats_finish(ppi_len_stats_t *out, uint32_t cnt)
+{
+   out->recv = cnt - out->sent;
+   out->bytes_recv = out->sum - out->bytes_sent;
+   out->sum_sq_recv = out->sum_sq - out->sum_sq_sent;
+   out->min = out->min_sent < out->min_recv ? out->min_sent : out->min_recv;
+   out->max = out->max_sent > out->max_recv ? out->max_sent : out->max_recv;
+   if (out->sent == 0) {
+      out->min_sent = 0;
+   }
+   if (out->recv == 0) {
+      out->min_recv = 0;
+   }
+   if (cnt == 0) {
+      out->min = 0;
+   }
+}
+
+/**
+ * Scalar loop, also used for the tails of the vectorized kernels. Kernels are
+ * instantiated with constant with_sq and with_hist, so the sum of squares and
+ * the histograms are compiled out of the variants which do not need them.
+ * Directions and bins are selected without branches (conditional moves and
+ * array indexes).
+ */
+static inline __attribute__((always_inline))
+void ppi_len_stats_tail(const uint16_t *lens, const int8_t *dirs, uint32_t from, uint32_t cnt,
+                        ppi_len_stats_t *out, ppi_hist_t *hist, const int with_sq, const int with_hist)
+{
+   for (uint32_t i = from; i < cnt; i++) {
+      uint16_t len16 = ppi_len_at(lens, i);
+      uint64_t len = len16;
+      uint32_t is_sent = dirs[i] == 1;
+      out->sent += is_sent;
+      out->bytes_sent += is_sent ? len : 0;
+      out->sum += len;
+      if (with_sq) {
+         out->sum_sq += len * len;
+         out->sum_sq_sent += is_sent ? len * len : 0;
+      }
+      // the other direction compares with neutral values
+      uint16_t min_sent = is_sent ? len16 : UINT16_MAX, min_recv = is_sent ? UINT16_MAX : len16;
+      uint16_t max_sent = is_sent ? len16 : 0, max_recv = is_sent ? 0 : len16;
+      out->min_sent = min_sent < out->min_sent ? min_sent : out->min_sent;
+      out->min_recv = min_recv < out->min_recv ? min_recv : out->min_recv;
+      out->max_sent = max_sent > out->max_sent ? max_sent : out->max_sent;
+      out->max_recv = max_recv > out->max_recv ? max_recv : out->max_recv;
+      if (with_hist) {
+         uint32_t bin = len16 / hist->width;
+         hist->lin[!is_sent][bin < hist->bins - 1 ? bin : hist->bins - 1]++;
+         hist->log[!is_sent][31 - __builtin_clz((uint32_t) len16 | 1)]++;
+      }
+   }
+}
+
+static inline __attribute__((always_inline))
+void ppi_len_stats_scalar_body(const uint16_t *lens, const int8_t *dirs, uint32_t cnt, ppi_len_stats_t *out,
+                               ppi_hist_t *hist, const int with_sq, const int with_hist)
+{
+   *out = PPI_LEN_STATS_INIT;
+   ppi_len_stats_tail(lens, dirs, 0, cnt, out, hist, with_sq, with_hist);
+   ppi_len_stats_finish(out, cnt);
+}
+
+PPI_LEN_VARIANTS_OF(ppi_len_stats_scalar, )
+
+const ppi_len_stats_fn ppi_len_kernels_scalar[PPI_LEN_VARIANTS] = PPI_LEN_TABLE(ppi_len_stats_scalar);
+
+ppi_len_stats_fn ppi_len_kernels[PPI_LEN_VARIANTS] = PPI_LEN_TABLE(ppi_len_stats_scalar);
+
+/**
+ * Scalar loop over the intervals from..n, also used for the tails of the vectorized kernels
+ */
+static inline void ppi_iat_tail(const uint64_t *times, uint32_t from, uint32_t n, uint64_t *iat,
+                                ppi_iat_stats_t *out)
+{
+   for (uint32_t i = from; i < n; i++) {
+      uint64_t us = ppi_timediff_us(ppi_time_at(times, i + 1), ppi_time_at(times, i));
+      iat[i] = us;
+      out->min = us < out->min ? us : out->min;
+      out->max = us > out->max ? us : out->max;
+      out->sum += us;
+   }
+}
+
+/**
+ * Finish the statistics, shared by all kernels
+ */
+static inline void ppi_iat_finish(ppi_iat_stats_t *out)
+{
+   if (out->cnt == 0) {
+      out->min = 0;
+   }
+}
+
+void ppi_iat_scalar(const uint64_t *times, uint32_t cnt, uint64_t *iat, ppi_iat_stats_t *out)
+{
+   *out = (ppi_iat_stats_t) { .cnt = cnt > 0 ? cnt - 1 : 0, .min = UINT64_MAX };
+   ppi_iat_tail(times, 0, out->cnt, iat, out);
+   ppi_iat_finish(out);
+}
+
+ppi_iat_fn ppi_iat = ppi_iat_scalar;
+
+void ppi_flag_stats_scalar(const uint8_t *flags, const int8_t *dirs, uint32_t cnt, ppi_flag_stats_t *out)
+{
+   *out = (ppi_flag_stats_t) { 0 };
+   for (uint32_t i = 0; i < cnt; i++) {
+      uint32_t is_sent = dirs[i] == 1;
+      for (int b = 0; b < PPI_FLAG_CNT; b++) {
+         uint32_t set = (flags[i] >> b) & 1;
+         out->total[b] += set;
+         out->sent[b] += set & is_sent;
+      }
+   }
+}
+
+ppi_flag_fn ppi_flag_stats = ppi_flag_stats_scalar;
+
+#ifdef PPI_KERNELS_X86
+
+/**
+ * Count 4 lengths (32 bit lanes) into the histograms. The fixed width bin is
+ * the length multiplied by the reciprocal of the width, corrected by one when
+ * the rounding of the product missed the exact quotient. The logarithmic bin
+ * is the exponent of the length converted to float. Received packets count
+ * into the second half of the flattened arrays, so only the increments
+ * themselves are scalar.
+ */
+__attribute__((target("sse4.1"), always_inline))
+static inline void ppi_hist_sse41(ppi_hist_t *hist, __m128i len, __m128i sent, __m128 inv, __m128i width,
+                                  __m128i last)
+{
+   __m128i bin = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(len), inv));
+   __m128i rem = _mm_sub_epi32(len, _mm_mullo_epi32(bin, width));
+   bin = _mm_add_epi32(bin, _mm_srai_epi32(rem, 31));
+   bin = _mm_sub_epi32(bin, _mm_cmpgt_epi32(rem, _mm_sub_epi32(width, _mm_set1_epi32(1))));
+   bin = _mm_min_epi32(bin, last);
+   bin = _mm_add_epi32(bin, _mm_andnot_si128(sent, _mm_set1_epi32(PPI_HIST_BINS_MAX)));
+
+   __m128 flen = _mm_cvtepi32_ps(_mm_or_si128(len, _mm_set1_epi32(1)));
+   __m128i exp = _mm_sub_epi32(_mm_srli_epi32(_mm_castps_si128(flen), 23), _mm_set1_epi32(127));
+   exp = _mm_add_epi32(exp, _mm_andnot_si128(sent, _mm_set1_epi32(PPI_LOG_BINS)));
+
+   uint32_t b[4], e[4];
+   _mm_storeu_si128((__m128i *) b, bin);
+   _mm_storeu_si128((__m128i *) e, exp);
+   for (int k = 0; k < 4; k++) {
+      (&hist->lin[0][0])[b[k]]++;
+      (&hist->log[0][0])[e[k]]++;
+   }
+}
+
+/**
+ * Sum of squares of the lengths in the 32 bit lanes of lo and hi, in 64 bit lanes
+ */
+__attribute__((target("sse4.1"), always_inline))
+static inline __m128i ppi_sq_sse41(__m128i lo, __m128i hi)
+{
+   __m128i even = _mm_add_epi64(_mm_mul_epu32(lo, lo), _mm_mul_epu32(hi, hi));
+   lo = _mm_srli_epi64(lo, 32);
+   hi = _mm_srli_epi64(hi, 32);
+   return _mm_add_epi64(even, _mm_add_epi64(_mm_mul_epu32(lo, lo), _mm_mul_epu32(hi, hi)));
+}
+
+/**
+ * SSE4.1 kernel, 8 packets per iteration. Lengths are widened to 32 bits for
+ * the sums and squared into 64 bit lanes, so nothing overflows even for the
+ * longest arrays a UniRec record can hold. Per direction values use the
+ * direction mask: lanes of the other direction are cleared for the sums and
+ * the maximum and set to all ones for the minimum.
+ */
+__attribute__((target("sse4.1"), always_inline))
+static inline void ppi_len_stats_sse41_body(const uint16_t *lens, const int8_t *dirs, uint32_t cnt,
+                                            ppi_len_stats_t *out, ppi_hist_t *hist, const int with_sq,
+                                            const int with_hist)
+{
+   const __m128i zero = _mm_setzero_si128();
+   const __m128i ones = _mm_set1_epi8(-1);
+   const __m128i one8 = _mm_set1_epi8(1);
+   const __m128 inv = _mm_set1_ps(with_hist ? hist->inv_width : 0);
+   const __m128i width = _mm_set1_epi32(with_hist ? hist->width : 1);
+   const __m128i last = _mm_set1_epi32(with_hist ? hist->bins - 1 : 0);
+   __m128i sum = zero, sum_sent = zero, sum_sq = zero, sum_sq_sent = zero;
+   __m128i min_sent = ones, min_recv = ones, max_sent = zero, max_recv = zero;
+   uint32_t sent = 0;
+   uint32_t i = 0;
+
+   for (; i + 8 <= cnt; i += 8) {
+      __m128i len = _mm_loadu_si128((const __m128i *) (lens + i));
+      __m128i dir = _mm_cmpeq_epi8(_mm_loadl_epi64((const __m128i *) (dirs + i)), one8);
+      __m128i mask = _mm_cvtepi8_epi16(dir);
+      sent += __builtin_popcount(_mm_movemask_epi8(dir) & 0xff);
+
+      __m128i lo = _mm_unpacklo_epi16(len, zero);
+      __m128i hi = _mm_unpackhi_epi16(len, zero);
+      sum = _mm_add_epi32(sum, _mm_add_epi32(lo, hi));
+      __m128i len_sent = _mm_and_si128(len, mask);
+      __m128i lo_sent = _mm_unpacklo_epi16(len_sent, zero);
+      __m128i hi_sent = _mm_unpackhi_epi16(len_sent, zero);
+      sum_sent = _mm_add_epi32(sum_sent, _mm_add_epi32(lo_sent, hi_sent));
+      if (with_hist) {
+         ppi_hist_sse41(hist, lo, _mm_unpacklo_epi16(mask, mask), inv, width, last);
+         ppi_hist_sse41(hist, hi, _mm_unpackhi_epi16(mask, mask), inv, width, last);
+      }
+      if (with_sq) {
+         sum_sq = _mm_add_epi64(sum_sq, ppi_sq_sse41(lo, hi));
+         sum_sq_sent = _mm_add_epi64(sum_sq_sent, ppi_sq_sse41(lo_sent, hi_sent));
+      }
+
+      min_sent = _mm_min_epu16(min_sent, _mm_or_si128(len, _mm_xor_si128(mask, ones)));
+      min_recv = _mm_min_epu16(min_recv, _mm_or_si128(len, mask));
+      max_sent = _mm_max_epu16(max_sent, len_sent);
+      max_recv = _mm_max_epu16(max_recv, _mm_andnot_si128(mask, len));
+   }
+
+   uint32_t s32[4], ss32[4];
+   uint64_t sq64[2], sqs64[2];
+   uint16_t mns[8], mnr[8], mxs[8], mxr[8];
+   _mm_storeu_si128((__m128i *) s32, sum);
+   _mm_storeu_si128((__m128i *) ss32, sum_sent);
+   _mm_storeu_si128((__m128i *) sq64, sum_sq);
+   _mm_storeu_si128((__m128i *) sqs64, sum_sq_sent);
+   _mm_storeu_si128((__m128i *) mns, min_sent);
+   _mm_storeu_si128((__m128i *) mnr, min_recv);
+   _mm_storeu_si128((__m128i *) mxs, max_sent);
+   _mm_storeu_si128((__m128i *) mxr, max_recv);
+
+   *out = PPI_LEN_STATS_INIT;
+   out->sent = sent;
+   out->sum = (uint64_t) s32[0] + s32[1] + s32[2] + s32[3];
+   out->bytes_sent = (uint64_t) ss32[0] + ss32[1] + ss32[2] + ss32[3];
+   out->sum_sq = sq64[0] + sq64[1];
+   out->sum_sq_sent = sqs64[0] + sqs64[1];
+   for (int k = 0; k < 8; k++) {
+      out->min_sent = mns[k] < out->min_sent ? mns[k] : out->min_sent;
+      out->min_recv = mnr[k] < out->min_recv ? mnr[k] : out->min_recv;
+      out->max_sent = mxs[k] > out->max_sent ? mxs[k] : out->max_sent;
+      out->max_recv = mxr[k] > out->max_recv ? mxr[k] : out->max_recv;
+   }
+   ppi_len_stats_tail(lens, dirs, i, cnt, out, hist, with_sq, with_hist);
+   ppi_len_stats_finish(out, cnt);
+}
+
+PPI_LEN_VARIANTS_OF(ppi_len_stats_sse41, __attribute__((target("sse4.1"))))
+
+static const ppi_len_stats_fn ppi_len_kernels_sse41[PPI_LEN_VARIANTS] = PPI_LEN_TABLE(ppi_len_stats_sse41);
+
+/**
+ * Count the flags of 16 packets. Shifting the flag bytes left (in 16 bit
+ * lanes, the top bit of each byte comes from the same byte) moves flag b to
+ * the top bit, movemask then gives the flag of all packets as a bit mask,
+ * which is counted by popcount, alone and together with the mask of sent
+ * packets.
+ */
+__attribute__((target("sse4.1"), always_inline))
+static inline void ppi_flag_block_sse41(const uint8_t *flags, const int8_t *dirs, ppi_flag_stats_t *out)
+{
+   __m128i f = _mm_loadu_si128((const __m128i *) flags);
+   uint32_t sent = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) dirs), _mm_set1_epi8(1)));
+   for (int b = 0; b < PPI_FLAG_CNT; b++) {
+      uint32_t set = _mm_movemask_epi8(_mm_sll_epi16(f, _mm_cvtsi32_si128(7 - b)));
+      out->total[b] += __builtin_popcount(set);
+      out->sent[b] += __builtin_popcount(set & sent);
+   }
+}
+
+/**
+ * SSE4.1 flag counting kernel, 16 packets per iteration. The tail is copied
+ * to a zero padded block, packets without flags are not counted.
+ */
+__attribute__((target("sse4.1")))
+static void ppi_flag_stats_sse41(const uint8_t *flags, const int8_t *dirs, uint32_t cnt, ppi_flag_stats_t *out)
+{
+   uint32_t i = 0;
+
+   *out = (ppi_flag_stats_t) { 0 };
+   for (; i + 16 <= cnt; i += 16) {
+      ppi_flag_block_sse41(flags + i, dirs + i, out);
+   }
+   if (i < cnt) {
+      uint8_t tail_flags[16] = { 0 };
+      int8_t tail_dirs[16] = { 0 };
+      memcpy(tail_flags, flags + i, cnt - i);
+      memcpy(tail_dirs, dirs + i, cnt - i);
+      ppi_flag_block_sse41(tail_flags, tail_dirs, out);
+   }
+}
+
+/**
+ * Histogram binning of 8 lengths, same scheme as ppi_hist_sse41().
+ */
+__attribute__((target("avx2"), always_inline))
+static inline void ppi_hist_avx2(ppi_hist_t *hist, __m256i len, __m256i sent, __m256 inv, __m256i width,
+                                 __m256i last)
+{
+   __m256i bin = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(len), inv));
+   __m256i rem = _mm256_sub_epi32(len, _mm256_mullo_epi32(bin, width));
+   bin = _mm256_add_epi32(bin, _mm256_srai_epi32(rem, 31));
+   bin = _mm256_sub_epi32(bin, _mm256_cmpgt_epi32(rem, _mm256_sub_epi32(width, _mm256_set1_epi32(1))));
+   bin = _mm256_min_epi32(bin, last);
+   bin = _mm256_add_epi32(bin, _mm256_andnot_si256(sent, _mm256_set1_epi32(PPI_HIST_BINS_MAX)));
+
+   __m256 flen = _mm256_cvtepi32_ps(_mm256_or_si256(len, _mm256_set1_epi32(1)));
+   __m256i exp = _mm256_sub_epi32(_mm256_srli_epi32(_mm256_castps_si256(flen), 23), _mm256_set1_epi32(127));
+   exp = _mm256_add_epi32(exp, _mm256_andnot_si256(sent, _mm256_set1_epi32(PPI_LOG_BINS)));
+
+   uint32_t b[8], e[8];
+   _mm256_storeu_si256((__m256i *) b, bin);
+   _mm256_storeu_si256((__m256i *) e, exp);
+   for (int k = 0; k < 8; k++) {
+      (&hist->lin[0][0])[b[k]]++;
+      (&hist->log[0][0])[e[k]]++;
+   }
+}
+
+/**
+ * Sum of squares of the lengths in the 32 bit lanes of lo and hi, in 64 bit lanes
+ */
+__attribute__((target("avx2"), always_inline))
+static inline __m256i ppi_sq_avx2(__m256i lo, __m256i hi)
+{
+   __m256i even = _mm256_add_epi64(_mm256_mul_epu32(lo, lo), _mm256_mul_epu32(hi, hi));
+   lo = _mm256_srli_epi64(lo, 32);
+   hi = _mm256_srli_epi64(hi, 32);
+   return _mm256_add_epi64(even, _mm256_add_epi64(_mm256_mul_epu32(lo, lo), _mm256_mul_epu32(hi, hi)));
+}
+
+/**
+ * AVX2 kernel, 16 packets per iteration, same scheme as the SSE4.1 one.
+ */
+__attribute__((target("avx2"), always_inline))
+static inline void ppi_len_stats_avx2_body(const uint16_t *lens, const int8_t *dirs, uint32_t cnt,
+                                           ppi_len_stats_t *out, ppi_hist_t *hist, const int with_sq,
+                                           const int with_hist)
+{
+   const __m256i zero = _mm256_setzero_si256();
+   const __m256i ones = _mm256_set1_epi8(-1);
+   const __m128i one8 = _mm_set1_epi8(1);
+   const __m256 inv = _mm256_set1_ps(with_hist ? hist->inv_width : 0);
+   const __m256i width = _mm256_set1_epi32(with_hist ? hist->width : 1);
+   const __m256i last = _mm256_set1_epi32(with_hist ? hist->bins - 1 : 0);
+   __m256i sum = zero, sum_sent = zero, sum_sq = zero, sum_sq_sent = zero;
+   __m256i min_sent = ones, min_recv = ones, max_sent = zero, max_recv = zero;
+   uint32_t sent = 0;
+   uint32_t i = 0;
+
+   for (; i + 16 <= cnt; i += 16) {
+      __m256i len = _mm256_loadu_si256((const __m256i *) (lens + i));
+      __m128i dir = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (dirs + i)), one8);
+      __m256i mask = _mm256_cvtepi8_epi16(dir);
+      sent += __builtin_popcount(_mm_movemask_epi8(dir));
+
+      __m256i lo = _mm256_unpacklo_epi16(len, zero);
+      __m256i hi = _mm256_unpackhi_epi16(len, zero);
+      sum = _mm256_add_epi32(sum, _mm256_add_epi32(lo, hi));
+      __m256i len_sent = _mm256_and_si256(len, mask);
+      __m256i lo_sent = _mm256_unpacklo_epi16(len_sent, zero);
+      __m256i hi_sent = _mm256_unpackhi_epi16(len_sent, zero);
+      sum_sent = _mm256_add_epi32(sum_sent, _mm256_add_epi32(lo_sent, hi_sent));
+      if (with_hist) {
+         ppi_hist_avx2(hist, lo, _mm256_unpacklo_epi16(mask, mask), inv, width, last);
+         ppi_hist_avx2(hist, hi, _mm256_unpackhi_epi16(mask, mask), inv, width, last);
+      }
+      if (with_sq) {
+         sum_sq = _mm256_add_epi64(sum_sq, ppi_sq_avx2(lo, hi));
+         sum_sq_sent = _mm256_add_epi64(sum_sq_sent, ppi_sq_avx2(lo_sent, hi_sent));
+      }
+
+      min_sent = _mm256_min_epu16(min_sent, _mm256_or_si256(len, _mm256_xor_si256(mask, ones)));
+      min_recv = _mm256_min_epu16(min_recv, _mm256_or_si256(len, mask));
+      max_sent = _mm256_max_epu16(max_sent, len_sent);
+      max_recv = _mm256_max_epu16(max_recv, _mm256_andnot_si256(mask, len));
+   }
+
+   uint32_t s32[8], ss32[8];
+   uint64_t sq64[4], sqs64[4];
+   uint16_t mns[16], mnr[16], mxs[16], mxr[16];
+   _mm256_storeu_si256((__m256i *) s32, sum);
+   _mm256_storeu_si256((__m256i *) ss32, sum_sent);
+   _mm256_storeu_si256((__m256i *) sq64, sum_sq);
+   _mm256_storeu_si256((__m256i *) sqs64, sum_sq_sent);
+   _mm256_storeu_si256((__m256i *) mns, min_sent);
+   _mm256_storeu_si256((__m256i *) mnr, min_recv);
+   _mm256_storeu_si256((__m256i *) mxs, max_sent);
+   _mm256_storeu_si256((__m256i *) mxr, max_recv);
+
+   *out = PPI_LEN_STATS_INIT;
+   out->sent = sent;
+   for (int k = 0; k < 8; k++) {
+      out->sum += s32[k];
+      out->bytes_sent += ss32[k];
+   }
+   out->sum_sq = sq64[0] + sq64[1] + sq64[2] + sq64[3];
+   out->sum_sq_sent = sqs64[0] + sqs64[1] + sqs64[2] + sqs64[3];
+   for (int k = 0; k < 16; k++) {
+      out->min_sent = mns[k] < out->min_sent ? mns[k] : out->min_sent;
+      out->min_recv = mnr[k] < out->min_recv ? mnr[k] : out->min_recv;
+      out->max_sent = mxs[k] > out->max_sent ? mxs[k] : out->max_sent;
+      out->max_recv = mxr[k] > out->max_recv ? mxr[k] : out->max_recv;
+   }
+   ppi_len_stats_tail(lens, dirs, i, cnt, out, hist, with_sq, with_hist);
+   ppi_len_stats_finish(out, cnt);
+}
+
+PPI_LEN_VARIANTS_OF(ppi_len_stats_avx2, __attribute__((target("avx2"))))
+
+static const ppi_len_stats_fn ppi_len_kernels_avx2[PPI_LEN_VARIANTS] = PPI_LEN_TABLE(ppi_len_stats_avx2);
+
+/**
+ * Count the flags of 32 packets, same scheme as ppi_flag_block_sse41(). All
+ * CPUs with AVX2 have the POPCNT instruction.
+ */
+__attribute__((target("avx2,popcnt"), always_inline))
+static inline void ppi_flag_block_avx2(const uint8_t *flags, const int8_t *dirs, ppi_flag_stats_t *out)
+{
+   __m256i f = _mm256_loadu_si256((const __m256i *) flags);
+   uint32_t sent = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) dirs),
+                                                          _mm256_set1_epi8(1)));
+   for (int b = 0; b < PPI_FLAG_CNT; b++) {
+      uint32_t set = _mm256_movemask_epi8(_mm256_sll_epi16(f, _mm_cvtsi32_si128(7 - b)));
+      out->total[b] += __builtin_popcount(set);
+      out->sent[b] += __builtin_popcount(set & sent);
+   }
+}
+
+/**
+ * AVX2 flag counting kernel, 32 packets per iteration, the tail as with SSE4.1.
+ */
+__attribute__((target("avx2,popcnt")))
+static void ppi_flag_stats_avx2(const uint8_t *flags, const int8_t *dirs, uint32_t cnt, ppi_flag_stats_t *out)
+{
+   uint32_t i = 0;
+
+   *out = (ppi_flag_stats_t) { 0 };
+   for (; i + 32 <= cnt; i += 32) {
+      ppi_flag_block_avx2(flags + i, dirs + i, out);
+   }
+   if (i < cnt) {
+      uint8_t tail_flags[32] = { 0 };
+      int8_t tail_dirs[32] = { 0 };
+      memcpy(tail_flags, flags + i, cnt - i);
+      memcpy(tail_dirs, dirs + i, cnt - i);
+      ppi_flag_block_avx2(tail_flags, tail_dirs, out);
+   }
+}
+
+/**
+ * AVX2 differencing kernel, 4 intervals per iteration. Timestamps are
+ * compared as unsigned numbers (sign bit flipped) for the absolute value,
+ * seconds and fraction are scaled by 32 bit multiplications. Intervals are
+ * below 2^52 us, so the minimum and maximum can use signed comparisons.
+ * There is no SSE4.1 variant, 64 bit comparisons need SSE4.2.
+ */
+__attribute__((target("avx2")))
+static void ppi_iat_avx2(const uint64_t *times, uint32_t cnt, uint64_t *iat, ppi_iat_stats_t *out)
+{
+   const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+   const __m256i usec = _mm256_set1_epi64x(1000000);
+   __m256i vmin = _mm256_set1_epi64x(INT64_MAX), vmax = _mm256_setzero_si256(), sum = _mm256_setzero_si256();
+   uint32_t n = cnt > 0 ? cnt - 1 : 0;
+   uint32_t i = 0;
+
+   for (; i + 4 <= n; i += 4) {
+      // both loads precede the store, so intervals may overwrite the timestamps
+      __m256i a = _mm256_loadu_si256((const __m256i *) (times + i));
+      __m256i b = _mm256_loadu_si256((const __m256i *) (times + i + 1));
+      __m256i back = _mm256_cmpgt_epi64(_mm256_xor_si256(a, sign), _mm256_xor_si256(b, sign));
+      __m256i d = _mm256_sub_epi64(_mm256_xor_si256(_mm256_sub_epi64(b, a), back), back);
+      __m256i us = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(d, 32), usec),
+                                    _mm256_srli_epi64(_mm256_mul_epu32(d, usec), 32));
+      _mm256_storeu_si256((__m256i *) (iat + i), us);
+      vmin = _mm256_blendv_epi8(vmin, us, _mm256_cmpgt_epi64(vmin, us));
+      vmax = _mm256_blendv_epi8(vmax, us, _mm256_cmpgt_epi64(us, vmax));
+      sum = _mm256_add_epi64(sum, us);
+   }
+
+   uint64_t mn[4], mx[4], s[4];
+   _mm256_storeu_si256((__m256i *) mn, vmin);
+   _mm256_storeu_si256((__m256i *) mx, vmax);
+   _mm256_storeu_si256((__m256i *) s, sum);
+
+   *out = (ppi_iat_stats_t) { .cnt = n, .min = UINT64_MAX };
+   for (int k = 0; k < 4; k++) {
+      out->min = mn[k] < out->min ? mn[k] : out->min;
+      out->max = mx[k] > out->max ? mx[k] : out->max;
+      out->sum += s[k];
+   }
+   ppi_iat_tail(times, i, n, iat, out);
+   ppi_iat_finish(out);
+}
+
+#endif
+
+/**
+ * Use the kernels of one instruction set
+ */
+static void ppi_kernels_select(const ppi_len_stats_fn *kernels, ppi_iat_fn iat, ppi_flag_fn flag)
+{
+   for (int v = 0; v < PPI_LEN_VARIANTS; v++) {
+      ppi_len_kernels[v] = kernels[v];
+   }
+   ppi_iat = iat;
+   ppi_flag_stats = flag;
+}
+
+double ppi_xlog2x_table[PPI_XLOG2X_MAX];
+
+const char *ppi_kernels_init(void)
+{
+   ppi_xlog2x_table[0] = 0;
+   for (uint32_t x = 1; x < PPI_XLOG2X_MAX; x++) {
+      ppi_xlog2x_table[x] = x * log2(x);
+   }
+#ifdef PPI_KERNELS_X86
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2")) {
+      ppi_kernels_select(ppi_len_kernels_avx2, ppi_iat_avx2, ppi_flag_stats_avx2);
+      return "AVX2";
+   }
+   if (__builtin_cpu_supports("sse4.1")) {
+      ppi_kernels_select(ppi_len_kernels_sse41, ppi_iat_scalar, ppi_flag_stats_sse41);
+      return "SSE4.1";
+   }
+#endif
+   ppi_kernels_select(ppi_len_kernels_scalar, ppi_iat_scalar, ppi_flag_stats_scalar);
+   return "scalar";
+}
@@ -0,0 +1,248 @@
+/**
+ * \file ppi_kernels.h
+ * \brief Vectorized reductions over PPI (per packet information) arrays.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef _PPI_KERNELS_H_
+#define _PPI_KERNELS_H_
+
+#include <stdint.h>
+#include <math.h>
+#include <string.h>
+
+/**
+ * Element i of a PPI_PKT_LENGTHS array. The PPI_PKT_* arrays start at any
+ * offset of the variable length part of a record, so their elements are read
+ * by memcpy() (a plain unaligned load) rather than through the typed pointer.
+ */
+static inline uint16_t ppi_len_at(const uint16_t *lens, uint32_t i)
+{
+   uint16_t len;
+   memcpy(&len, (const uint8_t *) lens + (size_t) i * sizeof(len), sizeof(len));
+   return len;
+}
+
+/**
+ * Element i of a PPI_PKT_TIMES array (UniRec ur_time_t), see ppi_len_at()
+ */
+static inline uint64_t ppi_time_at(const uint64_t *times, uint32_t i)
+{
+   uint64_t t;
+   memcpy(&t, (const uint8_t *) times + (size_t) i * sizeof(t), sizeof(t));
+   return t;
+}
+
+/**
+ * Reductions over packet lengths and directions of one flow, overall and per
+ * direction. Packets with direction 1 are sent, all others are received.
+ */
+typedef struct ppi_len_stats_s {
+   uint32_t sent;        ///< number of sent packets
+   uint32_t recv;        ///< number of received packets
+   uint64_t bytes_sent;  ///< sum of lengths of sent packets
+   uint64_t bytes_recv;  ///< sum of lengths of received packets
+   uint64_t sum;         ///< sum of all lengths
+   uint64_t sum_sq;      ///< sum of squared lengths
+   uint64_t sum_sq_sent; ///< sum of squared lengths of sent packets
+   uint64_t sum_sq_recv; ///< sum of squared lengths of received packets
+   uint16_t min;         ///< minimal length, 0 for empty arrays
+   uint16_t max;         ///< maximal length
+   uint16_t min_sent;    ///< minimal length of sent packets, 0 without them
+   uint16_t max_sent;    ///< maximal length of sent packets
+   uint16_t min_recv;    ///< minimal length of received packets, 0 without them
+   uint16_t max_recv;    ///< maximal length of received packets
+} ppi_len_stats_t;
+
+/**
+ * Upper limit of the number of fixed width bins of a length histogram
+ */
+#define PPI_HIST_BINS_MAX 64
+
+/**
+ * Number of logarithmic bins, bin k counts lengths in [2^k, 2^(k+1)) (bin 0 also length 0)
+ */
+#define PPI_LOG_BINS 16
+
+/**
+ * Packet length histograms of sent ([0]) and received ([1]) packets. The
+ * caller sets the bins and clears the counters.
+ */
+typedef struct ppi_hist_s {
+   uint32_t bins;                      ///< fixed width bins, the last one also counts all longer packets
+   uint32_t width;                     ///< width of a fixed bin in bytes
+   float inv_width;                    ///< 1 / width, the vectorized kernels divide by multiplication
+   uint16_t lin[2][PPI_HIST_BINS_MAX]; ///< fixed width histograms
+   uint16_t log[2][PPI_LOG_BINS];      ///< logarithmic histograms
+} ppi_hist_t;
+
+typedef void (*ppi_len_stats_fn)(const uint16_t *lens, const int8_t *dirs, uint32_t cnt, ppi_len_stats_t *out,
+                                 ppi_hist_t *hist);
+
+/**
+ * Variants of the length/direction reduction kernel, indexed by a combination of the flags
+ */
+#define PPI_LEN_SQ 1   ///< compute the sums of squares (they stay 0 otherwise)
+#define PPI_LEN_HIST 2 ///< fill the histograms (hist is not used otherwise)
+#define PPI_LEN_VARIANTS 4
+
+/**
+ * Kernels selected by ppi_kernels_init(), the scalar ones until then.
+ */
+extern ppi_len_stats_fn ppi_len_kernels[PPI_LEN_VARIANTS];
+
+/**
+ * Length/direction reduction of cnt packets, the flags select what is computed besides the basic sums
+ */
+static inline void ppi_len_stats(const uint16_t *lens, const int8_t *dirs, uint32_t cnt, ppi_len_stats_t *out,
+                                 ppi_hist_t *hist, uint32_t flags)
+{
+   ppi_len_kernels[flags](lens, dirs, cnt, out, hist);
+}
+
+/**
+ * Reductions over the intervals between packet timestamps (UniRec ur_time_t,
+ * 32.32 fixed point seconds), in microseconds
+ */
+typedef struct ppi_iat_stats_s {
+   uint32_t cnt; ///< number of intervals, one less than the number of timestamps
+   uint64_t min; ///< shortest interval, 0 without intervals
+   uint64_t max; ///< longest interval
+   uint64_t sum; ///< sum of all intervals
+} ppi_iat_stats_t;
+
+/**
+ * Differencing kernel: iat[i] = |times[i + 1] - times[i]| in microseconds for
+ * the cnt - 1 intervals of cnt timestamps, with their minimum, maximum and
+ * sum. The intervals may be written over the timestamps (iat == times).
+ */
+typedef void (*ppi_iat_fn)(const uint64_t *times, uint32_t cnt, uint64_t *iat, ppi_iat_stats_t *out);
+
+/**
+ * Kernel selected by ppi_kernels_init(), the scalar one until then.
+ */
+extern ppi_iat_fn ppi_iat;
+
+/**
+ * Scalar differencing kernel
+ */
+void ppi_iat_scalar(const uint64_t *times, uint32_t cnt, uint64_t *iat, ppi_iat_stats_t *out);
+
+/**
+ * Interval between two timestamps in microseconds: whole seconds and the
+ * fraction are converted separately, so no product overflows.
+ */
+static inline uint64_t ppi_timediff_us(uint64_t a, uint64_t b)
+{
+   uint64_t d = a > b ? a - b : b - a;
+   return (d >> 32) * 1000000 + (((d & 0xffffffff) * 1000000) >> 32);
+}
+
+/**
+ * TCP flags of PPI_PKT_FLAGS, counted by bit index
+ */
+#define PPI_FLAG_FIN 0x01
+#define PPI_FLAG_SYN 0x02
+#define PPI_FLAG_RST 0x04
+#define PPI_FLAG_PSH 0x08
+#define PPI_FLAG_ACK 0x10
+#define PPI_FLAG_URG 0x20
+#define PPI_FLAG_CNT 6
+
+/**
+ * Numbers of packets with each of the flags, indexed by the bit of the flag
+ */
+typedef struct ppi_flag_stats_s {
+   uint32_t total[PPI_FLAG_CNT]; ///< all packets
+   uint32_t sent[PPI_FLAG_CNT];  ///< sent packets (direction 1), received are the rest
+} ppi_flag_stats_t;
+
+/**
+ * Flag counting kernel over the TCP flags and directions of cnt packets
+ */
+typedef void (*ppi_flag_fn)(const uint8_t *flags, const int8_t *dirs, uint32_t cnt, ppi_flag_stats_t *out);
+
+/**
+ * Kernel selected by ppi_kernels_init(), the scalar one until then.
+ */
+extern ppi_flag_fn ppi_flag_stats;
+
+/**
+ * Scalar flag counting kernel
+ */
+void ppi_flag_stats_scalar(const uint8_t *flags, const int8_t *dirs, uint32_t cnt, ppi_flag_stats_t *out);
+
+/**
+ * Table of x * log2(x) for counts below PPI_XLOG2X_MAX, filled by
+ * ppi_kernels_init(). Entropies of histograms are computed from it without
+ * calling log() per element.
+ */
+#define PPI_XLOG2X_MAX 1024
+extern double ppi_xlog2x_table[PPI_XLOG2X_MAX];
+
+/**
+ * x * log2(x), 0 for 0
+ */
+static inline double ppi_xlog2x(uint32_t x)
+{
+   return x < PPI_XLOG2X_MAX ? ppi_xlog2x_table[x] : x * log2(x);
+}
+
+/**
+ * Shannon entropy in bits of a distribution of total items, given
+ * sum_xlog2x = sum of ppi_xlog2x(count) over its bins:
+ * H = log2(total) - sum(count * log2(count)) / total.
+ */
+static inline double ppi_entropy(uint32_t total, double sum_xlog2x)
+{
+   return total == 0 ? 0 : (ppi_xlog2x(total) - sum_xlog2x) / total;
+}
+
+/**
+ * Select the best kernels supported by the CPU. Returns name of the selected instruction set.
+ */
+const char *ppi_kernels_init(void);
+
+/**
+ * Scalar kernels, indexed as ppi_len_kernels
+ */
+extern const ppi_len_stats_fn ppi_len_kernels_scalar[PPI_LEN_VARIANTS];
+
+#endif
@@ -0,0 +1,105 @@
+/**
+ * \file shard.h
+ * \brief Routing of records to output interfaces by a hash of their IP addresses.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef _SHARD_H_
+#define _SHARD_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <unirec/unirec.h>
+
+/**
+ * Field(s) of the flow key deciding the output interface
+ */
+typedef enum {
+   SHARD_KEY_SRC_IP,  ///< source address
+   SHARD_KEY_DST_IP,  ///< destination address
+   SHARD_KEY_IP_PAIR  ///< both addresses, symmetric - both directions of a biflow get the same output
+} shard_key_t;
+
+/**
+ * Parse a shard key name (SRC_IP, DST_IP or IP_PAIR).
+ * Returns 0 on success, -1 for an unknown name (an error is printed).
+ */
+int shard_key_parse(const char *name, shard_key_t *key);
+
+/**
+ * 64 bit hash of an IP address (both halves combined and mixed by the
+ * SplitMix64 finalizer, so every bit of the hash depends on all address bits
+ * and any bit range can be used as an index)
+ */
+static inline uint64_t shard_ip_hash(const ip_addr_t *ip)
+{
+   uint64_t lo, hi;
+   memcpy(&lo, ip, sizeof(lo));
+   memcpy(&hi, (const uint8_t *) ip + sizeof(lo), sizeof(hi));
+   uint64_t h = lo ^ (hi * 0x9e3779b97f4a7c15ULL);
+   h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+   h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+   return h ^ (h >> 31);
+}
+
+/**
+ * Shard of a record with the given addresses out of shard_cnt, the hash is
+ * mapped to the range by multiplication instead of a modulo.
+ */
+static inline uint32_t shard_of(shard_key_t key, uint32_t shard_cnt, const ip_addr_t *src, const ip_addr_t *dst)
+{
+   uint64_t h;
+
+   switch (key) {
+   case SHARD_KEY_SRC_IP:
+      h = shard_ip_hash(src);
+      break;
+   case SHARD_KEY_DST_IP:
+      h = shard_ip_hash(dst);
+      break;
+   default:
+      // Sum does not depend on the order of the addresses
+      h = shard_ip_hash(src) + shard_ip_hash(dst);
+      break;
+   }
+   return (uint32_t) (((h >> 32) * shard_cnt) >> 32);
+}
+
+#endif
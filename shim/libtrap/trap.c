@@ -0,0 +1,516 @@
+/**
+ * \file trap.c
+ * \brief Minimal in-tree stand-in for libtrap.
+ *
+ * File framing used by the `f` interface type:
+ *  - 8 byte magic "TRAPSHM1",
+ *  - records as uint16 size (host byte order) followed by size bytes of data,
+ *  - size 0xffff introduces a format frame: uint16 length and the UniRec
+ *    template string, all following records use that format.
+ *
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
+#include "trap.h"
+
+#define SHIM_MAGIC "TRAPSHM1"
+#define SHIM_MAGIC_LEN 8
+#define SHIM_FMT_FRAME 0xffff
+
+const char *trap_last_error_msg = "No error";
+int trap_last_error = TRAP_E_OK;
+
+typedef struct shim_ifc_s {
+   char type;
+   pthread_mutex_t lock;
+   // input
+   unsigned char *buf;
+   size_t buf_size;
+   size_t pos;
+   uint32_t repeat;
+   uint32_t round;
+   int eod_sent;
+   char *req_fmt;
+   char *fmt;
+   // output
+   FILE *fp;
+   char *out_fmt;
+   int fmt_written;
+} shim_ifc_t;
+
+static shim_ifc_t *in_ifcs = NULL;
+static shim_ifc_t *out_ifcs = NULL;
+static int num_in = 0;
+static int num_out = 0;
+static int verbose = -1;
+static volatile int terminated = 0;
+
+static int set_error(int code, const char *msg)
+{
+   trap_last_error = code;
+   trap_last_error_msg = msg;
+   return code;
+}
+
+int trap_get_verbose_level()
+{
+   return verbose;
+}
+
+trap_module_info_t *trap_create_module_info(const char *name, const char *description,
+                                            int num_ifc_in, int num_ifc_out, uint16_t param_count)
+{
+   trap_module_info_t *m = calloc(1, sizeof(*m));
+   if (m == NULL) {
+      return NULL;
+   }
+   m->name = strdup(name);
+   m->description = strdup(description);
+   m->num_ifc_in = num_ifc_in;
+   m->num_ifc_out = num_ifc_out;
+   m->num_params = param_count;
+   m->params = calloc(param_count + 1, sizeof(trap_module_info_parameter_t *));
+   return m;
+}
+
+int trap_update_module_param(trap_module_info_t *m, uint16_t param_id, char short_opt, const char *long_opt,
+                             const char *description, int req_arg, const char *arg_type)
+{
+   if (m == NULL || param_id >= m->num_params) {
+      return TRAP_E_BADPARAMS;
+   }
+   trap_module_info_parameter_t *p = calloc(1, sizeof(*p));
+   if (p == NULL) {
+      return TRAP_E_MEMORY;
+   }
+   p->short_opt = short_opt;
+   p->long_opt = strdup(long_opt);
+   p->description = strdup(description);
+   p->param_required_argument = req_arg;
+   p->argument_type = strdup(arg_type);
+   m->params[param_id] = p;
+   return TRAP_E_OK;
+}
+
+char *trap_create_getopt_string(const trap_module_info_t *m)
+{
+   char *s = calloc(2 * (m ? m->num_params : 0) + 1, 1);
+   if (s == NULL || m == NULL) {
+      return s;
+   }
+   char *p = s;
+   for (int i = 0; i < m->num_params; i++) {
+      *p++ = m->params[i]->short_opt;
+      if (m->params[i]->param_required_argument == required_argument) {
+         *p++ = ':';
+      }
+   }
+   return s;
+}
+
+void trap_free_module_info(trap_module_info_t *m)
+{
+   if (m == NULL) {
+      return;
+   }
+   for (int i = 0; i < m->num_params; i++) {
+      if (m->params[i] != NULL) {
+         free(m->params[i]->long_opt);
+         free(m->params[i]->description);
+         free(m->params[i]->argument_type);
+         free(m->params[i]);
+      }
+   }
+   free(m->params);
+   free(m->name);
+   free(m->description);
+   free(m);
+}
+
+void trap_print_help(const trap_module_info_t *m)
+{
+   printf("TRAP module, libtrap shim\n===========================================\n");
+   printf("Name: %s\nInputs: %d\nOutputs: %d\nDescription:\n  %s\n", m->name, m->num_ifc_in,
+          m->num_ifc_out, m->description);
+   if (m->num_params > 0) {
+      printf("Parameters:\n");
+   }
+   for (int i = 0; i < m->num_params; i++) {
+      const trap_module_info_parameter_t *p = m->params[i];
+      printf("  -%c  --%-20s %s [%s]\n", p->short_opt, p->long_opt, p->description, p->argument_type);
+   }
+   printf("Interface types: f:FILE[:repeat=N] (input), f:FILE (output), b: (blackhole output)\n");
+}
+
+/**
+ * Remove n arguments starting at index i from argv.
+ */
+static void remove_args(int *argc, char **argv, int i, int n)
+{
+   for (int j = i; j + n <= *argc; j++) {
+      argv[j] = argv[j + n];
+   }
+   *argc -= n;
+}
+
+int trap_parse_params(int *argc, char **argv, trap_ifc_spec_t *ifc_spec)
+{
+   const char *spec = NULL;
+   int help = 0;
+
+   ifc_spec->types = NULL;
+   ifc_spec->params = NULL;
+   for (int i = 1; i < *argc;) {
+      if (strcmp(argv[i], "-i") == 0 && i + 1 < *argc) {
+         spec = argv[i + 1];
+         remove_args(argc, argv, i, 2);
+      } else if (strncmp(argv[i], "--ifcspec=", 10) == 0) {
+         spec = argv[i] + 10;
+         remove_args(argc, argv, i, 1);
+      } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+         help = 1;
+         remove_args(argc, argv, i, (i + 1 < *argc && strcmp(argv[i + 1], "trap") == 0) ? 2 : 1);
+      } else if (strcmp(argv[i], "-v") == 0 || strcmp(argv[i], "-vv") == 0 || strcmp(argv[i], "-vvv") == 0) {
+         verbose = (int) strlen(argv[i]) - 2;
+         remove_args(argc, argv, i, 1);
+      } else {
+         i++;
+      }
+   }
+   if (help) {
+      return set_error(TRAP_E_HELP, "Help requested");
+   }
+   if (spec == NULL) {
+      return set_error(TRAP_E_BADPARAMS, "Interface specifier (option -i) not found.");
+   }
+
+   size_t cnt = 1;
+   for (const char *c = spec; *c; c++) {
+      cnt += (*c == ',');
+   }
+   ifc_spec->types = calloc(cnt + 1, 1);
+   ifc_spec->params = calloc(cnt + 1, sizeof(char *));
+   if (ifc_spec->types == NULL || ifc_spec->params == NULL) {
+      return set_error(TRAP_E_MEMORY, "Memory allocation failed");
+   }
+   char *copy = strdup(spec);
+   char *save = NULL;
+   size_t idx = 0;
+   for (char *tok = strtok_r(copy, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+      ifc_spec->types[idx] = tok[0];
+      ifc_spec->params[idx] = strdup(tok[1] == ':' ? tok + 2 : "");
+      idx++;
+   }
+   free(copy);
+   return TRAP_E_OK;
+}
+
+void trap_free_ifc_spec(trap_ifc_spec_t ifc_spec)
+{
+   if (ifc_spec.params != NULL) {
+      for (size_t i = 0; ifc_spec.types != NULL && i < strlen(ifc_spec.types); i++) {
+         free(ifc_spec.params[i]);
+      }
+   }
+   free(ifc_spec.types);
+   free(ifc_spec.params);
+}
+
+static int load_input(shim_ifc_t *ifc, const char *params)
+{
+   char *copy = strdup(params);
+   char *opt = strchr(copy, ':');
+   if (opt != NULL) {
+      *opt++ = 0;
+      if (strncmp(opt, "repeat=", 7) == 0) {
+         ifc->repeat = (uint32_t) strtoul(opt + 7, NULL, 10);
+      }
+   }
+   FILE *fp = fopen(copy, "rb");
+   free(copy);
+   if (fp == NULL) {
+      return set_error(TRAP_E_BAD_FPARAMS, "Input file could not be opened.");
+   }
+   fseek(fp, 0, SEEK_END);
+   long size = ftell(fp);
+   fseek(fp, 0, SEEK_SET);
+   ifc->buf = malloc(size > 0 ? size : 1);
+   if (ifc->buf == NULL || fread(ifc->buf, 1, size, fp) != (size_t) size || size < SHIM_MAGIC_LEN ||
+       memcmp(ifc->buf, SHIM_MAGIC, SHIM_MAGIC_LEN) != 0) {
+      fclose(fp);
+      return set_error(TRAP_E_BAD_FPARAMS, "Input file is not in the shim format.");
+   }
+   fclose(fp);
+   ifc->buf_size = size;
+   ifc->pos = SHIM_MAGIC_LEN;
+   return TRAP_E_OK;
+}
+
+int trap_init(trap_module_info_t *module_info, trap_ifc_spec_t ifc_spec)
+{
+   size_t total = strlen(ifc_spec.types);
+   if (module_info->num_ifc_in < 0 || module_info->num_ifc_out < 0 ||
+       (size_t) (module_info->num_ifc_in + module_info->num_ifc_out) != total) {
+      return set_error(TRAP_E_BADPARAMS, "Number of interfaces in -i does not match the module.");
+   }
+   num_in = module_info->num_ifc_in;
+   num_out = module_info->num_ifc_out;
+   in_ifcs = calloc(num_in + 1, sizeof(shim_ifc_t));
+   out_ifcs = calloc(num_out + 1, sizeof(shim_ifc_t));
+   if (in_ifcs == NULL || out_ifcs == NULL) {
+      return set_error(TRAP_E_MEMORY, "Memory allocation failed");
+   }
+   for (int i = 0; i < num_in; i++) {
+      shim_ifc_t *ifc = &in_ifcs[i];
+      pthread_mutex_init(&ifc->lock, NULL);
+      ifc->type = ifc_spec.types[i];
+      ifc->repeat = 1;
+      if (ifc->type != 'f') {
+         return set_error(TRAP_E_BADPARAMS, "Only the f interface type is supported for inputs.");
+      }
+      int ret = load_input(ifc, ifc_spec.params[i]);
+      if (ret != TRAP_E_OK) {
+         return ret;
+      }
+   }
+   for (int i = 0; i < num_out; i++) {
+      shim_ifc_t *ifc = &out_ifcs[i];
+      pthread_mutex_init(&ifc->lock, NULL);
+      ifc->type = ifc_spec.types[num_in + i];
+      if (ifc->type == 'f') {
+         ifc->fp = fopen(ifc_spec.params[num_in + i], "wb");
+         if (ifc->fp == NULL) {
+            return set_error(TRAP_E_BAD_FPARAMS, "Output file could not be opened.");
+         }
+         setvbuf(ifc->fp, NULL, _IOFBF, 1 << 20);
+         fwrite(SHIM_MAGIC, 1, SHIM_MAGIC_LEN, ifc->fp);
+      } else if (ifc->type != 'b') {
+         return set_error(TRAP_E_BADPARAMS, "Only the f and b interface types are supported for outputs.");
+      }
+   }
+   return set_error(TRAP_E_OK, "No error");
+}
+
+int trap_finalize()
+{
+   for (int i = 0; i < num_in; i++) {
+      free(in_ifcs[i].buf);
+      free(in_ifcs[i].req_fmt);
+      free(in_ifcs[i].fmt);
+      pthread_mutex_destroy(&in_ifcs[i].lock);
+   }
+   for (int i = 0; i < num_out; i++) {
+      if (out_ifcs[i].fp != NULL) {
+         fclose(out_ifcs[i].fp);
+      }
+      free(out_ifcs[i].out_fmt);
+      pthread_mutex_destroy(&out_ifcs[i].lock);
+   }
+   free(in_ifcs);
+   free(out_ifcs);
+   in_ifcs = out_ifcs = NULL;
+   num_in = num_out = 0;
+   return TRAP_E_OK;
+}
+
+void trap_terminate()
+{
+   terminated = 1;
+}
+
+int trap_recv(uint32_t ifcidx, const void **data, uint16_t *size)
+{
+   static const char eod = 0;
+
+   if (terminated) {
+      return set_error(TRAP_E_TERMINATED, "Terminated");
+   }
+   if (ifcidx >= (uint32_t) num_in) {
+      return set_error(TRAP_E_BAD_IFC_INDEX, "Bad interface index");
+   }
+   shim_ifc_t *ifc = &in_ifcs[ifcidx];
+   int ret = TRAP_E_OK;
+   pthread_mutex_lock(&ifc->lock);
+   while (1) {
+      if (ifc->pos + 2 > ifc->buf_size) {
+         ifc->round++;
+         if (ifc->repeat == 0 || ifc->round < ifc->repeat) {
+            ifc->pos = SHIM_MAGIC_LEN;
+            continue;
+         }
+         if (ifc->eod_sent) {
+            ret = TRAP_E_TERMINATED;
+            break;
+         }
+         // end of data is signalled by a 1 byte record, as in libtrap
+         ifc->eod_sent = 1;
+         *data = &eod;
+         *size = 1;
+         break;
+      }
+      uint16_t len;
+      memcpy(&len, ifc->buf + ifc->pos, 2);
+      ifc->pos += 2;
+      if (len == SHIM_FMT_FRAME) {
+         uint16_t fmt_len;
+         memcpy(&fmt_len, ifc->buf + ifc->pos, 2);
+         ifc->pos += 2;
+         if (ifc->fmt == NULL || strlen(ifc->fmt) != fmt_len ||
+             memcmp(ifc->fmt, ifc->buf + ifc->pos, fmt_len) != 0) {
+            free(ifc->fmt);
+            ifc->fmt = strndup((const char *) ifc->buf + ifc->pos, fmt_len);
+            ret = TRAP_E_FORMAT_CHANGED;
+         }
+         ifc->pos += fmt_len;
+         continue;
+      }
+      if (ifc->pos + len > ifc->buf_size) {
+         ifc->pos = ifc->buf_size;
+         continue;
+      }
+      if (len <= 1 && (ifc->repeat == 0 || ifc->round + 1 < ifc->repeat)) {
+         ifc->pos += len; // end of data record of the file, only the last round ends the input
+         continue;
+      }
+      *data = ifc->buf + ifc->pos;
+      *size = len;
+      ifc->pos += len;
+      break;
+   }
+   pthread_mutex_unlock(&ifc->lock);
+   if (ret == TRAP_E_TERMINATED) {
+      return set_error(ret, "End of input");
+   }
+   return ret;
+}
+
+int trap_send(uint32_t ifcidx, const void *data, uint16_t size)
+{
+   if (terminated) {
+      return set_error(TRAP_E_TERMINATED, "Terminated");
+   }
+   if (ifcidx >= (uint32_t) num_out) {
+      return set_error(TRAP_E_BAD_IFC_INDEX, "Bad interface index");
+   }
+   shim_ifc_t *ifc = &out_ifcs[ifcidx];
+   if (ifc->fp == NULL) {
+      return TRAP_E_OK;
+   }
+   pthread_mutex_lock(&ifc->lock);
+   if (!ifc->fmt_written && ifc->out_fmt != NULL) {
+      uint16_t marker = SHIM_FMT_FRAME;
+      uint16_t fmt_len = (uint16_t) strlen(ifc->out_fmt);
+      fwrite(&marker, 2, 1, ifc->fp);
+      fwrite(&fmt_len, 2, 1, ifc->fp);
+      fwrite(ifc->out_fmt, 1, fmt_len, ifc->fp);
+      ifc->fmt_written = 1;
+   }
+   int ok = size != SHIM_FMT_FRAME && fwrite(&size, 2, 1, ifc->fp) == 1 && fwrite(data, 1, size, ifc->fp) == size;
+   pthread_mutex_unlock(&ifc->lock);
+   return ok ? TRAP_E_OK : set_error(TRAP_E_IO_ERROR, "Write to output file failed");
+}
+
+void trap_send_flush(uint32_t ifcidx)
+{
+   if (ifcidx < (uint32_t) num_out && out_ifcs[ifcidx].fp != NULL) {
+      pthread_mutex_lock(&out_ifcs[ifcidx].lock);
+      fflush(out_ifcs[ifcidx].fp);
+      pthread_mutex_unlock(&out_ifcs[ifcidx].lock);
+   }
+}
+
+int trap_ifcctl(int8_t type, uint32_t ifcidx, int32_t request, ...)
+{
+   (void) request;
+   if ((type == TRAPIFC_INPUT && ifcidx >= (uint32_t) num_in) ||
+       (type == TRAPIFC_OUTPUT && ifcidx >= (uint32_t) num_out)) {
+      return set_error(TRAP_E_BAD_IFC_INDEX, "Bad interface index");
+   }
+   // Timeouts and buffering have no effect, the shim never blocks.
+   return TRAP_E_OK;
+}
+
+void trap_set_required_fmt(uint32_t in_ifc_idx, uint8_t data_type, ...)
+{
+   va_list ap;
+   va_start(ap, data_type);
+   const char *spec = data_type == TRAP_FMT_UNIREC ? va_arg(ap, const char *) : NULL;
+   va_end(ap);
+   if (in_ifc_idx < (uint32_t) num_in && spec != NULL) {
+      free(in_ifcs[in_ifc_idx].req_fmt);
+      in_ifcs[in_ifc_idx].req_fmt = strdup(spec);
+   }
+}
+
+void trap_set_data_fmt(uint32_t out_ifc_idx, uint8_t data_type, ...)
+{
+   va_list ap;
+   va_start(ap, data_type);
+   const char *spec = data_type == TRAP_FMT_UNIREC ? va_arg(ap, const char *) : NULL;
+   va_end(ap);
+   if (out_ifc_idx < (uint32_t) num_out && spec != NULL) {
+      shim_ifc_t *ifc = &out_ifcs[out_ifc_idx];
+      pthread_mutex_lock(&ifc->lock);
+      if (ifc->out_fmt == NULL || strcmp(ifc->out_fmt, spec) != 0) {
+         free(ifc->out_fmt);
+         ifc->out_fmt = strdup(spec);
+         ifc->fmt_written = 0;
+      }
+      pthread_mutex_unlock(&ifc->lock);
+   }
+}
+
+int trap_get_data_fmt(uint8_t ifc_dir, uint32_t ifc_idx, uint8_t *data_type, const char **spec)
+{
+   if (ifc_dir == TRAPIFC_INPUT && ifc_idx < (uint32_t) num_in && in_ifcs[ifc_idx].fmt != NULL) {
+      *data_type = TRAP_FMT_UNIREC;
+      *spec = in_ifcs[ifc_idx].fmt;
+      return TRAP_E_OK;
+   }
+   if (ifc_dir == TRAPIFC_OUTPUT && ifc_idx < (uint32_t) num_out && out_ifcs[ifc_idx].out_fmt != NULL) {
+      *data_type = TRAP_FMT_UNIREC;
+      *spec = out_ifcs[ifc_idx].out_fmt;
+      return TRAP_E_OK;
+   }
+   return set_error(TRAP_E_NOT_INITIALIZED, "Data format is not known");
+}
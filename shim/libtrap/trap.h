@@ -0,0 +1,247 @@
+/**
+ * \file trap.h
+ * \brief Minimal in-tree stand-in for libtrap.
+ *
+ * Implements the subset of the libtrap API used by feature_engineer_module.
+ * Supported interface types:
+ *  - `f:FILE[:repeat=N]` input  - file loaded into memory and replayed N times
+ *    (0 = until the module is stopped),
+ *  - `f:FILE` output            - records are written to a file,
+ *  - `b:` output                - blackhole, records are discarded.
+ * Files use the shim framing (see trap.c), which is produced by the shim
+ * output interface itself and by feature_engineer_bench -o. End of data
+ * records stored in a replayed file end the input in the last round only.
+ *
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef _SHIM_TRAP_H_
+#define _SHIM_TRAP_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <getopt.h>
+
+#define TRAP_E_OK 0
+#define TRAP_E_TIMEOUT 1
+#define TRAP_E_INITIALIZED 10
+#define TRAP_E_BADPARAMS 11
+#define TRAP_E_BAD_IFC_INDEX 12
+#define TRAP_E_BAD_FPARAMS 13
+#define TRAP_E_IO_ERROR 14
+#define TRAP_E_TERMINATED 15
+#define TRAP_E_NOT_SELECTED 16
+#define TRAP_E_HELP 20
+#define TRAP_E_FORMAT_CHANGED 21
+#define TRAP_E_FORMAT_MISMATCH 22
+#define TRAP_E_NEGOTIATION_FAILED 23
+#define TRAP_E_NOT_INITIALIZED 254
+#define TRAP_E_MEMORY 255
+
+#define TRAP_WAIT -1
+#define TRAP_NO_WAIT 0
+#define TRAP_HALFWAIT -2
+
+#define TRAP_FMT_UNKNOWN 0
+#define TRAP_FMT_RAW 1
+#define TRAP_FMT_UNIREC 2
+#define TRAP_FMT_JSON 3
+
+enum trap_ifc_type {
+   TRAPIFC_INPUT = 1,
+   TRAPIFC_OUTPUT = 2
+};
+
+enum trap_ifcctl_request {
+   TRAPCTL_AUTOFLUSH_TIMEOUT = 1,
+   TRAPCTL_BUFFERSWITCH = 2,
+   TRAPCTL_SETTIMEOUT = 3
+};
+
+typedef struct trap_module_info_parameter_s {
+   char short_opt;
+   char *long_opt;
+   char *description;
+   int param_required_argument;
+   char *argument_type;
+} trap_module_info_parameter_t;
+
+typedef struct trap_module_info_s {
+   char *name;
+   char *description;
+   int num_ifc_in;
+   int num_ifc_out;
+   int num_params;
+   trap_module_info_parameter_t **params;
+} trap_module_info_t;
+
+typedef struct trap_ifc_spec_s {
+   char *types;
+   char **params;
+} trap_ifc_spec_t;
+
+extern const char *trap_last_error_msg;
+extern int trap_last_error;
+
+int trap_parse_params(int *argc, char **argv, trap_ifc_spec_t *ifc_spec);
+int trap_init(trap_module_info_t *module_info, trap_ifc_spec_t ifc_spec);
+int trap_finalize();
+void trap_free_ifc_spec(trap_ifc_spec_t ifc_spec);
+void trap_print_help(const trap_module_info_t *module_info);
+void trap_terminate();
+int trap_get_verbose_level();
+
+int trap_recv(uint32_t ifcidx, const void **data, uint16_t *size);
+int trap_send(uint32_t ifcidx, const void *data, uint16_t size);
+void trap_send_flush(uint32_t ifc);
+int trap_ifcctl(int8_t type, uint32_t ifcidx, int32_t request, ...);
+
+void trap_set_required_fmt(uint32_t in_ifc_idx, uint8_t data_type, ...);
+void trap_set_data_fmt(uint32_t out_ifc_idx, uint8_t data_type, ...);
+int trap_get_data_fmt(uint8_t ifc_dir, uint32_t ifc_idx, uint8_t *data_type, const char **spec);
+
+trap_module_info_t *trap_create_module_info(const char *name, const char *description,
+                                            int num_ifc_in, int num_ifc_out, uint16_t param_count);
+int trap_update_module_param(trap_module_info_t *m, uint16_t param_id, char short_opt, const char *long_opt,
+                             const char *description, int req_arg, const char *arg_type);
+char *trap_create_getopt_string(const trap_module_info_t *m);
+void trap_free_module_info(trap_module_info_t *m);
+
+#ifndef TRAP_GETOPT
+#define TRAP_GETOPT(argc, argv, optstr, longopts) getopt_long(argc, argv, optstr, longopts, NULL)
+#endif
+
+#define TRAP_GEN_LONG_OPT_LINE(p_short_opt, p_long_opt, p_description, p_required_argument, p_argument_type) \
+   {p_long_opt, p_required_argument, 0, p_short_opt},
+#define TRAP_GEN_PARAM_COUNT(p_short_opt, p_long_opt, p_description, p_required_argument, p_argument_type) + 1
+#define TRAP_GEN_PARAM_LINE(p_short_opt, p_long_opt, p_description, p_required_argument, p_argument_type) \
+   trap_update_module_param(module_info, trap_param_id++, p_short_opt, p_long_opt, p_description, \
+                            p_required_argument, p_argument_type);
+#define TRAP_GEN_BASIC_LINE(p_name, p_description, p_input, p_output) \
+   module_info = trap_create_module_info(p_name, p_description, p_input, p_output, trap_param_count);
+
+/**
+ * Allocate module_info, long_options and module_getopt_string from the
+ * MODULE_BASIC_INFO and MODULE_PARAMS definitions.
+ */
+#define INIT_MODULE_INFO_STRUCT(BASIC, PARAMS) \
+   static struct option long_options[] __attribute__((used)) = { PARAMS(TRAP_GEN_LONG_OPT_LINE) {0, 0, 0, 0} }; \
+   uint16_t trap_param_count = 0 PARAMS(TRAP_GEN_PARAM_COUNT); \
+   uint16_t trap_param_id = 0; \
+   BASIC(TRAP_GEN_BASIC_LINE) \
+   PARAMS(TRAP_GEN_PARAM_LINE) \
+   (void) trap_param_id; \
+   char *module_getopt_string = trap_create_getopt_string(module_info);
+
+#define FREE_MODULE_INFO_STRUCT(BASIC, PARAMS) \
+   { \
+      trap_free_module_info(module_info); \
+      module_info = NULL; \
+      free(module_getopt_string); \
+      module_getopt_string = NULL; \
+   }
+
+#define TRAP_DEFAULT_INITIALIZATION(argc, argv, module_info) \
+   { \
+      trap_ifc_spec_t ifc_spec; \
+      int ret = trap_parse_params(&argc, argv, &ifc_spec); \
+      if (ret != TRAP_E_OK) { \
+         if (ret == TRAP_E_HELP) { \
+            trap_print_help(&module_info); \
+            return 0; \
+         } \
+         trap_free_ifc_spec(ifc_spec); \
+         fprintf(stderr, "ERROR in parsing of parameters for TRAP: %s\n", trap_last_error_msg); \
+         return 1; \
+      } \
+      ret = trap_init(&module_info, ifc_spec); \
+      if (ret != TRAP_E_OK) { \
+         trap_free_ifc_spec(ifc_spec); \
+         fprintf(stderr, "ERROR in TRAP initialization: %s\n", trap_last_error_msg); \
+         return 1; \
+      } \
+      trap_free_ifc_spec(ifc_spec); \
+   }
+
+#define TRAP_DEFAULT_FINALIZATION() trap_finalize();
+
+#define TRAP_DEFAULT_SIGNAL_HANDLER(stop_cmd) \
+   void trap_default_signal_handler(int signal) \
+   { \
+      if (signal == SIGTERM || signal == SIGINT) { \
+         stop_cmd; \
+         trap_terminate(); \
+      } \
+   }
+
+#define TRAP_REGISTER_DEFAULT_SIGNAL_HANDLER() \
+   signal(SIGTERM, trap_default_signal_handler); \
+   signal(SIGINT, trap_default_signal_handler);
+
+#define TRAP_DEFAULT_RECV_ERROR_HANDLING(ret, timeout_cmd, fail_cmd) \
+   if ((ret) != TRAP_E_OK) { \
+      if ((ret) == TRAP_E_TIMEOUT) { \
+         timeout_cmd; \
+      } else if ((ret) == TRAP_E_TERMINATED) { \
+         fail_cmd; \
+      } else if ((ret) == TRAP_E_FORMAT_MISMATCH) { \
+         fprintf(stderr, "trap_recv() error: output and input interfaces are incompatible.\n"); \
+         fail_cmd; \
+      } else { \
+         fprintf(stderr, "Error: trap_recv() returned %i (%s)\n", (ret), trap_last_error_msg); \
+         fail_cmd; \
+      } \
+   }
+
+#define TRAP_DEFAULT_SEND_ERROR_HANDLING(ret, timeout_cmd, fail_cmd) \
+   if ((ret) != TRAP_E_OK) { \
+      if ((ret) == TRAP_E_TIMEOUT) { \
+         timeout_cmd; \
+      } else if ((ret) == TRAP_E_TERMINATED) { \
+         fail_cmd; \
+      } else { \
+         fprintf(stderr, "Error: trap_send() returned %i (%s)\n", (ret), trap_last_error_msg); \
+         fail_cmd; \
+      } \
+   }
+
+#endif
@@ -0,0 +1,116 @@
+/**
+ * \file ipaddr.h
+ * \brief Minimal stand-in for the UniRec IP address type.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef _SHIM_UR_IPADDR_H_
+#define _SHIM_UR_IPADDR_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <arpa/inet.h>
+
+/**
+ * IPv4 and IPv6 addresses share one 16 byte layout, IPv4 is stored in ui32[2]
+ * with ui64[0] zeroed and ui32[3] set to all ones (same as real UniRec).
+ */
+typedef union {
+   uint8_t bytes[16];
+   uint32_t ui32[4];
+   uint64_t ui64[2];
+} ip_addr_t;
+
+static inline int ip_is4(const ip_addr_t *addr)
+{
+   return addr->ui64[0] == 0 && addr->ui32[3] == 0xffffffff;
+}
+
+static inline int ip_is6(const ip_addr_t *addr)
+{
+   return !ip_is4(addr);
+}
+
+static inline uint32_t ip_get_v4_as_int(const ip_addr_t *addr)
+{
+   return ntohl(addr->ui32[2]);
+}
+
+static inline ip_addr_t ip_from_int(uint32_t i)
+{
+   ip_addr_t a;
+   a.ui64[0] = 0;
+   a.ui32[2] = htonl(i);
+   a.ui32[3] = 0xffffffff;
+   return a;
+}
+
+static inline ip_addr_t ip_from_4_bytes_be(const char b[4])
+{
+   ip_addr_t a;
+   a.ui64[0] = 0;
+   memcpy(&a.ui32[2], b, 4);
+   a.ui32[3] = 0xffffffff;
+   return a;
+}
+
+static inline ip_addr_t ip_from_16_bytes_be(const char b[16])
+{
+   ip_addr_t a;
+   memcpy(a.bytes, b, 16);
+   return a;
+}
+
+static inline int ip_cmp(const ip_addr_t *a, const ip_addr_t *b)
+{
+   return memcmp(a, b, sizeof(ip_addr_t));
+}
+
+static inline void ip_to_str(const ip_addr_t *addr, char *str)
+{
+   if (ip_is4(addr)) {
+      inet_ntop(AF_INET, &addr->ui32[2], str, INET6_ADDRSTRLEN);
+   } else {
+      inet_ntop(AF_INET6, addr->bytes, str, INET6_ADDRSTRLEN);
+   }
+}
+
+#endif
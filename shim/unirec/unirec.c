@@ -0,0 +1,533 @@
+/**
+ * \file unirec.c
+ * \brief Minimal in-tree stand-in for the UniRec library.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <ctype.h>
+#include "unirec.h"
+
+static const char *type_names[] = {
+   "string", "bytes", "char", "uint8", "int8", "uint16", "int16", "uint32", "int32", "uint64", "int64",
+   "float", "double", "ipaddr", "macaddr", "time", "uint8*", "int8*", "uint16*", "int16*", "uint32*",
+   "int32*", "uint64*", "int64*", "float*", "double*", "ipaddr*", "macaddr*", "time*"
+};
+
+static const short type_sizes[] = {
+   -1, -1, 1, 1, 1, 2, 2, 4, 4, 8, 8, 4, 8, 16, 6, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+#define TYPE_COUNT ((int) (sizeof(type_sizes) / sizeof(type_sizes[0])))
+
+int ur_size_of(ur_field_type_t type)
+{
+   return (int) type < TYPE_COUNT ? type_sizes[type] : -1;
+}
+
+const char *ur_get_type_name(ur_field_type_t type)
+{
+   return (int) type < TYPE_COUNT ? type_names[type] : "unknown";
+}
+
+ur_field_type_t ur_array_get_elem_type(ur_field_id_t field_id)
+{
+   ur_field_type_t t = ur_get_type(field_id);
+   return t >= UR_TYPE_A_UINT8 ? (ur_field_type_t) (t - UR_TYPE_A_UINT8 + UR_TYPE_UINT8) : UR_TYPE_UINT8;
+}
+
+static int type_by_name(const char *name, size_t len)
+{
+   for (int i = 0; i < TYPE_COUNT; i++) {
+      if (strlen(type_names[i]) == len && strncmp(type_names[i], name, len) == 0) {
+         return i;
+      }
+   }
+   return -1;
+}
+
+int ur_get_id_by_name(const char *name)
+{
+   for (int i = 0; i < ur_field_specs.ur_last_id; i++) {
+      if (strcmp(ur_field_specs.ur_field_names[i], name) == 0) {
+         return i;
+      }
+   }
+   return UR_INVALID_FIELD;
+}
+
+/**
+ * Switch field specification arrays from the static ones to heap copies that can grow.
+ */
+static int specs_make_dynamic(int needed)
+{
+   ur_field_specs_t *s = &ur_field_specs;
+   if (s->initialized && s->ur_allocated_fields >= needed) {
+      return 0;
+   }
+   int alloc = s->ur_allocated_fields > 0 ? s->ur_allocated_fields : 16;
+   while (alloc < needed) {
+      alloc *= 2;
+   }
+   char **names = malloc(alloc * sizeof(char *));
+   short *sizes = malloc(alloc * sizeof(short));
+   ur_field_type_t *types = malloc(alloc * sizeof(ur_field_type_t));
+   if (names == NULL || sizes == NULL || types == NULL) {
+      free(names);
+      free(sizes);
+      free(types);
+      return -1;
+   }
+   for (int i = 0; i < s->ur_last_id; i++) {
+      names[i] = s->initialized ? s->ur_field_names[i] : strdup(s->ur_field_names[i]);
+      sizes[i] = s->ur_field_sizes[i];
+      types[i] = s->ur_field_types[i];
+   }
+   if (s->initialized) {
+      free(s->ur_field_names);
+      free(s->ur_field_sizes);
+      free(s->ur_field_types);
+   }
+   s->ur_field_names = names;
+   s->ur_field_sizes = sizes;
+   s->ur_field_types = types;
+   s->ur_allocated_fields = alloc;
+   s->initialized = 1;
+   return 0;
+}
+
+int ur_define_field(const char *name, ur_field_type_t type)
+{
+   int id = ur_get_id_by_name(name);
+   if (id != UR_INVALID_FIELD) {
+      return ur_get_type(id) == type ? id : UR_INVALID_FIELD;
+   }
+   if (specs_make_dynamic(ur_field_specs.ur_last_id + 1) != 0) {
+      return UR_INVALID_FIELD;
+   }
+   id = ur_field_specs.ur_last_id++;
+   ur_field_specs.ur_field_names[id] = strdup(name);
+   ur_field_specs.ur_field_sizes[id] = ur_size_of(type);
+   ur_field_specs.ur_field_types[id] = type;
+   return id;
+}
+
+/**
+ * Record order: static fields by size (descending) and name, then dynamic fields by name.
+ */
+static int field_cmp(const void *a, const void *b)
+{
+   ur_field_id_t x = *(const ur_field_id_t *) a;
+   ur_field_id_t y = *(const ur_field_id_t *) b;
+   int sx = ur_get_size(x), sy = ur_get_size(y);
+   if ((sx < 0) != (sy < 0)) {
+      return sx < 0 ? 1 : -1;
+   }
+   if (sx != sy) {
+      return sy - sx;
+   }
+   return strcmp(ur_get_name(x), ur_get_name(y));
+}
+
+static void set_errstr(char **errstr, const char *msg)
+{
+   if (errstr != NULL) {
+      *errstr = strdup(msg);
+   }
+}
+
+/**
+ * Parse comma separated "NAME" or "type NAME" items, defining typed ones.
+ */
+static int parse_fields(const char *fields, ur_field_id_t *ids, int max, char **errstr)
+{
+   int cnt = 0;
+   const char *p = fields;
+   while (p != NULL && *p) {
+      const char *end = strchr(p, ',');
+      size_t len = end ? (size_t) (end - p) : strlen(p);
+      while (len > 0 && isspace((unsigned char) *p)) {
+         p++;
+         len--;
+      }
+      while (len > 0 && isspace((unsigned char) p[len - 1])) {
+         len--;
+      }
+      if (len > 0) {
+         char item[256];
+         if (len >= sizeof(item)) {
+            set_errstr(errstr, "Field specification is too long.");
+            return -1;
+         }
+         memcpy(item, p, len);
+         item[len] = 0;
+         char *space = strchr(item, ' ');
+         int id;
+         if (space != NULL) {
+            int type = type_by_name(item, space - item);
+            if (type < 0) {
+               set_errstr(errstr, "Unknown field type.");
+               return -1;
+            }
+            id = ur_define_field(space + 1, (ur_field_type_t) type);
+         } else {
+            id = ur_get_id_by_name(item);
+         }
+         if (id == UR_INVALID_FIELD) {
+            set_errstr(errstr, "Unknown field or conflicting field type.");
+            return -1;
+         }
+         int dup = 0;
+         for (int i = 0; i < cnt; i++) {
+            dup |= ids[i] == id;
+         }
+         if (!dup) {
+            if (cnt >= max) {
+               set_errstr(errstr, "Too many fields.");
+               return -1;
+            }
+            ids[cnt++] = (ur_field_id_t) id;
+         }
+      }
+      p = end ? end + 1 : NULL;
+   }
+   return cnt;
+}
+
+static ur_template_t *create_template_from_ids(ur_field_id_t *ids, int count)
+{
+   ur_template_t *t = calloc(1, sizeof(ur_template_t));
+   if (t == NULL) {
+      return NULL;
+   }
+   t->offset_size = ur_field_specs.ur_last_id;
+   t->offset = malloc(t->offset_size * sizeof(uint16_t) + 1);
+   t->ids = malloc(count * sizeof(ur_field_id_t) + 1);
+   if (t->offset == NULL || t->ids == NULL) {
+      ur_free_template(t);
+      return NULL;
+   }
+   memset(t->offset, 0xff, t->offset_size * sizeof(uint16_t));
+   memcpy(t->ids, ids, count * sizeof(ur_field_id_t));
+   qsort(t->ids, count, sizeof(ur_field_id_t), field_cmp);
+   t->count = count;
+   t->first_dynamic = -1;
+   uint16_t off = 0;
+   for (int i = 0; i < count; i++) {
+      ur_field_id_t id = t->ids[i];
+      t->offset[id] = off;
+      if (ur_is_varlen(id)) {
+         if (t->first_dynamic < 0) {
+            t->first_dynamic = i;
+         }
+         off += 4;
+      } else {
+         off += ur_get_size(id);
+      }
+   }
+   t->static_size = off;
+   return t;
+}
+
+ur_template_t *ur_create_template(const char *fields, char **errstr)
+{
+   int max = ur_field_specs.ur_last_id + 256;
+   ur_field_id_t *ids = malloc(max * sizeof(ur_field_id_t));
+   if (ids == NULL) {
+      set_errstr(errstr, "Memory allocation failed.");
+      return NULL;
+   }
+   int cnt = parse_fields(fields, ids, max, errstr);
+   ur_template_t *t = cnt < 0 ? NULL : create_template_from_ids(ids, cnt);
+   free(ids);
+   return t;
+}
+
+ur_template_t *ur_create_input_template(int ifc, const char *fields, char **errstr)
+{
+   ur_template_t *t = ur_create_template(fields, errstr);
+   if (t == NULL) {
+      return NULL;
+   }
+   if (ur_set_input_template(ifc, t) != 0) {
+      ur_free_template(t);
+      return NULL;
+   }
+   return t;
+}
+
+ur_template_t *ur_create_output_template(int ifc, const char *fields, char **errstr)
+{
+   ur_template_t *t = ur_create_template(fields, errstr);
+   if (t == NULL) {
+      return NULL;
+   }
+   if (ur_set_output_template(ifc, t) != 0) {
+      ur_free_template(t);
+      return NULL;
+   }
+   return t;
+}
+
+ur_template_t *ur_create_bidirectional_template(int ifc_in, int ifc_out, const char *fields, char **errstr)
+{
+   ur_template_t *t = ur_create_input_template(ifc_in, fields, errstr);
+   if (t == NULL) {
+      return NULL;
+   }
+   if (ur_set_output_template(ifc_out, t) != 0) {
+      ur_free_template(t);
+      return NULL;
+   }
+   t->direction = UR_TMPLT_DIRECTION_BI;
+   return t;
+}
+
+int ur_set_input_template(int ifc, ur_template_t *tmplt)
+{
+   char *spec = ur_template_string(tmplt);
+   if (spec == NULL) {
+      return -1;
+   }
+   trap_set_required_fmt(ifc, TRAP_FMT_UNIREC, spec);
+   free(spec);
+   tmplt->direction = tmplt->direction == UR_TMPLT_DIRECTION_OUT ? UR_TMPLT_DIRECTION_BI : UR_TMPLT_DIRECTION_IN;
+   return 0;
+}
+
+int ur_set_output_template(int ifc, ur_template_t *tmplt)
+{
+   char *spec = ur_template_string(tmplt);
+   if (spec == NULL) {
+      return -1;
+   }
+   trap_set_data_fmt(ifc, TRAP_FMT_UNIREC, spec);
+   free(spec);
+   tmplt->direction = tmplt->direction == UR_TMPLT_DIRECTION_IN ? UR_TMPLT_DIRECTION_BI : UR_TMPLT_DIRECTION_OUT;
+   tmplt->ifc_out = ifc;
+   return 0;
+}
+
+ur_template_t *ur_define_fields_and_update_template(const char *ifc_data_fmt, ur_template_t *tmplt)
+{
+   ur_template_t *t = ur_create_template(ifc_data_fmt, NULL);
+   if (t == NULL) {
+      return NULL;
+   }
+   if (tmplt != NULL) {
+      t->direction = tmplt->direction;
+      t->ifc_out = tmplt->ifc_out;
+      ur_free_template(tmplt);
+   }
+   if (t->direction == UR_TMPLT_DIRECTION_BI) {
+      trap_set_data_fmt(t->ifc_out, TRAP_FMT_UNIREC, ifc_data_fmt);
+   }
+   return t;
+}
+
+char *ur_template_string_delimiter(const ur_template_t *tmplt, int delimiter)
+{
+   size_t size = 1;
+   for (int i = 0; i < tmplt->count; i++) {
+      size += strlen(ur_get_type_name(ur_get_type(tmplt->ids[i]))) + strlen(ur_get_name(tmplt->ids[i])) + 2;
+   }
+   char *s = malloc(size);
+   if (s == NULL) {
+      return NULL;
+   }
+   char *p = s;
+   *p = 0;
+   for (int i = 0; i < tmplt->count; i++) {
+      p += sprintf(p, "%s%s %s", i ? (char[]) {(char) delimiter, 0} : "",
+                   ur_get_type_name(ur_get_type(tmplt->ids[i])), ur_get_name(tmplt->ids[i]));
+   }
+   return s;
+}
+
+char *ur_template_string(const ur_template_t *tmplt)
+{
+   return ur_template_string_delimiter(tmplt, ',');
+}
+
+char *ur_cpy_string(const char *str)
+{
+   return strdup(str);
+}
+
+void ur_free_template(ur_template_t *tmplt)
+{
+   if (tmplt == NULL) {
+      return;
+   }
+   free(tmplt->offset);
+   free(tmplt->ids);
+   free(tmplt);
+}
+
+ur_field_id_t ur_iter_fields(const ur_template_t *tmplt, ur_field_id_t id)
+{
+   for (int i = id + 1; i < tmplt->offset_size; i++) {
+      if (tmplt->offset[i] != UR_INVALID_OFFSET) {
+         return (ur_field_id_t) i;
+      }
+   }
+   return UR_ITER_END;
+}
+
+ur_field_id_t ur_iter_fields_record_order(const ur_template_t *tmplt, int index)
+{
+   return index < tmplt->count ? tmplt->ids[index] : UR_ITER_END;
+}
+
+void *ur_create_record(const ur_template_t *tmplt, uint16_t max_var_size)
+{
+   size_t size = (size_t) tmplt->static_size + max_var_size;
+   if (size > UR_MAX_SIZE) {
+      size = UR_MAX_SIZE;
+   }
+   return calloc(1, size ? size : 1);
+}
+
+void ur_free_record(void *record)
+{
+   free(record);
+}
+
+void ur_clear_varlen(const ur_template_t *tmplt, void *rec)
+{
+   if (tmplt->first_dynamic < 0) {
+      return;
+   }
+   for (int i = tmplt->first_dynamic; i < tmplt->count; i++) {
+      ur_field_id_t id = tmplt->ids[i];
+      ur_get_var_offset(tmplt, rec, id) = 0;
+      ur_get_var_len(tmplt, rec, id) = 0;
+   }
+}
+
+uint16_t ur_rec_varlen_size(const ur_template_t *tmplt, const void *rec)
+{
+   uint32_t size = 0;
+   if (tmplt->first_dynamic < 0) {
+      return 0;
+   }
+   for (int i = tmplt->first_dynamic; i < tmplt->count; i++) {
+      size += ur_get_var_len(tmplt, rec, tmplt->ids[i]);
+   }
+   return (uint16_t) size;
+}
+
+/**
+ * Change length of a dynamic field to len bytes, moving data of the following
+ * fields. Existing content of the field is kept (truncated if shrunk).
+ */
+static int resize_var(const ur_template_t *tmplt, void *rec, int field_id, int len)
+{
+   if (!ur_is_present(tmplt, field_id) || !ur_is_varlen(field_id) || len < 0) {
+      return -1;
+   }
+   uint16_t old_len = ur_get_var_len(tmplt, rec, field_id);
+   uint16_t start = ur_get_var_offset(tmplt, rec, field_id);
+   uint32_t total = ur_rec_varlen_size(tmplt, rec);
+   if ((uint32_t) tmplt->static_size + total - old_len + len > UR_MAX_SIZE) {
+      return -1;
+   }
+   char *dyn = (char *) rec + tmplt->static_size;
+   uint32_t tail = total - start - old_len;
+   memmove(dyn + start + len, dyn + start + old_len, tail);
+   int after = 0;
+   for (int i = tmplt->first_dynamic; i < tmplt->count; i++) {
+      ur_field_id_t id = tmplt->ids[i];
+      if (after) {
+         ur_get_var_offset(tmplt, rec, id) += (int) len - (int) old_len;
+      }
+      after |= id == field_id;
+   }
+   ur_get_var_len(tmplt, rec, field_id) = (uint16_t) len;
+   return 0;
+}
+
+int ur_set_var(const ur_template_t *tmplt, void *rec, int field_id, const void *val_ptr, int val_len)
+{
+   if (resize_var(tmplt, rec, field_id, val_len) != 0) {
+      return -1;
+   }
+   memcpy((char *) rec + tmplt->static_size + ur_get_var_offset(tmplt, rec, field_id), val_ptr, val_len);
+   return 0;
+}
+
+int ur_array_resize(const ur_template_t *tmplt, void *rec, int field_id, int len)
+{
+   return resize_var(tmplt, rec, field_id, len);
+}
+
+void ur_copy_fields(const ur_template_t *dst_tmplt, void *dst, const ur_template_t *src_tmplt, const void *src)
+{
+   for (int i = 0; i < dst_tmplt->count; i++) {
+      ur_field_id_t id = dst_tmplt->ids[i];
+      if (!ur_is_present(src_tmplt, id)) {
+         continue;
+      }
+      if (ur_is_varlen(id)) {
+         ur_set_var(dst_tmplt, dst, id, ur_get_ptr_by_id(src_tmplt, src, id), ur_get_var_len(src_tmplt, src, id));
+      } else {
+         memcpy((char *) dst + dst_tmplt->offset[id], (const char *) src + src_tmplt->offset[id], ur_get_size(id));
+      }
+   }
+}
+
+void ur_finalize()
+{
+   ur_field_specs_t *s = &ur_field_specs;
+   if (!s->initialized) {
+      return;
+   }
+   for (int i = 0; i < s->ur_last_id; i++) {
+      free(s->ur_field_names[i]);
+   }
+   free(s->ur_field_names);
+   free(s->ur_field_sizes);
+   free(s->ur_field_types);
+   s->ur_field_names = UR_FIELD_SPECS_STATIC.ur_field_names;
+   s->ur_field_sizes = UR_FIELD_SPECS_STATIC.ur_field_sizes;
+   s->ur_field_types = UR_FIELD_SPECS_STATIC.ur_field_types;
+   s->ur_last_id = UR_FIELD_SPECS_STATIC.ur_last_id;
+   s->ur_allocated_fields = 0;
+   s->initialized = 0;
+}
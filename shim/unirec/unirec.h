@@ -0,0 +1,243 @@
+/**
+ * \file unirec.h
+ * \brief Minimal in-tree stand-in for the UniRec library.
+ *
+ * Implements the subset of the UniRec API used by feature_engineer_module with
+ * the same record layout and the same macro names, so the module compiles
+ * unchanged against either this shim or the real Nemea framework.
+ *
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef _SHIM_UNIREC_H_
+#define _SHIM_UNIREC_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <libtrap/trap.h>
+#include "ipaddr.h"
+#include "ur_time.h"
+
+typedef int16_t ur_field_id_t;
+
+#define UR_INVALID_OFFSET 0xffff
+#define UR_INVALID_FIELD 0xffff
+#define UR_ITER_BEGIN ((ur_field_id_t) UR_INVALID_FIELD)
+#define UR_ITER_END ((ur_field_id_t) UR_INVALID_FIELD)
+#define UR_MAX_SIZE 0xffff
+
+#define UR_TMPLT_DIRECTION_NO 0
+#define UR_TMPLT_DIRECTION_IN 1
+#define UR_TMPLT_DIRECTION_OUT 2
+#define UR_TMPLT_DIRECTION_BI 3
+
+typedef enum {
+   UR_TYPE_STRING,
+   UR_TYPE_BYTES,
+   UR_TYPE_CHAR,
+   UR_TYPE_UINT8,
+   UR_TYPE_INT8,
+   UR_TYPE_UINT16,
+   UR_TYPE_INT16,
+   UR_TYPE_UINT32,
+   UR_TYPE_INT32,
+   UR_TYPE_UINT64,
+   UR_TYPE_INT64,
+   UR_TYPE_FLOAT,
+   UR_TYPE_DOUBLE,
+   UR_TYPE_IP,
+   UR_TYPE_MAC,
+   UR_TYPE_TIME,
+   UR_TYPE_A_UINT8,
+   UR_TYPE_A_INT8,
+   UR_TYPE_A_UINT16,
+   UR_TYPE_A_INT16,
+   UR_TYPE_A_UINT32,
+   UR_TYPE_A_INT32,
+   UR_TYPE_A_UINT64,
+   UR_TYPE_A_INT64,
+   UR_TYPE_A_FLOAT,
+   UR_TYPE_A_DOUBLE,
+   UR_TYPE_A_IP,
+   UR_TYPE_A_MAC,
+   UR_TYPE_A_TIME
+} ur_field_type_t;
+
+/**
+ * Statically defined fields, generated by ur_processor.sh into fields.c.
+ */
+typedef struct {
+   char **ur_field_names;
+   short *ur_field_sizes;
+   ur_field_type_t *ur_field_types;
+   ur_field_id_t ur_last_id;
+} ur_static_field_specs_t;
+
+/**
+ * All known fields (static ones followed by fields defined at runtime).
+ */
+typedef struct {
+   char **ur_field_names;
+   short *ur_field_sizes;
+   ur_field_type_t *ur_field_types;
+   ur_field_id_t ur_last_statically_defined_id;
+   ur_field_id_t ur_last_id;
+   ur_field_id_t ur_allocated_fields;
+   int initialized;
+} ur_field_specs_t;
+
+extern ur_field_specs_t ur_field_specs;
+extern ur_static_field_specs_t UR_FIELD_SPECS_STATIC;
+
+/**
+ * Template: offset table indexed by field ID plus field IDs in record order.
+ * Static fields come first ordered by size, each dynamic field has a 4 byte
+ * header (offset into the dynamic part, length) at the end of the static part.
+ */
+typedef struct {
+   uint16_t *offset;
+   uint16_t offset_size;
+   ur_field_id_t *ids;
+   uint16_t count;
+   uint16_t static_size;
+   int16_t first_dynamic;
+   int direction;
+   uint32_t ifc_out;
+} ur_template_t;
+
+/** Fields are declared by ur_processor.sh, the macro itself expands to nothing. */
+#define UR_FIELDS(...)
+
+#define ur_get_name(field_id) ur_field_specs.ur_field_names[(field_id)]
+#define ur_get_type(field_id) ur_field_specs.ur_field_types[(field_id)]
+#define ur_get_size(field_id) ur_field_specs.ur_field_sizes[(field_id)]
+#define ur_is_varlen(field_id) (ur_field_specs.ur_field_sizes[(field_id)] < 0)
+#define ur_is_dynamic(field_id) ur_is_varlen(field_id)
+#define ur_is_static(field_id) (!ur_is_varlen(field_id))
+#define ur_is_present(tmplt, field_id) \
+   ((tmplt)->offset_size > (field_id) && (tmplt)->offset[(field_id)] != UR_INVALID_OFFSET)
+
+#define ur_rec_fixlen_size(tmplt) ((tmplt)->static_size)
+#define ur_rec_size(tmplt, rec) (ur_rec_fixlen_size(tmplt) + ur_rec_varlen_size((tmplt), (rec)))
+
+#define ur_get_var_offset(tmplt, rec, field_id) \
+   (*(uint16_t *) ((char *) (rec) + (tmplt)->offset[(field_id)]))
+#define ur_get_len_ptr(tmplt, rec, field_id) \
+   ((uint16_t *) ((char *) (rec) + (tmplt)->offset[(field_id)] + 2))
+#define ur_get_var_len(tmplt, rec, field_id) (*ur_get_len_ptr(tmplt, rec, field_id))
+
+#define ur_get_ptr_by_id(tmplt, data, field_id) \
+   (ur_is_static(field_id) ? \
+      (void *) ((char *) (data) + (tmplt)->offset[(field_id)]) : \
+      (void *) ((char *) (data) + (tmplt)->static_size + ur_get_var_offset(tmplt, data, field_id)))
+
+#define ur_get(tmplt, data, field_id) \
+   (*(field_id ## _T *) ((char *) (data) + (tmplt)->offset[(field_id)]))
+#define ur_get_ptr(tmplt, data, field_id) ((field_id ## _T *) ur_get_ptr_by_id(tmplt, data, field_id))
+#define ur_set(tmplt, data, field_id, value) \
+   (*(field_id ## _T *) ((char *) (data) + (tmplt)->offset[(field_id)]) = (value))
+
+#define ur_array_get_elem_size(field_id) ur_size_of(ur_array_get_elem_type(field_id))
+#define ur_array_get_elem_cnt(tmplt, rec, field_id) \
+   (ur_get_var_len(tmplt, rec, field_id) / ur_array_get_elem_size(field_id))
+#define ur_array_allocate(tmplt, rec, field_id, elem_cnt) \
+   ur_array_resize(tmplt, rec, field_id, (elem_cnt) * ur_array_get_elem_size(field_id))
+#define ur_array_set(tmplt, rec, field_id, index, element) \
+   (((field_id ## _T *) ur_get_ptr_by_id(tmplt, rec, field_id))[(index)] = (element))
+
+int ur_size_of(ur_field_type_t type);
+ur_field_type_t ur_array_get_elem_type(ur_field_id_t field_id);
+const char *ur_get_type_name(ur_field_type_t type);
+
+int ur_define_field(const char *name, ur_field_type_t type);
+int ur_get_id_by_name(const char *name);
+
+ur_template_t *ur_create_template(const char *fields, char **errstr);
+ur_template_t *ur_create_input_template(int ifc, const char *fields, char **errstr);
+ur_template_t *ur_create_output_template(int ifc, const char *fields, char **errstr);
+ur_template_t *ur_create_bidirectional_template(int ifc_in, int ifc_out, const char *fields, char **errstr);
+int ur_set_input_template(int ifc, ur_template_t *tmplt);
+int ur_set_output_template(int ifc, ur_template_t *tmplt);
+ur_template_t *ur_define_fields_and_update_template(const char *ifc_data_fmt, ur_template_t *tmplt);
+char *ur_template_string(const ur_template_t *tmplt);
+char *ur_template_string_delimiter(const ur_template_t *tmplt, int delimiter);
+char *ur_cpy_string(const char *str);
+void ur_free_template(ur_template_t *tmplt);
+ur_field_id_t ur_iter_fields(const ur_template_t *tmplt, ur_field_id_t id);
+ur_field_id_t ur_iter_fields_record_order(const ur_template_t *tmplt, int index);
+
+void *ur_create_record(const ur_template_t *tmplt, uint16_t max_var_size);
+void ur_free_record(void *record);
+void ur_clear_varlen(const ur_template_t *tmplt, void *rec);
+uint16_t ur_rec_varlen_size(const ur_template_t *tmplt, const void *rec);
+int ur_set_var(const ur_template_t *tmplt, void *rec, int field_id, const void *val_ptr, int val_len);
+int ur_array_resize(const ur_template_t *tmplt, void *rec, int field_id, int len);
+void ur_copy_fields(const ur_template_t *dst_tmplt, void *dst, const ur_template_t *src_tmplt, const void *src);
+
+void ur_finalize();
+
+#define ur_set_string(tmplt, rec, field_id, str) \
+   ur_set_var(tmplt, rec, field_id, str, strlen(str))
+
+/**
+ * Receive a record and, on a format change, update the template to the newly
+ * negotiated format (same contract as the real TRAP_RECEIVE).
+ */
+#define TRAP_RECEIVE(ifc_num, data, data_size, tmplt) \
+   trap_recv(ifc_num, &data, &data_size); \
+   if (ret == TRAP_E_FORMAT_CHANGED) { \
+      const char *spec = NULL; \
+      uint8_t data_fmt; \
+      if (trap_get_data_fmt(TRAPIFC_INPUT, ifc_num, &data_fmt, &spec) != TRAP_E_OK) { \
+         fprintf(stderr, "Data format was not loaded."); \
+         return 1; \
+      } else { \
+         tmplt = ur_define_fields_and_update_template(spec, tmplt); \
+         if (tmplt == NULL) { \
+            fprintf(stderr, "Template could not be edited"); \
+            return 1; \
+         } \
+         ret = TRAP_E_OK; \
+      } \
+   }
+
+#endif
@@ -0,0 +1,79 @@
+/**
+ * \file ur_time.h
+ * \brief Minimal stand-in for the UniRec timestamp type.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef _SHIM_UR_TIME_H_
+#define _SHIM_UR_TIME_H_
+
+#include <stdint.h>
+
+/**
+ * Timestamp as 32.32 fixed point number - upper half holds seconds, lower half
+ * holds the fraction of a second in units of 2^-32 s (same as real UniRec).
+ */
+typedef uint64_t ur_time_t;
+
+#define ur_time_from_sec_msec(sec, msec) \
+   (ur_time_t) ((((uint64_t) (sec)) << 32) | ((((uint64_t) (msec)) << 32) / 1000))
+
+#define ur_time_from_sec_usec(sec, usec) \
+   (ur_time_t) ((((uint64_t) (sec)) << 32) | ((((uint64_t) (usec)) << 32) / 1000000))
+
+#define ur_time_get_sec(time) \
+   (uint32_t) ((uint64_t) (time) >> 32)
+
+#define ur_time_get_msec(time) \
+   (uint16_t) ((((uint64_t) (time) & 0xffffffff) * 1000) >> 32)
+
+#define ur_time_get_usec(time) \
+   (uint32_t) ((((uint64_t) (time) & 0xffffffff) * 1000000) >> 32)
+
+/**
+ * Absolute difference of two timestamps in milliseconds.
+ */
+static inline uint64_t ur_timediff(ur_time_t a, ur_time_t b)
+{
+   ur_time_t c = (a > b) ? a - b : b - a;
+   return (uint64_t) ur_time_get_sec(c) * 1000 + ur_time_get_msec(c);
+}
+
+#endif
@@ -0,0 +1,113 @@
+#!/bin/sh
+#
+# Minimal stand-in for the UniRec processor.
+# Collects fields declared in UR_FIELDS() blocks of all .c/.h/.cpp files in
+# the input directory and generates fields.c and fields.h in the output
+# directory (same interface as ur_processor.sh from the Nemea framework).
+#
+# Usage: ur_processor.sh -i INPUT_DIR -o OUTPUT_DIR
+#
+
+indir=.
+outdir=.
+while getopts "i:o:" opt; do
+   case "$opt" in
+   i) indir="$OPTARG" ;;
+   o) outdir="$OPTARG" ;;
+   *) echo "Usage: $0 -i INPUT_DIR -o OUTPUT_DIR" >&2; exit 1 ;;
+   esac
+done
+
+fields=$(for f in "$indir"/*.c "$indir"/*.h "$indir"/*.cpp; do
+   [ -f "$f" ] || continue
+   case "$(basename "$f")" in fields.c|fields.h) continue ;; esac
+   sed -e 's,//.*$,,' "$f" | tr '\n' ' ' | grep -o 'UR_FIELDS *([^)]*)' | \
+      sed -e 's/UR_FIELDS *(//' -e 's/)$//' | tr ',' '\n'
+done | sed -e 's/^[[:space:]]*//' -e 's/[[:space:]]*$//' -e 's/[[:space:]][[:space:]]*/ /g' | \
+   grep -v '^$' | awk '!seen[$2]++')
+
+count=$(printf '%s\n' "$fields" | grep -c .)
+
+c_type() {
+   case "$1" in
+   string|bytes) echo "char" ;;
+   char) echo "char" ;;
+   uint8*|uint8) echo "uint8_t" ;;
+   int8*|int8) echo "int8_t" ;;
+   uint16*|uint16) echo "uint16_t" ;;
+   int16*|int16) echo "int16_t" ;;
+   uint32*|uint32) echo "uint32_t" ;;
+   int32*|int32) echo "int32_t" ;;
+   uint64*|uint64) echo "uint64_t" ;;
+   int64*|int64) echo "int64_t" ;;
+   float*|float) echo "float" ;;
+   double*|double) echo "double" ;;
+   ipaddr*|ipaddr) echo "ip_addr_t" ;;
+   macaddr*|macaddr) echo "mac_addr_t" ;;
+   time*|time) echo "ur_time_t" ;;
+   esac
+}
+
+ur_type() {
+   case "$1" in
+   string) echo "UR_TYPE_STRING" ;;
+   bytes) echo "UR_TYPE_BYTES" ;;
+   *\*) echo "UR_TYPE_A_$(ur_type "${1%\*}" | sed 's/UR_TYPE_//')" ;;
+   ipaddr) echo "UR_TYPE_IP" ;;
+   macaddr) echo "UR_TYPE_MAC" ;;
+   *) echo "UR_TYPE_$(echo "$1" | tr 'a-z' 'A-Z')" ;;
+   esac
+}
+
+ur_size() {
+   case "$1" in
+   string|bytes|*\*) echo "-1" ;;
+   char|uint8|int8) echo "1" ;;
+   uint16|int16) echo "2" ;;
+   uint32|int32|float) echo "4" ;;
+   uint64|int64|double|time) echo "8" ;;
+   macaddr) echo "6" ;;
+   ipaddr) echo "16" ;;
+   esac
+}
+
+{
+   echo "#ifndef _UR_FIELDS_H_"
+   echo "#define _UR_FIELDS_H_"
+   echo "/* Generated by the UniRec processor stand-in, do not edit. */"
+   echo "#include <unirec/unirec.h>"
+   id=0
+   printf '%s\n' "$fields" | while read -r type name; do
+      [ -n "$name" ] || continue
+      echo "#define F_$name $id"
+      echo "#define F_${name}_T $(c_type "$type")"
+      id=$((id + 1))
+   done
+   echo "extern uint16_t ur_last_id;"
+   echo "extern ur_static_field_specs_t UR_FIELD_SPECS_STATIC;"
+   echo "extern ur_field_specs_t ur_field_specs;"
+   echo "#endif"
+} > "$outdir/fields.h"
+
+{
+   echo "/* Generated by the UniRec processor stand-in, do not edit. */"
+   echo "#include <unirec/unirec.h>"
+   echo "char *ur_field_names_static[] = {"
+   printf '%s\n' "$fields" | while read -r type name; do
+      [ -n "$name" ] && echo "   \"$name\","
+   done
+   echo "};"
+   echo "short ur_field_sizes_static[] = {"
+   printf '%s\n' "$fields" | while read -r type name; do
+      [ -n "$name" ] && echo "   $(ur_size "$type"),"
+   done
+   echo "};"
+   echo "ur_field_type_t ur_field_types_static[] = {"
+   printf '%s\n' "$fields" | while read -r type name; do
+      [ -n "$name" ] && echo "   $(ur_type "$type"),"
+   done
+   echo "};"
+   echo "uint16_t ur_last_id = $count;"
+   echo "ur_static_field_specs_t UR_FIELD_SPECS_STATIC = {ur_field_names_static, ur_field_sizes_static, ur_field_types_static, $count};"
+   echo "ur_field_specs_t ur_field_specs = {ur_field_names_static, ur_field_sizes_static, ur_field_types_static, $count, $count, 0, 0};"
+} > "$outdir/fields.c"
@@ -0,0 +1,372 @@
+/**
+ * \file stats.c
+ * \brief Export of runtime statistics as UniRec records.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <libtrap/trap.h>
+#include <unirec/unirec.h>
+#include "fields.h"
+#include "stats.h"
+
+/**
+ * Fields of the statistics records
+ */
+UR_FIELDS (
+   time TIME_FIRST,
+   time TIME_LAST,
+   uint64 RECORDS_IN,
+   uint64 RECORDS_OUT,
+   uint64 SEND_ERRORS,
+   uint64 SHORT_RECORDS,
+   uint64 PROCESS_ERRORS,
+   uint64* INPUT_RECORDS_IN,
+   uint64* INPUT_SHORT_RECORDS,
+   uint64 RECV_LAT_CNT,
+   uint64 RECV_LAT_P50,
+   uint64 RECV_LAT_P90,
+   uint64 RECV_LAT_P99,
+   uint64 RECV_LAT_P999,
+   uint64 RECV_LAT_MAX,
+   uint64 PROC_LAT_CNT,
+   uint64 PROC_LAT_P50,
+   uint64 PROC_LAT_P90,
+   uint64 PROC_LAT_P99,
+   uint64 PROC_LAT_P999,
+   uint64 PROC_LAT_MAX,
+   uint64 SEND_LAT_CNT,
+   uint64 SEND_LAT_P50,
+   uint64 SEND_LAT_P90,
+   uint64 SEND_LAT_P99,
+   uint64 SEND_LAT_P999,
+   uint64 SEND_LAT_MAX
+)
+
+#define STATS_GEN_COUNTER_SPEC(name) "," #name
+#define STATS_GEN_STAGE_SPEC(name) \
+   "," #name "_LAT_CNT," #name "_LAT_P50," #name "_LAT_P90," #name "_LAT_P99," #name "_LAT_P999," #name "_LAT_MAX"
+#define STATS_GEN_INPUT_SPEC(name) "," #name ",INPUT_" #name
+#define STATS_GEN_COUNTER_ID(name) F_##name,
+#define STATS_GEN_INPUT_ID(name) F_##name,
+#define STATS_GEN_INPUT_ARRAY_ID(name) F_INPUT_##name,
+#define STATS_GEN_STAGE_IDS(name) \
+   {F_##name##_LAT_P50, F_##name##_LAT_P90, F_##name##_LAT_P99, F_##name##_LAT_P999},
+
+/**
+ * Template of the statistics records
+ */
+#define STATS_SPEC "TIME_FIRST,TIME_LAST" STATS_COUNTERS(STATS_GEN_COUNTER_SPEC) \
+   STATS_INPUT_COUNTERS(STATS_GEN_INPUT_SPEC) STATS_STAGES(STATS_GEN_STAGE_SPEC)
+
+/**
+ * Exported percentiles of the latency histograms
+ */
+#define STATS_PERCENTILE_CNT 4
+static const double stats_percentiles[STATS_PERCENTILE_CNT] = {0.5, 0.9, 0.99, 0.999};
+
+static const ur_field_id_t stats_counter_ids[STATS_COUNTER_CNT] = {STATS_COUNTERS(STATS_GEN_COUNTER_ID)};
+static const ur_field_id_t stats_input_ids[STATS_INPUT_COUNTER_CNT] = {STATS_INPUT_COUNTERS(STATS_GEN_INPUT_ID)};
+static const ur_field_id_t stats_input_array_ids[STATS_INPUT_COUNTER_CNT] = {
+   STATS_INPUT_COUNTERS(STATS_GEN_INPUT_ARRAY_ID)
+};
+static const ur_field_id_t stats_cnt_ids[STATS_STAGE_CNT] = {F_RECV_LAT_CNT, F_PROC_LAT_CNT, F_SEND_LAT_CNT};
+static const ur_field_id_t stats_max_ids[STATS_STAGE_CNT] = {F_RECV_LAT_MAX, F_PROC_LAT_MAX, F_SEND_LAT_MAX};
+static const ur_field_id_t stats_percentile_ids[STATS_STAGE_CNT][STATS_PERCENTILE_CNT] = {
+   STATS_STAGES(STATS_GEN_STAGE_IDS)
+};
+
+__thread stats_thread_t *stats_tls = NULL;
+
+stats_thread_t *stats_register(stats_t *s)
+{
+   uint32_t idx = __atomic_fetch_add(&s->registered, 1, __ATOMIC_ACQ_REL);
+   // Should not happen, the creator sizes the statistics for all its threads
+   return &s->threads[idx < s->thread_cnt ? idx : s->thread_cnt];
+}
+
+/**
+ * Highest value stored into a histogram bucket
+ */
+static uint64_t stats_hist_value(uint32_t bucket)
+{
+   if (bucket < STATS_HIST_SUB) {
+      return bucket;
+   }
+   uint32_t shift = bucket / STATS_HIST_SUB - 1;
+   uint64_t low = (uint64_t) (STATS_HIST_SUB + bucket % STATS_HIST_SUB) << shift;
+   return low + (((uint64_t) 1 << shift) - 1);
+}
+
+static ur_time_t stats_wall_time(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_REALTIME, &ts);
+   return ur_time_from_sec_usec(ts.tv_sec, ts.tv_nsec / 1000);
+}
+
+static void stats_set(stats_t *s, ur_field_id_t id, uint64_t value)
+{
+   memcpy(ur_get_ptr_by_id(s->tmplt, s->rec, id), &value, sizeof(value));
+}
+
+/**
+ * Fill latency fields of a stage from the histogram of the last interval (cur - prev).
+ */
+static void stats_fill_stage(stats_t *s, int stage)
+{
+   const uint64_t *cur = s->cur + (size_t) stage * STATS_HIST_BUCKETS;
+   const uint64_t *prev = s->prev + (size_t) stage * STATS_HIST_BUCKETS;
+   uint64_t total = 0;
+   uint64_t max = 0;
+
+   for (uint32_t b = 0; b < STATS_HIST_BUCKETS; b++) {
+      if (cur[b] != prev[b]) {
+         total += cur[b] - prev[b];
+         max = stats_hist_value(b);
+      }
+   }
+   stats_set(s, stats_cnt_ids[stage], total);
+   stats_set(s, stats_max_ids[stage], max);
+
+   uint64_t seen = 0;
+   uint32_t b = 0;
+   for (int i = 0; i < STATS_PERCENTILE_CNT; i++) {
+      uint64_t rank = (uint64_t) (stats_percentiles[i] * total + 0.5);
+      if (rank == 0) {
+         rank = 1;
+      }
+      while (total > 0 && seen < rank && b < STATS_HIST_BUCKETS) {
+         seen += cur[b] - prev[b];
+         b++;
+      }
+      stats_set(s, stats_percentile_ids[stage][i], total > 0 ? stats_hist_value(b - 1) : 0);
+   }
+}
+
+/**
+ * Sum blocks of all threads and send one statistics record.
+ */
+static void stats_export(stats_t *s)
+{
+   uint64_t counters[STATS_COUNTER_CNT] = {0};
+   uint32_t cnt = __atomic_load_n(&s->registered, __ATOMIC_ACQUIRE);
+   size_t hist_cnt = (size_t) STATS_STAGE_CNT * STATS_HIST_BUCKETS;
+
+   if (cnt > s->thread_cnt) {
+      cnt = s->thread_cnt;
+   }
+   memset(s->cur, 0, hist_cnt * sizeof(uint64_t));
+   for (uint32_t t = 0; t < cnt; t++) {
+      const stats_thread_t *block = &s->threads[t];
+      for (int c = 0; c < STATS_COUNTER_CNT; c++) {
+         counters[c] += __atomic_load_n(&block->counters[c], __ATOMIC_RELAXED);
+      }
+      const uint64_t *hist = &block->hist[0][0];
+      for (size_t b = 0; b < hist_cnt; b++) {
+         s->cur[b] += __atomic_load_n(&hist[b], __ATOMIC_RELAXED);
+      }
+   }
+
+   ur_time_t now = stats_wall_time();
+   ur_set(s->tmplt, s->rec, F_TIME_FIRST, s->last);
+   ur_set(s->tmplt, s->rec, F_TIME_LAST, now);
+   s->last = now;
+   for (int c = 0; c < STATS_COUNTER_CNT; c++) {
+      stats_set(s, stats_counter_ids[c], counters[c]);
+   }
+   for (int c = 0; c < STATS_INPUT_COUNTER_CNT; c++) {
+      uint64_t total = 0;
+      for (uint32_t i = 0; i < s->input_cnt; i++) {
+         s->input_values[i] = __atomic_load_n(&s->inputs[i].counters[c], __ATOMIC_RELAXED);
+         total += s->input_values[i];
+      }
+      stats_set(s, stats_input_ids[c], total);
+      ur_set_var(s->tmplt, s->rec, stats_input_array_ids[c], s->input_values, s->input_cnt * sizeof(uint64_t));
+   }
+   for (int stage = 0; stage < STATS_STAGE_CNT; stage++) {
+      stats_fill_stage(s, stage);
+   }
+   if (s->fill != NULL) {
+      s->fill(s->tmplt, s->rec, s->fill_arg);
+   }
+   uint64_t *tmp = s->prev;
+   s->prev = s->cur;
+   s->cur = tmp;
+
+   int ret = trap_send(s->ifc, s->rec, ur_rec_size(s->tmplt, s->rec));
+   if (ret != TRAP_E_OK && ret != TRAP_E_TERMINATED && ret != TRAP_E_TIMEOUT) {
+      fprintf(stderr, "Error: trap_send() of statistics returned %i (%s)\n", ret, trap_last_error_msg);
+   }
+   trap_send_flush(s->ifc);
+}
+
+static void *stats_main(void *arg)
+{
+   stats_t *s = (stats_t *)arg;
+   struct timespec deadline;
+
+   pthread_mutex_lock(&s->lock);
+   while (!s->stop) {
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_sec += s->interval;
+      while (!s->stop && pthread_cond_timedwait(&s->cond, &s->lock, &deadline) != ETIMEDOUT) {
+      }
+      pthread_mutex_unlock(&s->lock);
+      stats_export(s);
+      pthread_mutex_lock(&s->lock);
+   }
+   pthread_mutex_unlock(&s->lock);
+   return NULL;
+}
+
+stats_t *stats_create(uint32_t thread_cnt, uint32_t input_cnt, uint32_t ifc, uint32_t interval)
+{
+   stats_t *s = calloc(1, sizeof(stats_t));
+   if (s == NULL) {
+      return NULL;
+   }
+   s->thread_cnt = thread_cnt;
+   s->input_cnt = input_cnt;
+   s->ifc = ifc;
+   s->interval = interval;
+   size_t size = ((size_t) thread_cnt + 1) * sizeof(stats_thread_t);
+   if (posix_memalign((void **) &s->threads, 64, size) != 0) {
+      s->threads = NULL;
+      stats_destroy(s);
+      return NULL;
+   }
+   memset(s->threads, 0, size);
+   size = (size_t) input_cnt * sizeof(stats_input_t);
+   if (posix_memalign((void **) &s->inputs, 64, size) != 0) {
+      s->inputs = NULL;
+      stats_destroy(s);
+      return NULL;
+   }
+   memset(s->inputs, 0, size);
+   s->input_values = calloc(input_cnt, sizeof(uint64_t));
+   s->prev = calloc((size_t) STATS_STAGE_CNT * STATS_HIST_BUCKETS, sizeof(uint64_t));
+   s->cur = calloc((size_t) STATS_STAGE_CNT * STATS_HIST_BUCKETS, sizeof(uint64_t));
+   s->tmplt = ur_create_output_template(ifc, STATS_SPEC, NULL);
+   if (s->input_values == NULL || s->prev == NULL || s->cur == NULL || s->tmplt == NULL) {
+      stats_destroy(s);
+      return NULL;
+   }
+   s->rec = ur_create_record(s->tmplt, STATS_INPUT_COUNTER_CNT * input_cnt * sizeof(uint64_t));
+   if (s->rec == NULL) {
+      stats_destroy(s);
+      return NULL;
+   }
+   pthread_mutex_init(&s->lock, NULL);
+   pthread_cond_init(&s->cond, NULL);
+   s->last = stats_wall_time();
+   return s;
+}
+
+int stats_extend(stats_t *s, const char *spec, uint32_t var_size, stats_fill_t fill, void *arg)
+{
+   char *full_spec = malloc(sizeof(STATS_SPEC) + strlen(spec) + 1);
+   if (full_spec == NULL) {
+      return -1;
+   }
+   sprintf(full_spec, "%s,%s", STATS_SPEC, spec);
+   ur_template_t *tmplt = ur_create_output_template(s->ifc, full_spec, NULL);
+   free(full_spec);
+   if (tmplt == NULL) {
+      return -1;
+   }
+   void *rec = ur_create_record(tmplt, STATS_INPUT_COUNTER_CNT * s->input_cnt * sizeof(uint64_t) + var_size);
+   if (rec == NULL) {
+      ur_free_template(tmplt);
+      return -1;
+   }
+   ur_free_record(s->rec);
+   ur_free_template(s->tmplt);
+   s->tmplt = tmplt;
+   s->rec = rec;
+   s->fill = fill;
+   s->fill_arg = arg;
+   return 0;
+}
+
+int stats_start(stats_t *s)
+{
+   if (pthread_create(&s->thread, NULL, stats_main, s) != 0) {
+      return -1;
+   }
+   s->running = 1;
+   return 0;
+}
+
+void stats_stop(stats_t *s)
+{
+   if (!s->running) {
+      return;
+   }
+   pthread_mutex_lock(&s->lock);
+   s->stop = 1;
+   pthread_cond_signal(&s->cond);
+   pthread_mutex_unlock(&s->lock);
+   pthread_join(s->thread, NULL);
+   s->running = 0;
+}
+
+void stats_destroy(stats_t *s)
+{
+   if (s == NULL) {
+      return;
+   }
+   stats_stop(s);
+   if (s->rec != NULL) {
+      pthread_mutex_destroy(&s->lock);
+      pthread_cond_destroy(&s->cond);
+      ur_free_record(s->rec);
+   }
+   ur_free_template(s->tmplt);
+   free(s->prev);
+   free(s->cur);
+   free(s->threads);
+   free(s->inputs);
+   free(s->input_values);
+   free(s);
+}
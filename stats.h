@@ -0,0 +1,254 @@
+/**
+ * \file stats.h
+ * \brief Runtime counters and latency histograms of the module threads.
+ * \author Jaroslav Pesek <jaroslav.pesek@fit.cvut.cz>
+ * \date 2022
+ */
+/*
+ * Copyright (C) 2022 CESNET
+ *
+ * LICENSE TERMS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is'', and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <unirec/unirec.h>
+
+/**
+ * Event counters, exported as uint64 fields of the same name (totals since start).
+ */
+#define STATS_COUNTERS(X) \
+   X(RECORDS_OUT) \
+   X(SEND_ERRORS) \
+   X(PROCESS_ERRORS)
+
+/**
+ * Counters of each input interface, exported as uint64 fields of the same
+ * name (sum over all inputs) and as uint64 arrays INPUT_<name> (per input).
+ */
+#define STATS_INPUT_COUNTERS(X) \
+   X(RECORDS_IN) \
+   X(SHORT_RECORDS)
+
+/**
+ * Measured stages: receiving a record, process_flow() and sending a record.
+ * Each is exported as <STAGE>_LAT_CNT (records measured in the interval) and
+ * <STAGE>_LAT_P50, _P90, _P99, _P999, _MAX in nanoseconds.
+ */
+#define STATS_STAGES(X) \
+   X(RECV) \
+   X(PROC) \
+   X(SEND)
+
+#define STATS_GEN_COUNTER_ENUM(name) STATS_ ## name,
+#define STATS_GEN_INPUT_COUNTER_ENUM(name) STATS_INPUT_ ## name,
+#define STATS_GEN_STAGE_ENUM(name) STATS_STAGE_ ## name,
+
+enum {
+   STATS_COUNTERS(STATS_GEN_COUNTER_ENUM)
+   STATS_COUNTER_CNT
+};
+
+enum {
+   STATS_INPUT_COUNTERS(STATS_GEN_INPUT_COUNTER_ENUM)
+   STATS_INPUT_COUNTER_CNT
+};
+
+enum {
+   STATS_STAGES(STATS_GEN_STAGE_ENUM)
+   STATS_STAGE_CNT
+};
+
+/**
+ * Latency histograms are log-linear (as HDR histograms): each power of two is
+ * split into 2^STATS_HIST_SUB_BITS buckets, so any value is stored with
+ * a relative error below 1/16 and the whole uint64 range fits into
+ * STATS_HIST_BUCKETS buckets.
+ */
+#define STATS_HIST_SUB_BITS 4
+#define STATS_HIST_SUB (1 << STATS_HIST_SUB_BITS)
+#define STATS_HIST_BUCKETS ((64 - STATS_HIST_SUB_BITS + 1) * STATS_HIST_SUB)
+
+/**
+ * Statistics of one thread. Only the owning thread writes it, the exporting
+ * thread reads it with relaxed atomic loads, so no locks are needed and the
+ * blocks of different threads do not share cache lines.
+ */
+typedef struct stats_thread_s {
+   uint64_t counters[STATS_COUNTER_CNT];
+   uint64_t hist[STATS_STAGE_CNT][STATS_HIST_BUCKETS];
+} __attribute__((aligned(64))) stats_thread_t;
+
+/**
+ * Counters of one input interface, written only by the thread receiving from it.
+ */
+typedef struct stats_input_s {
+   uint64_t counters[STATS_INPUT_COUNTER_CNT];
+} __attribute__((aligned(64))) stats_input_t;
+
+/**
+ * Callback filling additional fields of the statistics record, called by the exporting thread
+ */
+typedef void (*stats_fill_t)(const ur_template_t *tmplt, void *rec, void *arg);
+
+typedef struct stats_s {
+   stats_thread_t *threads;  ///< per thread blocks followed by a spare one for threads over thread_cnt
+   uint32_t thread_cnt;      ///< number of exported blocks
+   uint32_t registered;      ///< number of blocks claimed by threads
+   stats_input_t *inputs;    ///< counters of the input interfaces
+   uint32_t input_cnt;       ///< number of input interfaces
+   uint64_t *input_values;   ///< per input values of one exported array
+   uint32_t ifc;             ///< output interface of the statistics records
+   uint32_t interval;        ///< export interval in seconds
+   ur_template_t *tmplt;     ///< template of the statistics records
+   void *rec;                ///< statistics record
+   uint64_t *prev;           ///< histograms summed at the previous export
+   uint64_t *cur;            ///< histograms summed at this export
+   ur_time_t last;           ///< time of the previous export
+   stats_fill_t fill;        ///< fills additional fields (stats_extend()), NULL if there are none
+   void *fill_arg;
+   pthread_t thread;
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+   int running;              ///< the export thread was started
+   int stop;                 ///< the export thread should send the final record and exit
+} stats_t;
+
+/**
+ * Block of the calling thread, claimed on the first use.
+ */
+extern __thread stats_thread_t *stats_tls;
+
+stats_thread_t *stats_register(stats_t *s);
+
+static inline stats_thread_t *stats_thread(stats_t *s)
+{
+   if (stats_tls == NULL) {
+      stats_tls = stats_register(s);
+   }
+   return stats_tls;
+}
+
+/**
+ * Monotonic time in nanoseconds used for latency measurement.
+ */
+static inline uint64_t stats_now(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline void stats_add(uint64_t *c, uint64_t n)
+{
+   __atomic_store_n(c, __atomic_load_n(c, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+/**
+ * Histogram bucket of a value
+ */
+static inline uint32_t stats_hist_bucket(uint64_t v)
+{
+   if (v < STATS_HIST_SUB) {
+      return (uint32_t) v;
+   }
+   uint32_t e = 63 - __builtin_clzll(v);
+   return (e - STATS_HIST_SUB_BITS + 1) * STATS_HIST_SUB +
+          (uint32_t) ((v >> (e - STATS_HIST_SUB_BITS)) & (STATS_HIST_SUB - 1));
+}
+
+/**
+ * Add n to a counter of the calling thread. Does nothing when statistics are disabled (s is NULL).
+ */
+static inline void stats_count(stats_t *s, int counter, uint64_t n)
+{
+   if (s != NULL) {
+      stats_add(&stats_thread(s)->counters[counter], n);
+   }
+}
+
+/**
+ * Add n to a counter of an input interface. Must be called only from the
+ * thread receiving from the input. Does nothing when statistics are disabled.
+ */
+static inline void stats_count_input(stats_t *s, uint32_t input, int counter, uint64_t n)
+{
+   if (s != NULL) {
+      stats_add(&s->inputs[input].counters[counter], n);
+   }
+}
+
+/**
+ * Record a stage which took elapsed nanoseconds for cnt records, i.e. cnt
+ * records with the average latency. Batches are timed as a whole, so the
+ * latencies are exact per record only with batch size 1.
+ */
+static inline void stats_latency(stats_t *s, int stage, uint64_t elapsed, uint32_t cnt)
+{
+   if (s != NULL && cnt > 0) {
+      stats_add(&stats_thread(s)->hist[stage][stats_hist_bucket(elapsed / cnt)], cnt);
+   }
+}
+
+/**
+ * Create statistics for up to thread_cnt threads and input_cnt input
+ * interfaces, exported every interval seconds to output interface ifc.
+ * Returns NULL on failure.
+ */
+stats_t *stats_create(uint32_t thread_cnt, uint32_t input_cnt, uint32_t ifc, uint32_t interval);
+
+/**
+ * Add fields (comma separated spec) filled by fill to the statistics records,
+ * var_size bytes are reserved for their variable length data. Must be called
+ * before stats_start(). Returns 0 on success, -1 on failure.
+ */
+int stats_extend(stats_t *s, const char *spec, uint32_t var_size, stats_fill_t fill, void *arg);
+
+/**
+ * Start the thread exporting the statistics. Returns 0 on success, -1 on failure.
+ */
+int stats_start(stats_t *s);
+
+/**
+ * Export the final statistics record and stop the exporting thread.
+ */
+void stats_stop(stats_t *s);
+
+void stats_destroy(stats_t *s);
+
+#endif